@@ -0,0 +1,527 @@
+/*
+ *  Copyright 2018 Digital Media Professionals Inc.
+
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+
+ *      http://www.apache.org/licenses/LICENSE-2.0
+
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+/// @file
+/// @brief CPU cache maintenance of device-accessible memory.
+#pragma once
+
+#include "common.h"
+#include "mem_stats.hpp"
+
+#include <time.h>
+#include <math.h>
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <algorithm>
+
+
+#define CACHE_LINE_SIZE 64
+#define CACHE_LINE_LOG2 6
+
+
+/// @brief Range for the cache maintenance.
+struct DMPDVCacheRange {
+  int fd;                // dma-buf file descriptor of the buffer
+  uint8_t *start;        // CPU address of the start of the range, NULL when the range is not mapped
+  uint8_t *end;          // CPU address of the end of the range, NULL when the range is not mapped
+  size_t buf_size;       // size of the whole buffer
+  bool invalidate;       // invalidate cache lines after writing them to RAM
+  int dma_buf_flags;     // DMA_BUF_SYNC_WRITE or DMA_BUF_SYNC_READ if DMA_BUF_IOCTL_SYNC is allowed, 0 otherwise
+  bool done_by_dma_buf;  // set when the whole buffer was processed with DMA_BUF_IOCTL_SYNC
+  bool barrier_only;     // buffer is not cached by CPU, only the barrier is required
+};
+
+
+/// @brief Cache maintenance engine.
+/// @details Chooses the cheapest of three paths for each range according to the cost model:
+///          per-line maintenance in the calling thread,
+///          per-line maintenance split across worker threads (each thread issues its own barrier,
+///          as DSB waits only for the maintenance issued by the same core),
+///          DMA_BUF_IOCTL_SYNC over the whole buffer, which is done by the kernel.
+class CDMPDVCacheEngine {
+ public:
+  /// @brief Writes CPU cache lines covering the range to RAM, so the device will see the CPU writes.
+  /// @param fd dma-buf file descriptor of the buffer.
+  /// @param ptr CPU address of the start of the range.
+  /// @param size Size of the range in bytes.
+  /// @param buf_size Size of the whole buffer in bytes.
+  /// @param invalidate Invalidate cache lines after writing them to RAM.
+  /// @param allow_dma_buf_sync Allow DMA_BUF_IOCTL_SYNC over the whole buffer.
+  /// @return 0 on success, non-zero otherwise.
+  static int ToDevice(int fd, uint8_t *ptr, size_t size, size_t buf_size, bool invalidate, bool allow_dma_buf_sync) {
+    return Flush(fd, ptr, size, buf_size, invalidate, allow_dma_buf_sync ? DMA_BUF_SYNC_WRITE : 0);
+  }
+
+  /// @brief Invalidates CPU cache lines covering the range, so the CPU will see the device writes.
+  /// @param fd dma-buf file descriptor of the buffer.
+  /// @param ptr CPU address of the start of the range.
+  /// @param size Size of the range in bytes.
+  /// @param buf_size Size of the whole buffer in bytes.
+  /// @param allow_dma_buf_sync Allow DMA_BUF_IOCTL_SYNC over the whole buffer.
+  /// @return 0 on success, non-zero otherwise.
+  static int ToCPU(int fd, uint8_t *ptr, size_t size, size_t buf_size, bool allow_dma_buf_sync) {
+    return Flush(fd, ptr, size, buf_size, true, allow_dma_buf_sync ? DMA_BUF_SYNC_READ : 0);
+  }
+
+  /// @brief Fills the current cost model parameters.
+  static void GetParams(struct dmp_dv_cache_params *params) {
+    std::lock_guard<std::mutex> lock(params_mutex_);
+    *params = params_;
+  }
+
+  /// @brief Replaces the cost model parameters.
+  /// @return 0 on success, non-zero otherwise.
+  static int SetParams(const struct dmp_dv_cache_params *params) {
+    if ((params->line_ns < 0.0) || (params->sync_fixed_ns < 0.0) || (params->sync_byte_ns < 0.0) ||
+        (params->thread_ns < 0.0) || (params->max_threads < 1)) {
+      SET_ERR("Invalid argument: cache cost model parameters must be non-negative and max_threads must be positive");
+      return EINVAL;
+    }
+    std::lock_guard<std::mutex> lock(params_mutex_);
+    params_ = *params;
+    return 0;
+  }
+
+  /// @brief Measures the cost model parameters on the provided buffers and makes them current.
+  /// @param fd_big dma-buf file descriptor of the big buffer.
+  /// @param ptr_big CPU address of the mapped big buffer.
+  /// @param size_big Size of the big buffer in bytes.
+  /// @param fd_small dma-buf file descriptor of the small buffer.
+  /// @param size_small Size of the small buffer in bytes.
+  /// @param params Structure to be filled with the measured parameters, can be NULL.
+  /// @return 0 on success, non-zero otherwise.
+  static int Calibrate(int fd_big, uint8_t *ptr_big, size_t size_big,
+                       int fd_small, size_t size_small, struct dmp_dv_cache_params *params) {
+    static const int n_rep = 3;
+    struct dmp_dv_cache_params new_params;
+    GetParams(&new_params);
+
+    // CPU maintenance of dirty lines
+    double t_lines = 1.0e30;
+    for (int i = 0; i < n_rep; ++i) {
+      memset(ptr_big, i, size_big);
+      const double t0 = GetNs();
+      FlushLines<false>(ptr_big, ptr_big + size_big);
+      Barrier();
+      t_lines = std::min(t_lines, GetNs() - t0);
+    }
+    new_params.line_ns = t_lines / (size_big >> CACHE_LINE_LOG2);
+
+    // Kernel maintenance of the whole buffer
+    double t_sync_big = 1.0e30, t_sync_small = 1.0e30;
+    for (int i = 0; i < n_rep; ++i) {
+      memset(ptr_big, i, size_big);
+      double t0 = GetNs();
+      int res = DmaBufSync(fd_big, DMA_BUF_SYNC_WRITE);
+      if (res) {
+        return res;
+      }
+      t_sync_big = std::min(t_sync_big, GetNs() - t0);
+      t0 = GetNs();
+      res = DmaBufSync(fd_small, DMA_BUF_SYNC_WRITE);
+      if (res) {
+        return res;
+      }
+      t_sync_small = std::min(t_sync_small, GetNs() - t0);
+    }
+    new_params.sync_byte_ns = std::max(t_sync_big - t_sync_small, 0.0) / (size_big - size_small);
+    new_params.sync_fixed_ns = std::max(t_sync_small - new_params.sync_byte_ns * size_small, 0.0);
+
+    // Worker thread startup
+    const int n_threads = std::max((int)std::thread::hardware_concurrency(), 1);
+    double t_threads = 1.0e30;
+    for (int i = 0; i < n_rep; ++i) {
+      std::vector<std::thread> workers;
+      const double t0 = GetNs();
+      try {
+        for (int j = 0; j < n_threads; ++j) {
+          workers.push_back(std::thread([](){}));
+        }
+      }
+      catch (...) {
+        // ignore, the cost will be measured on the started threads
+      }
+      for (auto it = workers.begin(); it != workers.end(); ++it) {
+        it->join();
+      }
+      if (workers.size()) {
+        t_threads = std::min(t_threads, (GetNs() - t0) / workers.size());
+      }
+    }
+    new_params.thread_ns = t_threads < 1.0e30 ? t_threads : new_params.thread_ns;
+    new_params.max_threads = n_threads;
+
+    SetParams(&new_params);
+    if (params) {
+      *params = new_params;
+    }
+    return 0;
+  }
+
+  /// @brief Does the cache maintenance of the batch of ranges with a single barrier for the CPU loops.
+  /// @details Ranges of the same buffer with the same kind of maintenance which overlap or are adjacent are merged,
+  ///          ranges for which the cost model prefers DMA_BUF_IOCTL_SYNC or worker threads use those paths,
+  ///          all the other ranges are processed back to back by the calling thread followed by one barrier.
+  ///          The order of the ranges is changed.
+  /// @return 0 on success, non-zero otherwise.
+  static int FlushBatch(std::vector<DMPDVCacheRange>& ranges) {
+    if (ranges.empty()) {
+      return 0;
+    }
+    std::sort(ranges.begin(), ranges.end(), [](const DMPDVCacheRange& a, const DMPDVCacheRange& b) {
+      if (a.fd != b.fd) {
+        return a.fd < b.fd;
+      }
+      if (a.invalidate != b.invalidate) {
+        return a.invalidate < b.invalidate;
+      }
+      if (a.dma_buf_flags != b.dma_buf_flags) {
+        return a.dma_buf_flags < b.dma_buf_flags;
+      }
+      return a.start < b.start;
+    });
+    size_t n = 0;
+    for (size_t i = 1; i < ranges.size(); ++i) {
+      DMPDVCacheRange& last = ranges[n];
+      const DMPDVCacheRange& range = ranges[i];
+      if ((range.fd == last.fd) && (range.invalidate == last.invalidate) &&
+          (range.dma_buf_flags == last.dma_buf_flags) && (AlignDown(range.start) <= last.end)) {
+        last.end = std::max(last.end, range.end);
+        continue;
+      }
+      ranges[++n] = range;
+    }
+    ranges.resize(n + 1);
+
+    struct dmp_dv_cache_params params;
+    GetParams(&params);
+    bool need_barrier = false;
+    for (size_t i = 0; i < ranges.size(); ++i) {
+      if ((i) && (ranges[i].fd == ranges[i - 1].fd) && (ranges[i].dma_buf_flags) &&
+          (ranges[i].dma_buf_flags == ranges[i - 1].dma_buf_flags) && (ranges[i - 1].done_by_dma_buf)) {
+        ranges[i].done_by_dma_buf = true;  // whole buffer was already processed
+        continue;
+      }
+      int res = FlushRange(ranges[i], params, &need_barrier);
+      if (res) {
+        return res;
+      }
+    }
+    if (need_barrier) {
+      Barrier();
+    }
+    return 0;
+  }
+
+  /// @brief Does the cache maintenance choosing the path according to the cost model.
+  /// @param dma_buf_flags DMA_BUF_SYNC_WRITE or DMA_BUF_SYNC_READ if DMA_BUF_IOCTL_SYNC is allowed, 0 otherwise.
+  static int Flush(int fd, uint8_t *ptr, size_t size, size_t buf_size, bool invalidate, int dma_buf_flags) {
+    if (!size) {
+      return 0;
+    }
+    DMPDVCacheRange range = {fd, ptr, ptr + size, buf_size, invalidate, dma_buf_flags, false, false};
+    struct dmp_dv_cache_params params;
+    GetParams(&params);
+    bool need_barrier = false;
+    int res = FlushRange(range, params, &need_barrier);
+    if (need_barrier) {
+      Barrier();
+    }
+    return res;
+  }
+
+  /// @brief Copies data to device-accessible memory writing each destination cache line to RAM as soon as it is filled.
+  /// @param dst CPU address of the destination.
+  /// @param src CPU address of the source, must not overlap with the destination.
+  /// @param size Number of bytes to copy.
+  /// @param cached Destination is cached by CPU, otherwise only the write buffers are drained.
+  /// @param invalidate Invalidate destination cache lines after writing them to RAM.
+  static void CopyToDevice(uint8_t *dst, const uint8_t *src, size_t size, bool cached, bool invalidate) {
+    if (!cached) {
+      memcpy(dst, src, size);
+    }
+    else if (invalidate) {
+      StreamLines<true, false>(dst, src, 0, size);
+    }
+    else {
+      StreamLines<false, false>(dst, src, 0, size);
+    }
+    Barrier();
+  }
+
+  /// @brief Fills device-accessible memory writing each cache line to RAM as soon as it is filled.
+  /// @param dst CPU address of the destination.
+  /// @param value Byte value to fill with.
+  /// @param size Number of bytes to fill.
+  /// @param cached Destination is cached by CPU, otherwise only the write buffers are drained.
+  /// @param invalidate Invalidate destination cache lines after writing them to RAM.
+  static void FillToDevice(uint8_t *dst, uint8_t value, size_t size, bool cached, bool invalidate) {
+    if (!cached) {
+      memset(dst, value, size);
+    }
+    else if (invalidate) {
+      StreamLines<true, true>(dst, NULL, value, size);
+    }
+    else {
+      StreamLines<false, true>(dst, NULL, value, size);
+    }
+    Barrier();
+  }
+
+  /// @brief Waits for completion of the cache maintenance issued by the current core.
+  static inline void Barrier() {
+#ifdef __aarch64__
+    asm volatile("DSB SY" ::: "memory");  // data sync barrier
+#endif
+  }
+
+ private:
+  /// @brief Does the cache maintenance of a single range choosing the path according to the cost model.
+  /// @param need_barrier Set to true if CPU maintenance was issued and the barrier is required.
+  static int FlushRange(DMPDVCacheRange& range, const struct dmp_dv_cache_params& params, bool *need_barrier) {
+    if (range.barrier_only) {
+      *need_barrier = true;
+      return 0;
+    }
+    if (!range.start) {  // range is not mapped to CPU, only the kernel can do maintenance
+      CDMPDVMemStats::RecordBytes(range.buf_size, range.dma_buf_flags == DMA_BUF_SYNC_READ);
+      range.done_by_dma_buf = true;
+      return DmaBufSync(range.fd, range.dma_buf_flags);
+    }
+#ifdef __aarch64__
+    uint8_t *start = AlignDown(range.start);
+    uint8_t *end = range.end;
+    const size_t n_lines = (end - start + CACHE_LINE_SIZE - 1) >> CACHE_LINE_LOG2;
+
+    // Cost of per-line maintenance split across n threads is n_lines * line_ns / n + (n - 1) * thread_ns,
+    // which is minimal at n = sqrt(n_lines * line_ns / thread_ns)
+    const double t_lines = n_lines * params.line_ns;
+    int n_threads = params.thread_ns > 0.0 ? (int)sqrt(t_lines / params.thread_ns) : params.max_threads;
+    n_threads = std::max(std::min(n_threads, params.max_threads), 1);
+    n_threads = (int)std::min((size_t)n_threads, n_lines);
+    const double t_threads = t_lines / n_threads + (n_threads - 1) * params.thread_ns;
+    const double t_dma_buf = params.sync_fixed_ns + params.sync_byte_ns * range.buf_size;
+
+    if ((range.dma_buf_flags) && (params.use_dma_buf_sync) && (t_dma_buf < t_threads)) {
+      CDMPDVMemStats::RecordBytes(range.buf_size, range.dma_buf_flags == DMA_BUF_SYNC_READ);
+      range.done_by_dma_buf = true;
+      return DmaBufSync(range.fd, range.dma_buf_flags);
+    }
+
+    CDMPDVMemStats::RecordBytes(n_lines << CACHE_LINE_LOG2, range.invalidate);
+    if (n_threads > 1) {
+      const size_t chunk = (n_lines + n_threads - 1) / n_threads;
+      std::vector<std::thread> workers;
+      uint8_t *addr = start;
+      for (int i = 0; (i < n_threads - 1) && (addr + (chunk << CACHE_LINE_LOG2) < end);
+           ++i, addr += chunk << CACHE_LINE_LOG2) {
+        try {
+          workers.push_back(std::thread(FlushLinesWithBarrier, addr, addr + (chunk << CACHE_LINE_LOG2),
+                                        range.invalidate));
+        }
+        catch (...) {
+          break;  // the rest will be processed in the calling thread
+        }
+      }
+      FlushLinesWithBarrier(addr, end, range.invalidate);
+      for (auto it = workers.begin(); it != workers.end(); ++it) {
+        it->join();
+      }
+      return 0;
+    }
+
+    if (range.invalidate) {
+      FlushLines<true>(start, end);
+    }
+    else {
+      FlushLines<false>(start, end);
+    }
+    *need_barrier = true;
+#else
+    __builtin___clear_cache(range.start, range.end);
+#endif
+    return 0;
+  }
+
+  /// @brief Returns address rounded down to the cache line boundary.
+  static inline uint8_t *AlignDown(uint8_t *addr) {
+    return (uint8_t*)((((size_t)addr) >> CACHE_LINE_LOG2) << CACHE_LINE_LOG2);
+  }
+
+  /// @brief Issues per-line maintenance for the range followed by the data synchronization barrier.
+  static void FlushLinesWithBarrier(uint8_t *start, uint8_t *end, bool invalidate) {
+    if (invalidate) {
+      FlushLines<true>(start, end);
+    }
+    else {
+      FlushLines<false>(start, end);
+    }
+    Barrier();
+  }
+
+  /// @brief Issues per-line maintenance for the range, 8 lines per iteration.
+  /// @param start Cache line aligned start address.
+  /// @param end End address.
+  template <bool kInvalidate>
+  static void FlushLines(uint8_t *start, uint8_t *end) {
+    uint8_t *addr = start;
+    for (; addr + 8 * CACHE_LINE_SIZE <= end; addr += 8 * CACHE_LINE_SIZE) {
+      FlushLine<kInvalidate>(addr);
+      FlushLine<kInvalidate>(addr + 1 * CACHE_LINE_SIZE);
+      FlushLine<kInvalidate>(addr + 2 * CACHE_LINE_SIZE);
+      FlushLine<kInvalidate>(addr + 3 * CACHE_LINE_SIZE);
+      FlushLine<kInvalidate>(addr + 4 * CACHE_LINE_SIZE);
+      FlushLine<kInvalidate>(addr + 5 * CACHE_LINE_SIZE);
+      FlushLine<kInvalidate>(addr + 6 * CACHE_LINE_SIZE);
+      FlushLine<kInvalidate>(addr + 7 * CACHE_LINE_SIZE);
+    }
+    for (; addr < end; addr += CACHE_LINE_SIZE) {
+      FlushLine<kInvalidate>(addr);
+    }
+  }
+
+  /// @brief Writes the destination line by line issuing the maintenance of each line right after it is written,
+  ///        so the line is touched once while it is still hot instead of in a separate pass.
+  /// @param src Source for the copy, ignored when kFill is true.
+  /// @param value Byte value for the fill, ignored when kFill is false.
+  template <bool kInvalidate, bool kFill>
+  static void StreamLines(uint8_t *dst, const uint8_t *src, uint8_t value, size_t size) {
+    uint8_t *end = dst + size;
+    uint8_t *addr = dst;
+    if (((size_t)addr & (CACHE_LINE_SIZE - 1)) && (size)) {  // partial head line
+      const size_t n = std::min(size, (size_t)(AlignDown(addr) + CACHE_LINE_SIZE - addr));
+      StorePartial<kFill>(addr, src, value, n);
+      FlushLine<kInvalidate>(AlignDown(addr));
+      addr += n;
+      if (!kFill) {
+        src += n;
+      }
+    }
+    for (; addr + CACHE_LINE_SIZE <= end; addr += CACHE_LINE_SIZE) {
+      if (kFill) {
+        FillLine(addr, value);
+      }
+      else {
+        CopyLine(addr, src);
+        src += CACHE_LINE_SIZE;
+      }
+      FlushLine<kInvalidate>(addr);
+    }
+    if (addr < end) {  // partial tail line
+      StorePartial<kFill>(addr, src, value, end - addr);
+      FlushLine<kInvalidate>(addr);
+    }
+    CDMPDVMemStats::RecordBytes(size, kInvalidate);
+  }
+
+  /// @brief Copies or fills part of the cache line.
+  template <bool kFill>
+  static inline void StorePartial(uint8_t *dst, const uint8_t *src, uint8_t value, size_t n) {
+    if (kFill) {
+      memset(dst, value, n);
+    }
+    else {
+      memcpy(dst, src, n);
+    }
+  }
+
+  /// @brief Copies single cache line to the cache line aligned destination.
+  static inline void CopyLine(uint8_t *dst, const uint8_t *src) {
+#ifdef __aarch64__
+    for (int i = 0; i < CACHE_LINE_SIZE; i += 64) {
+      asm volatile("LDP q0, q1, [%1]\n\t"
+                   "LDP q2, q3, [%1, #32]\n\t"
+                   "STNP q0, q1, [%0]\n\t"  /* Non-temporal stores don't allocate lines which are flushed next */
+                   "STNP q2, q3, [%0, #32]"
+                   : /* No outputs */
+                   : "r" (dst + i), "r" (src + i)
+                   : "v0", "v1", "v2", "v3", "memory");
+    }
+#else
+    memcpy(dst, src, CACHE_LINE_SIZE);
+#endif
+  }
+
+  /// @brief Fills single cache line aligned destination.
+  static inline void FillLine(uint8_t *dst, uint8_t value) {
+#ifdef __aarch64__
+    for (int i = 0; i < CACHE_LINE_SIZE; i += 64) {
+      asm volatile("DUP v0.16b, %w1\n\t"
+                   "STNP q0, q0, [%0]\n\t"
+                   "STNP q0, q0, [%0, #32]"
+                   : /* No outputs */
+                   : "r" (dst + i), "r" ((uint32_t)value)
+                   : "v0", "memory");
+    }
+#else
+    memset(dst, value, CACHE_LINE_SIZE);
+#endif
+  }
+
+  /// @brief Issues maintenance of a single cache line.
+  template <bool kInvalidate>
+  static inline void FlushLine(uint8_t *addr) {
+#ifdef __aarch64__
+    if (kInvalidate) {
+      asm volatile("DC CIVAC, %0" /* Write changes to RAM and Invalidate cache */
+                   : /* No outputs */
+                   : "r" (addr)
+                   : "memory");
+    }
+    else {
+      asm volatile("DC CVAC, %0" /* Write changes to RAM and Leave data in cache */
+                   : /* No outputs */
+                   : "r" (addr)
+                   : "memory");
+    }
+#else
+    __builtin___clear_cache((char*)addr, (char*)addr + CACHE_LINE_SIZE);
+#endif
+  }
+
+  /// @brief Does the kernel cache maintenance of the whole buffer with DMA_BUF_IOCTL_SYNC start/end pair.
+  static int DmaBufSync(int fd, int flags) {
+    struct dma_buf_sync sync_args;
+    memset(&sync_args, 0, sizeof(sync_args));
+    sync_args.flags = DMA_BUF_SYNC_START | flags;
+    int res = TimedDmaBufSync(fd, &sync_args);
+    if (res < 0) {
+      SET_IOCTL_ERR(res, "/dev/ion", "DMA_BUF_SYNC_START");
+      return res;
+    }
+    sync_args.flags = DMA_BUF_SYNC_END | flags;
+    res = TimedDmaBufSync(fd, &sync_args);
+    if (res < 0) {
+      SET_IOCTL_ERR(res, "/dev/ion", "DMA_BUF_SYNC_END");
+      return res;
+    }
+    return 0;
+  }
+
+  /// @brief Returns monotonic time in nanoseconds.
+  static inline double GetNs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return 1.0e9 * ts.tv_sec + ts.tv_nsec;
+  }
+
+  /// @brief Current cost model parameters.
+  static struct dmp_dv_cache_params params_;
+
+  /// @brief Mutex for protecting params_.
+  static std::mutex params_mutex_;
+};
@@ -19,6 +19,12 @@
 
 #include <vector>
 #include <tuple>
+#include <deque>
+#include <map>
+#include <string>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
 
 #include "dmp_dv.h"
 #include "common.h"
@@ -66,6 +72,27 @@ class CDMPDVCmdListDeviceHelper : public CDMPDVBase {
   /// @return 0 on success, non-zero on error.
   virtual int FillKCommand(uint8_t *kcmd, struct dmp_dv_cmdraw *cmd, uint32_t& size) = 0;
 
+  /// @brief Returns number of bytes of the checked command which are used later.
+  /// @details Trailing unused parts of the command (e.g. inactive runs) are not kept in the command list.
+  virtual uint32_t GetRawSize(struct dmp_dv_cmdraw *cmd) {
+    return cmd->size;
+  }
+
+  /// @brief Collects buffers referenced by the command together with their copies in the kernel command.
+  /// @param cmd Command (user-space format).
+  /// @param kcmd Command filled by FillKCommand().
+  /// @param refs Must be extended with pairs of <buffer in cmd, buffer in kcmd>,
+  ///             buffer in kcmd is NULL when the buffer was converted and can not be patched in place.
+  /// @return 0 on success, non-zero on error.
+  virtual int GetBufRefs(struct dmp_dv_cmdraw *cmd, uint8_t *kcmd,
+                         std::vector<std::pair<struct dmp_dv_buf*, struct dmp_dv_kbuf*> >& refs) = 0;
+
+  /// @brief Returns number of arithmetic operations of the checked command, multiply-add counts as 2 operations.
+  /// @return Number of operations or 0 if it is not known for the command type.
+  virtual uint64_t GetOps(struct dmp_dv_cmdraw *cmd) {
+    return 0;
+  }
+
   /// @brief Commits command list, e.g. issues ioctl to kernel module.
   /// @param kcmdlist Command list to commit.
   /// @param size Size in bytes of the command list.
@@ -73,6 +100,10 @@ class CDMPDVCmdListDeviceHelper : public CDMPDVBase {
   /// @return 0 on sucess, non-zero on error.
   virtual int KCommit(uint8_t *kcmdlist, uint32_t size, uint32_t n_commands) = 0;
 
+  /// @brief Replaces the commited command list with the new one.
+  /// @return 0 on sucess, non-zero on error (the previous command list is kept).
+  virtual int KRecommit(uint8_t *kcmdlist, uint32_t size, uint32_t n_commands) = 0;
+
   /// @brief Schedules commited command list for execution.
   /// @return >= 0 - execution id on sucess, < 0 on error.
   virtual int64_t Exec() = 0;
@@ -107,8 +138,8 @@ class CDMPDVCmdListDeviceHelper : public CDMPDVBase {
 
  protected:
   /// @brief Sets the list to be in commited state.
-  inline void set_commited() {
-    commited_ = true;
+  inline void set_commited(bool commited = true) {
+    commited_ = commited;
   }
 
   /// @brief Checks if a list in a commited state.
@@ -149,15 +180,15 @@ class CDMPDVCmdListKHelper : public CDMPDVCmdListDeviceHelper {
   /// @brief Issues ioctl to kernel module to commit the command list.
   virtual int KCommit(uint8_t *kcmdlist, uint32_t size, uint32_t n_commands) {
     if (is_commited()) {
-      SET_ERR("Command list is already in commited state");
+      SET_ERR_CODE(EALREADY, "Command list is already in commited state");
       return EALREADY;
     }
 
     if (fd_acc_ == -1) {
       fd_acc_ = open(fnme_acc_, O_RDONLY | O_CLOEXEC);
       if (fd_acc_ == -1) {
-        SET_ERR("open() failed for %s: %s", fnme_acc_, strerror(errno));
-        return false;
+        SET_ERR_CODE(errno, "open() failed for %s: %s", fnme_acc_, strerror(errno));
+        return -1;
       }
     }
 
@@ -177,6 +208,27 @@ class CDMPDVCmdListKHelper : public CDMPDVCmdListDeviceHelper {
     return res;
   }
 
+  /// @brief Commits the new command list on the new file handle and closes the previous one.
+  virtual int KRecommit(uint8_t *kcmdlist, uint32_t size, uint32_t n_commands) {
+    const int fd_prev = fd_acc_;
+    const bool commited_prev = is_commited();
+    fd_acc_ = -1;
+    set_commited(false);
+    int res = KCommit(kcmdlist, size, n_commands);
+    if (res) {
+      if (fd_acc_ != -1) {
+        close(fd_acc_);
+      }
+      fd_acc_ = fd_prev;
+      set_commited(commited_prev);
+      return res;
+    }
+    if (fd_prev != -1) {
+      close(fd_prev);
+    }
+    return 0;
+  }
+
   /// @brief Schedules commited command list for execution.
   virtual int64_t Exec() {
     // Issue ioctl on the kernel module requesting this list execution
@@ -244,13 +296,84 @@ class CDMPDVCmdListKHelper : public CDMPDVCmdListDeviceHelper {
 
 /// @brief Command in command list.
 struct DMPDVCommand {
-  std::vector<uint8_t> cmd;  // raw command
+  size_t cmd_offs;     // offset of the raw command in the command list arena
+  uint32_t kcmd_size;  // size of the kernel command
+  uint32_t kcmd_offs;  // offset of the kernel command in the commited segment
+  uint32_t input_first;   // index of the first buffer of the command in the input buffers of the command list
+  uint32_t output_first;  // index of the first buffer of the command in the output buffers of the command list
   CDMPDVCmdListDeviceHelper *device_helper;  // pointer to device helper for convenience
-  std::vector<std::pair<struct dmp_dv_buf, uint64_t> > input_bufs, output_bufs;  // buffers used during this command
+};
+
+
+/// @brief Part of the command list with consecutive commands for the same device.
+struct DMPDVCmdListSegment {
+  size_t first, last;                  // range of commands [first, last)
+  CDMPDVCmdListDeviceHelper *helper;   // helper holding the commited segment
+  std::vector<uint8_t> kcommand;       // commited kernel commands kept for patching on rebind
+};
+
+
+/// @brief Execution of the command list spanning several devices.
+struct DMPDVChainExec {
+  int64_t exec_id;      // execution id returned to the user
+  int64_t seg_exec_id;  // execution id of the first segment if it was already scheduled, -1 otherwise
+};
+
+
+/// @brief CPU-dirty range taken from the memory for flushing, marked dirty again when the flush fails.
+struct DMPDVTakenDirty {
+  CDMPDVMem *mem;  // memory the range was taken from
+  size_t offs;     // offset within the memory
+  size_t size;     // size in bytes
+};
+
+
+/// @brief Identifies serialized command list ("DVCL").
+#define DMP_DV_CMDLIST_BLOB_MAGIC 0x4C435644
+
+/// @brief Format version of serialized command list.
+#define DMP_DV_CMDLIST_BLOB_VERSION 1
+
+
+/// @brief Header of serialized command list, followed by commands, input and output buffers and raw commands.
+struct DMPDVCmdListBlobHeader {
+  uint32_t magic;            // DMP_DV_CMDLIST_BLOB_MAGIC
+  uint32_t version;          // DMP_DV_CMDLIST_BLOB_VERSION
+  int32_t ub_size;           // unified buffer size the commands were checked for
+  int32_t svn_version;       // hardware version the commands were checked for
+  int32_t max_kernel_size;   // maximum kernel size the commands were checked for
+  uint32_t n_commands;       // number of commands
+  uint32_t n_input_bufs;     // number of input buffers
+  uint32_t n_output_bufs;    // number of output buffers
+  uint64_t arena_size;       // size of the raw commands in bytes
+};
+
+
+/// @brief Serialized command.
+struct DMPDVCmdListBlobCommand {
+  uint64_t cmd_offs;      // offset of the raw command in the serialized raw commands
+  uint32_t raw_size;      // stored size of the raw command
+  uint32_t kcmd_size;     // size of the kernel command
+  uint32_t input_first;   // index of the first input buffer of the command
+  uint32_t output_first;  // index of the first output buffer of the command
+  uint32_t device_type;   // device type of the helper which has checked the command
+  uint32_t rsvd;          // padding to 64-bits
+};
+
+
+/// @brief Serialized buffer.
+struct DMPDVCmdListBlobBuf {
+  uint64_t slot;  // index in the buffer table
+  uint64_t offs;  // offset from the start of the buffer
+  uint64_t size;  // used size in bytes
 };
 
 
 /// @brief Implementation of dmp_dv_cmdlist.
+/// @details When commands for different devices are mixed, consecutive commands for the same device form a segment
+///          commited separately, Exec() schedules the first segment and the worker thread
+///          schedules the next segment as soon as the previous one completes.
+///          In profiling mode each command forms its own segment, so the kernel module reports its execution time.
 class CDMPDVCmdList : public CDMPDVBase {
  public:
   /// @brief Constructor.
@@ -259,6 +382,14 @@ class CDMPDVCmdList : public CDMPDVBase {
     commited_ = false;
     memset(device_helpers_, 0, sizeof(device_helpers_));
     single_device_ = NULL;
+    managed_coherency_ = false;
+    profiling_ = false;
+    completed_exec_id_ = -1;
+    last_exec_id_ = -1;
+    tracked_exec_id_ = -1;
+    next_exec_id_ = 0;
+    chain_stop_ = false;
+    chain_exec_time_ = 0;
   }
 
   /// @brief Destructor.
@@ -283,7 +414,7 @@ class CDMPDVCmdList : public CDMPDVBase {
   /// @brief Adds raw structure describing the command.
   int AddRaw(struct dmp_dv_cmdraw *cmd) {
     if (commited_) {
-      SET_ERR("Command list is already in commited state");
+      SET_ERR_CODE(EALREADY, "Command list is already in commited state");
       return -1;
     }
     if (!cmd) {
@@ -317,39 +448,49 @@ class CDMPDVCmdList : public CDMPDVBase {
       device_helpers_[device_type] = helper;
     }
 
-    DMPDVCommand command;
-    command.cmd.resize(cmd->size);
-    memcpy(command.cmd.data(), cmd, cmd->size);
-    command.device_helper = device_helpers_[device_type];
-    res = device_helpers_[device_type]->CheckRaw(cmd, command.input_bufs, command.output_bufs);
-    if (res) {
-      return res;
-    }
+    // Buffers of all commands are kept in the shared lists, drop the extension on error
+    CDMPDVCmdListDeviceHelper *helper = device_helpers_[device_type];
+    const size_t n_input_bufs = input_bufs_.size(), n_output_bufs = output_bufs_.size();
+    res = helper->CheckRaw(cmd, input_bufs_, output_bufs_);
 
     // Validate buffers
-    for (auto it = command.input_bufs.begin(); it != command.input_bufs.end(); ++it) {
-      res = ValidateBuffer(it->first, it->second);
-      if (res) {
-        return res;
-      }
+    for (size_t i = n_input_bufs; (!res) && (i < input_bufs_.size()); ++i) {
+      res = ValidateBuffer(input_bufs_[i].first, input_bufs_[i].second);
     }
-    for (auto it = command.output_bufs.begin(); it != command.output_bufs.end(); ++it) {
-      res = ValidateBuffer(it->first, it->second);
-      if (res) {
-        return res;
-      }
+    for (size_t i = n_output_bufs; (!res) && (i < output_bufs_.size()); ++i) {
+      res = ValidateBuffer(output_bufs_[i].first, output_bufs_[i].second);
+    }
+
+    // Get kernel command size now, so commit will fill all commands in a single pass
+    DMPDVCommand command;
+    command.kcmd_size = 0;
+    command.kcmd_offs = 0;
+    command.input_first = (uint32_t)n_input_bufs;
+    command.output_first = (uint32_t)n_output_bufs;
+    command.device_helper = helper;
+    if (!res) {
+      res = helper->FillKCommand(NULL, cmd, command.kcmd_size);
+    }
+    if (res) {
+      input_bufs_.resize(n_input_bufs);
+      output_bufs_.resize(n_output_bufs);
+      return res;
     }
 
     // Increase reference counters
-    for (auto it = command.input_bufs.begin(); it != command.input_bufs.end(); ++it) {
-      dmp_dv_mem_retain(it->first.mem);
+    for (size_t i = n_input_bufs; i < input_bufs_.size(); ++i) {
+      dmp_dv_mem_retain(input_bufs_[i].first.mem);
     }
-    for (auto it = command.output_bufs.begin(); it != command.output_bufs.end(); ++it) {
-      dmp_dv_mem_retain(it->first.mem);
+    for (size_t i = n_output_bufs; i < output_bufs_.size(); ++i) {
+      dmp_dv_mem_retain(output_bufs_[i].first.mem);
     }
 
-    // Add command to the command list
-    commands_.push_back(std::move(command));
+    // Add command to the command list, keeping only the used part of it in the arena
+    const uint32_t raw_size = std::min(helper->GetRawSize(cmd), cmd->size);
+    command.cmd_offs = (arena_.size() + 7) & ~(size_t)7;
+    arena_.resize(command.cmd_offs + raw_size);
+    memcpy(arena_.data() + command.cmd_offs, cmd, raw_size);
+    commands_.push_back(command);
 
     return 0;
   }
@@ -357,7 +498,7 @@ class CDMPDVCmdList : public CDMPDVBase {
   /// @brief Commits command list, filling hardware-specific structures and passing them to kernel module.
   int Commit() {
     if (commited_) {
-      SET_ERR("Command list is already in commited state");
+      SET_ERR_CODE(EALREADY, "Command list is already in commited state");
       return EALREADY;
     }
     int n_devs = 0;
@@ -368,19 +509,20 @@ class CDMPDVCmdList : public CDMPDVBase {
       SET_ERR("Command list is empty");
       return ENODATA;
     }
-    if (n_devs == 1) {
-      for (int i = 0; i < DMP_DV_DEV_COUNT; ++i) {
-        if (device_helpers_[i]) {
-          single_device_ = device_helpers_[i];
-          return CommitSingleDevice();
-        }
+    int res;
+    if ((n_devs == 1) && (!profiling_)) {
+      for (int i = 0; (i < DMP_DV_DEV_COUNT) && (!single_device_); ++i) {
+        single_device_ = device_helpers_[i];
       }
-      SET_LOGIC_ERR();
-      return -1;
+      res = CommitSingleDevice();
     }
-
-    SET_ERR("Having different device types in the single command list is not yet implemented");
-    return -1;
+    else {
+      res = CommitSegments();
+    }
+    if (res) {
+      ReleaseSegments();  // so the next Commit() will not append to the partially commited segments
+    }
+    return res;
   }
 
   /// @brief Schedules commited command list for execution.
@@ -390,29 +532,530 @@ class CDMPDVCmdList : public CDMPDVBase {
       SET_ERR("Command list is not in commited state");
       return -EINVAL;
     }
-    if (single_device_) {
-      return single_device_->Exec();
+    if ((managed_coherency_) && (FlushDirtyBuffers())) {
+      return -1;
+    }
+    return Run();
+  }
+
+  /// @brief Schedules several commited command lists for execution.
+  /// @param exec_ids Filled with execution ids, -1 for the command lists which were not scheduled.
+  /// @return 0 on success, non-zero on error.
+  /// @details CPU caches for all command lists with managed coherency are maintained in a single batch
+  ///          before the first command list is scheduled.
+  static int ExecMany(CDMPDVCmdList **cmdlists, int n, int64_t *exec_ids) {
+    for (int i = 0; i < n; ++i) {
+      exec_ids[i] = -1;
+    }
+    for (int i = 0; i < n; ++i) {
+      if (!cmdlists[i]) {
+        SET_ERR("Invalid argument: cmdlists[%d] is NULL", i);
+        return EINVAL;
+      }
+      if (!cmdlists[i]->commited_) {
+        SET_ERR("Command list %d is not in commited state", i);
+        return EINVAL;
+      }
     }
-    SET_ERR("Having different device types in the single command list is not yet implemented");
-    return -1;
+    std::vector<DMPDVCacheRange> ranges;
+    std::vector<std::pair<size_t, size_t> > dirty;
+    std::vector<DMPDVTakenDirty> taken;
+    int res = 0;
+    for (int i = 0; (i < n) && (!res); ++i) {
+      if (cmdlists[i]->managed_coherency_) {
+        res = cmdlists[i]->AppendFlushRanges(ranges, dirty, taken);
+      }
+    }
+    res = res ? res : CDMPDVCacheEngine::FlushBatch(ranges);
+    if (res) {
+      RestoreDirty(taken);
+      return res;
+    }
+    for (int i = 0; i < n; ++i) {
+      exec_ids[i] = cmdlists[i]->Run();
+      if (exec_ids[i] < 0) {
+        exec_ids[i] = -1;
+        return -1;
+      }
+    }
+    return 0;
   }
 
   /// @brief Waits for the specific execution id to be completed.
   /// @return 0 on success, non-zero on error.
   int Wait(int64_t exec_id) {
+    int res = ValidateExecId(exec_id);
+    if (res) {
+      return res;
+    }
+    Reap(exec_id);
+    return TakeResult(exec_id);
+  }
+
+  /// @brief Checks that the execution id was returned by Exec().
+  int ValidateExecId(int64_t exec_id) {
+    if ((exec_id < 0) || (exec_id > __sync_add_and_fetch(&last_exec_id_, 0))) {
+      SET_ERR("Invalid argument: exec_id = %lld", (long long)exec_id);
+      return EINVAL;
+    }
+    return 0;
+  }
+
+  /// @brief Waits for the specific execution id to be completed keeping its result for TakeResult().
+  /// @details Output buffers are invalidated here when managed coherency is enabled,
+  ///          so the execution is completed for every waiter at once.
+  void Reap(int64_t exec_id) {
+    if (IsCompleted(exec_id)) {
+      return;
+    }
     if (single_device_) {
-      return single_device_->Wait(exec_id);
+      int res = single_device_->Wait(exec_id);
+      if ((!res) && (managed_coherency_)) {
+        res = InvalidateOutputBuffers();
+      }
+      std::lock_guard<std::mutex> lock(exec_mutex_);
+      if (res) {
+        SetError(exec_id, res);
+      }
+      SetCompleted(exec_id);
+      return;
+    }
+    std::unique_lock<std::mutex> lock(exec_mutex_);
+    exec_cond_.wait(lock, [this, exec_id]{ return IsCompleted(exec_id); });
+  }
+
+  /// @brief Returns the result of the completed execution, the error is reported only once.
+  /// @return 0 on success, non-zero if the execution has failed.
+  int TakeResult(int64_t exec_id) {
+    std::lock_guard<std::mutex> lock(exec_mutex_);
+    auto it = exec_errors_.find(exec_id);
+    if (it == exec_errors_.end()) {
+      return 0;
+    }
+    const int res = it->second.first;
+    SET_ERR_CODE(res, "%s", it->second.second.c_str());
+    exec_errors_.erase(it);
+    return res;
+  }
+
+  /// @brief Marks the execution id as tracked by the reaper.
+  /// @return true if the execution id is greater than the tracked ones, false if it is already covered by them.
+  /// @details Completion of the execution id completes all earlier ones, so only the maximum has to be tracked.
+  inline bool MarkTracked(int64_t exec_id) {
+    return AtomicMax(&tracked_exec_id_, exec_id);
+  }
+
+  /// @brief Returns the context of the command list.
+  inline CDMPDVContext *get_ctx() const {
+    return ctx_;
+  }
+
+  /// @brief Replaces the memory handle in the buffers of the commited command list.
+  /// @param old_mem Memory handle to replace.
+  /// @param new_buf Buffer to use instead, offsets within old_mem become offsets from new_buf.offs.
+  /// @return 0 on success, non-zero on error (the command list is not changed).
+  /// @details Only the sizes of the affected buffers are checked again,
+  ///          the kernel commands are patched in place and commited again without filling them from scratch.
+  int Rebind(dmp_dv_mem old_mem, const struct dmp_dv_buf& new_buf) {
+    if (!commited_) {
+      SET_ERR("Command list is not in commited state");
+      return EINVAL;
+    }
+    if ((!old_mem) || (!new_buf.mem)) {
+      SET_ERR("Invalid argument: old_mem=%p new_buf.mem=%p", old_mem, new_buf.mem);
+      return EINVAL;
+    }
+    if (!IsCompleted(__sync_add_and_fetch(&last_exec_id_, 0))) {
+      SET_ERR_CODE(EBUSY, "Command list is still executing, wait for its completion before rebinding buffers");
+      return EBUSY;
+    }
+    const int64_t shift = (int64_t)(new_buf.offs + CDMPDVMem::get_base_offs(new_buf.mem)) -
+                          (int64_t)CDMPDVMem::get_base_offs(old_mem);
+    if (shift & 15) {
+      SET_ERR("Invalid argument: new_buf must keep 16-bytes alignment of the buffers, got address shift %lld",
+              (long long)shift);
+      return EINVAL;
+    }
+
+    // Check sizes of the affected buffers
+    int n_found = 0;
+    for (int i = 0; i < 2; ++i) {
+      auto& bufs = i ? output_bufs_ : input_bufs_;
+      for (auto it = bufs.begin(); it != bufs.end(); ++it) {
+        if (it->first.mem != old_mem) {
+          continue;
+        }
+        struct dmp_dv_buf buf;
+        buf.mem = new_buf.mem;
+        buf.offs = new_buf.offs + it->first.offs;
+        int res = ValidateBuffer(buf, it->second);
+        if (res) {
+          return res;
+        }
+        ++n_found;
+      }
+    }
+    if (!n_found) {
+      SET_ERR("Invalid argument: old_mem %p is not used by the command list", old_mem);
+      return EINVAL;
+    }
+
+    // Patch copies of the kernel commands and commit them
+    std::vector<std::vector<uint8_t> > kcommands(segments_.size());
+    std::vector<std::pair<struct dmp_dv_buf*, struct dmp_dv_kbuf*> > refs;
+    for (size_t i_seg = 0; i_seg < segments_.size(); ++i_seg) {
+      DMPDVCmdListSegment& segment = segments_[i_seg];
+      bool patched = false;
+      kcommands[i_seg] = segment.kcommand;
+      for (size_t i = segment.first; i < segment.last; ++i) {
+        refs.clear();
+        int res = commands_[i].device_helper->GetBufRefs(
+            get_cmd(commands_[i]), kcommands[i_seg].data() + commands_[i].kcmd_offs, refs);
+        if (res) {
+          RestoreSegments(kcommands, i_seg);
+          return res;
+        }
+        for (auto it = refs.begin(); it != refs.end(); ++it) {
+          if (it->first->mem != old_mem) {
+            continue;
+          }
+          if (!it->second) {
+            SET_ERR_CODE(ENOTSUP, "Buffer of command %zu was converted on commit and can not be rebound", i);
+            RestoreSegments(kcommands, i_seg);
+            return ENOTSUP;
+          }
+          it->second->fd = CDMPDVMem::get_fd(new_buf.mem);
+          it->second->offs = (uint64_t)((int64_t)it->second->offs + shift);
+          patched = true;
+        }
+      }
+      if (!patched) {
+        kcommands[i_seg].clear();
+        continue;
+      }
+      int res = segment.helper->KRecommit(kcommands[i_seg].data(), kcommands[i_seg].size(),
+                                          segment.last - segment.first);
+      if (res) {
+        RestoreSegments(kcommands, i_seg);
+        return res;
+      }
+    }
+
+    // Apply the new buffers to the user-space commands
+    for (size_t i_seg = 0; i_seg < segments_.size(); ++i_seg) {
+      DMPDVCmdListSegment& segment = segments_[i_seg];
+      if (kcommands[i_seg].empty()) {
+        continue;
+      }
+      segment.kcommand.swap(kcommands[i_seg]);
+      for (size_t i = segment.first; i < segment.last; ++i) {
+        DMPDVCommand& command = commands_[i];
+        refs.clear();
+        command.device_helper->GetBufRefs(
+            get_cmd(command), segment.kcommand.data() + command.kcmd_offs, refs);
+        for (auto it = refs.begin(); it != refs.end(); ++it) {
+          if (it->first->mem == old_mem) {
+            it->first->mem = new_buf.mem;
+            it->first->offs += new_buf.offs;
+          }
+        }
+      }
+    }
+    for (int i = 0; i < 2; ++i) {
+      auto& bufs = i ? output_bufs_ : input_bufs_;
+      for (auto it = bufs.begin(); it != bufs.end(); ++it) {
+        if (it->first.mem == old_mem) {
+          dmp_dv_mem_retain(new_buf.mem);
+          dmp_dv_mem_release(it->first.mem);
+          it->first.mem = new_buf.mem;
+          it->first.offs += new_buf.offs;
+        }
+      }
+    }
+    return 0;
+  }
+
+  /// @brief Returns true if the specified or later execution id has completed (successfully or not).
+  inline bool IsCompleted(int64_t exec_id) {
+    return __sync_add_and_fetch(&completed_exec_id_, 0) >= exec_id;
+  }
+
+  /// @brief Enables or disables managed coherency.
+  void SetManagedCoherency(bool enable) {
+    managed_coherency_ = enable;
+  }
+
+  /// @brief Writes the commited command list to the blob.
+  /// @param buffer_table Memory handles used by the commands, buffers refer to them by index.
+  /// @param blob Blob to fill, can be NULL to get only size.
+  /// @param size On enter must contain size of the blob, on exit will contain used or required size.
+  /// @return 0 on success, non-zero on error.
+  /// @details Memory handles in the raw commands are replaced with the indices in buffer_table plus one.
+  int Serialize(const dmp_dv_mem *buffer_table, int n_buffers, uint8_t *blob, size_t& size) {
+    if (!commited_) {
+      SET_ERR("Command list is not in commited state");
+      return EINVAL;
+    }
+    const size_t req_size = sizeof(DMPDVCmdListBlobHeader) + commands_.size() * sizeof(DMPDVCmdListBlobCommand) +
+        (input_bufs_.size() + output_bufs_.size()) * sizeof(DMPDVCmdListBlobBuf) + arena_.size();
+    if (!blob) {
+      size = req_size;
+      return 0;
+    }
+    if (size < req_size) {
+      SET_ERR_CODE(ENOSPC, "Not enough buffer size for the serialized command list: %zu < %zu", size, req_size);
+      size = req_size;
+      return ENOSPC;
+    }
+    std::map<dmp_dv_mem, uint64_t> slots;
+    for (int i = 0; i < n_buffers; ++i) {
+      if (buffer_table[i]) {
+        slots.insert(std::make_pair(buffer_table[i], (uint64_t)i));
+      }
+    }
+
+    DMPDVCmdListBlobHeader *header = (DMPDVCmdListBlobHeader*)blob;
+    memset(header, 0, sizeof(*header));
+    header->magic = DMP_DV_CMDLIST_BLOB_MAGIC;
+    header->version = DMP_DV_CMDLIST_BLOB_VERSION;
+    header->ub_size = ctx_->get_ub_size();
+    header->svn_version = ctx_->get_svn_version();
+    header->max_kernel_size = ctx_->get_max_kernel_size();
+    header->n_commands = commands_.size();
+    header->n_input_bufs = input_bufs_.size();
+    header->n_output_bufs = output_bufs_.size();
+    header->arena_size = arena_.size();
+
+    DMPDVCmdListBlobCommand *blob_commands = (DMPDVCmdListBlobCommand*)(header + 1);
+    DMPDVCmdListBlobBuf *blob_bufs = (DMPDVCmdListBlobBuf*)(blob_commands + commands_.size());
+    uint8_t *blob_arena = (uint8_t*)(blob_bufs + input_bufs_.size() + output_bufs_.size());
+    memcpy(blob_arena, arena_.data(), arena_.size());
+
+    const std::vector<std::pair<struct dmp_dv_buf, uint64_t> > *bufs[2] = {&input_bufs_, &output_bufs_};
+    for (int i_list = 0; i_list < 2; ++i_list) {
+      for (auto it = bufs[i_list]->begin(); it != bufs[i_list]->end(); ++it, ++blob_bufs) {
+        auto slot = slots.find(it->first.mem);
+        if (slot == slots.end()) {
+          SET_ERR("Memory handle %p used by the command list is not in the buffer table", it->first.mem);
+          return EINVAL;
+        }
+        blob_bufs->slot = slot->second;
+        blob_bufs->offs = it->first.offs;
+        blob_bufs->size = it->second;
+      }
+    }
+
+    std::vector<uint8_t> kcmd;
+    std::vector<std::pair<struct dmp_dv_buf*, struct dmp_dv_kbuf*> > refs;
+    for (size_t i = 0; i < commands_.size(); ++i) {
+      const DMPDVCommand& command = commands_[i];
+      DMPDVCmdListBlobCommand& blob_command = blob_commands[i];
+      memset(&blob_command, 0, sizeof(blob_command));
+      blob_command.cmd_offs = command.cmd_offs;
+      blob_command.raw_size = (i + 1 < commands_.size() ? commands_[i + 1].cmd_offs : arena_.size()) - command.cmd_offs;
+      blob_command.kcmd_size = command.kcmd_size;
+      blob_command.input_first = command.input_first;
+      blob_command.output_first = command.output_first;
+      blob_command.device_type = GetDeviceType(command.device_helper);
+
+      // Replace memory handles in the copy of the raw command with slots
+      kcmd.resize(command.kcmd_size);
+      refs.clear();
+      int res = command.device_helper->GetBufRefs(
+          (struct dmp_dv_cmdraw*)(blob_arena + command.cmd_offs), kcmd.data(), refs);
+      if (res) {
+        return res;
+      }
+      for (auto it = refs.begin(); it != refs.end(); ++it) {
+        if (!it->first->mem) {
+          continue;
+        }
+        auto slot = slots.find(it->first->mem);
+        if (slot == slots.end()) {
+          SET_ERR("Memory handle %p used by the command %zu is not in the buffer table", it->first->mem, i);
+          return EINVAL;
+        }
+        it->first->rsvd = slot->second + 1;
+      }
+    }
+    size = req_size;
+    return 0;
+  }
+
+  /// @brief Restores the command list from the blob created by Serialize() and commits it.
+  /// @param buffer_table Memory handles to use for the buffer indices stored in the blob.
+  /// @return 0 on success, non-zero on error.
+  /// @details Commands are not checked again, only the bounds of the buffers are validated,
+  ///          so the blob must be created on the device with the same capabilities.
+  int Deserialize(const uint8_t *blob, size_t size, const dmp_dv_mem *buffer_table, int n_buffers) {
+    if (commited_) {
+      SET_ERR_CODE(EALREADY, "Command list is already in commited state");
+      return EALREADY;
+    }
+    if (!commands_.empty()) {
+      SET_ERR("Command list is not empty");
+      return EINVAL;
+    }
+    const DMPDVCmdListBlobHeader *header = (const DMPDVCmdListBlobHeader*)blob;
+    if ((size < sizeof(*header)) || (header->magic != DMP_DV_CMDLIST_BLOB_MAGIC)) {
+      SET_ERR("Invalid argument: blob is not a serialized command list");
+      return EINVAL;
+    }
+    if (header->version != DMP_DV_CMDLIST_BLOB_VERSION) {
+      SET_ERR_CODE(ENOTSUP, "Serialized command list version %u is not supported", header->version);
+      return ENOTSUP;
     }
-    SET_ERR("Having different device types in the single command list is not yet implemented");
-    return -1;
+    if ((header->ub_size != ctx_->get_ub_size()) || (header->svn_version != ctx_->get_svn_version()) ||
+        (header->max_kernel_size != ctx_->get_max_kernel_size())) {
+      SET_ERR_CODE(ESTALE, "Serialized command list was created for another device: "
+                   "ub_size=%d svn_version=%d max_kernel_size=%d while the device has %d %d %d",
+                   header->ub_size, header->svn_version, header->max_kernel_size,
+                   ctx_->get_ub_size(), ctx_->get_svn_version(), ctx_->get_max_kernel_size());
+      return ESTALE;
+    }
+    const uint64_t n_bufs = (uint64_t)header->n_input_bufs + header->n_output_bufs;
+    const uint64_t req_size = sizeof(*header) + (uint64_t)header->n_commands * sizeof(DMPDVCmdListBlobCommand) +
+        n_bufs * sizeof(DMPDVCmdListBlobBuf) + header->arena_size;
+    if ((!header->n_commands) || (req_size > size)) {
+      SET_ERR("Invalid argument: serialized command list of %u commands requires %llu bytes, got %zu",
+              header->n_commands, (unsigned long long)req_size, size);
+      return EINVAL;
+    }
+    const DMPDVCmdListBlobCommand *blob_commands = (const DMPDVCmdListBlobCommand*)(header + 1);
+    const DMPDVCmdListBlobBuf *blob_bufs = (const DMPDVCmdListBlobBuf*)(blob_commands + header->n_commands);
+    const uint8_t *blob_arena = (const uint8_t*)(blob_bufs + n_bufs);
+
+    // Restore and validate buffers, one reference on the memory handle for each buffer
+    std::vector<std::pair<struct dmp_dv_buf, uint64_t> > *bufs[2] = {&input_bufs_, &output_bufs_};
+    const uint32_t n_list_bufs[2] = {header->n_input_bufs, header->n_output_bufs};
+    for (int i_list = 0; i_list < 2; ++i_list) {
+      bufs[i_list]->reserve(n_list_bufs[i_list]);
+      for (uint32_t i = 0; i < n_list_bufs[i_list]; ++i, ++blob_bufs) {
+        if ((blob_bufs->slot >= (uint64_t)n_buffers) || (!buffer_table[blob_bufs->slot])) {
+          SET_ERR("Invalid argument: buffer table of size %d has no memory handle for index %llu",
+                  n_buffers, (unsigned long long)blob_bufs->slot);
+          return EINVAL;
+        }
+        struct dmp_dv_buf buf;
+        buf.mem = buffer_table[blob_bufs->slot];
+        buf.offs = blob_bufs->offs;
+        int res = ValidateBuffer(buf, blob_bufs->size);
+        if (res) {
+          return res;
+        }
+        dmp_dv_mem_retain(buf.mem);
+        bufs[i_list]->push_back(std::make_pair(buf, blob_bufs->size));
+      }
+    }
+
+    // Restore commands replacing the buffer indices with memory handles
+    arena_.assign(blob_arena, blob_arena + header->arena_size);
+    commands_.reserve(header->n_commands);
+    std::vector<uint8_t> kcmd;
+    std::vector<std::pair<struct dmp_dv_buf*, struct dmp_dv_kbuf*> > refs;
+    for (uint32_t i = 0; i < header->n_commands; ++i) {
+      const DMPDVCmdListBlobCommand& blob_command = blob_commands[i];
+      if ((blob_command.device_type >= DMP_DV_DEV_COUNT) || (blob_command.raw_size < sizeof(struct dmp_dv_cmdraw)) ||
+          (blob_command.cmd_offs > arena_.size()) || (arena_.size() - blob_command.cmd_offs < blob_command.raw_size) ||
+          (blob_command.input_first > header->n_input_bufs) || (blob_command.output_first > header->n_output_bufs)) {
+        SET_ERR("Invalid argument: serialized command %u is corrupted", i);
+        return EINVAL;
+      }
+      const int device_type = blob_command.device_type;
+      if (!device_helpers_[device_type]) {
+        int res = CDMPDVCmdListDeviceHelper::Instantiate(ctx_, device_type, &device_helpers_[device_type]);
+        if (res) {
+          return res;
+        }
+      }
+      DMPDVCommand command;
+      command.cmd_offs = blob_command.cmd_offs;
+      command.kcmd_size = blob_command.kcmd_size;
+      command.kcmd_offs = 0;
+      command.input_first = blob_command.input_first;
+      command.output_first = blob_command.output_first;
+      command.device_helper = device_helpers_[device_type];
+      if (command.device_helper->GetRawSize(get_cmd(command)) > blob_command.raw_size) {
+        SET_ERR("Invalid argument: serialized command %u is truncated", i);
+        return EINVAL;
+      }
+
+      kcmd.resize(command.kcmd_size);
+      refs.clear();
+      int res = command.device_helper->GetBufRefs(get_cmd(command), kcmd.data(), refs);
+      if (res) {
+        return res;
+      }
+      for (auto it = refs.begin(); it != refs.end(); ++it) {
+        const uint64_t slot = it->first->rsvd;
+        if ((slot > (uint64_t)n_buffers) || ((slot) && (!buffer_table[slot - 1]))) {
+          SET_ERR("Invalid argument: buffer table of size %d has no memory handle for index %llu",
+                  n_buffers, (unsigned long long)(slot - 1));
+          return EINVAL;
+        }
+        it->first->mem = slot ? buffer_table[slot - 1] : NULL;
+      }
+      commands_.push_back(command);
+    }
+
+    return Commit();
+  }
+
+  /// @brief Enables or disables profiling mode, must be called before Commit().
+  int SetProfiling(bool enable) {
+    if (commited_) {
+      SET_ERR_CODE(EALREADY, "Command list is already in commited state");
+      return EALREADY;
+    }
+    profiling_ = enable;
+    return 0;
+  }
+
+  /// @brief Fills the execution profile of the commands.
+  /// @param profile Array to fill, can be NULL.
+  /// @param n Number of elements in the profile array.
+  /// @return Number of commands in the command list on success, negative errno on error.
+  int GetProfile(struct dmp_dv_cmd_profile *profile, int n) {
+    if ((!commited_) || (!profiling_)) {
+      SET_ERR("Command list is not commited in profiling mode");
+      return -EINVAL;
+    }
+    if ((profile) && (n > 0)) {
+      std::vector<int64_t> exec_times;
+      {
+        std::lock_guard<std::mutex> lock(exec_mutex_);
+        exec_times = profile_times_;
+      }
+      for (int i = 0; (i < n) && (i < (int)commands_.size()); ++i) {
+        const DMPDVCommand& command = commands_[i];
+        const size_t input_last = i + 1 < (int)commands_.size() ? commands_[i + 1].input_first : input_bufs_.size();
+        const size_t output_last = i + 1 < (int)commands_.size() ? commands_[i + 1].output_first : output_bufs_.size();
+        struct dmp_dv_cmd_profile& p = profile[i];
+        memset(&p, 0, sizeof(p));
+        p.exec_time = exec_times.empty() ? -1 : exec_times[i];
+        for (size_t j = command.input_first; j < input_last; ++j) {
+          p.bytes_read += input_bufs_[j].second;
+        }
+        for (size_t j = command.output_first; j < output_last; ++j) {
+          p.bytes_written += output_bufs_[j].second;
+        }
+        p.n_ops = command.device_helper->GetOps(get_cmd(command));
+        p.intensity = (double)p.n_ops / (double)std::max(p.bytes_read + p.bytes_written, (uint64_t)1);
+      }
+    }
+    return (int)commands_.size();
   }
 
   int64_t GetLastExecTime() {
     if (single_device_) {
       return single_device_->GetLastExecTime();
     }
-    SET_ERR("Having different device types in the single command list is not yet implemented");
-    return -1;
+    if (!commited_) {
+      SET_ERR("Command list is not in commited state");
+      return -1;
+    }
+    std::lock_guard<std::mutex> lock(exec_mutex_);
+    return chain_exec_time_;
   }
 
  protected:
@@ -424,16 +1067,37 @@ class CDMPDVCmdList : public CDMPDVBase {
  private:
   /// @brief Releases held resources.
   void ReleaseResources() {
-    // Decrease reference counters on used memory pointers
-    for (auto cmd_it = commands_.rbegin(); cmd_it != commands_.rend(); ++cmd_it) {
-      for (auto it = cmd_it->output_bufs.rbegin(); it != cmd_it->output_bufs.rend(); ++it) {
-        dmp_dv_mem_release(it->first.mem);
-      }
-      for (auto it = cmd_it->input_bufs.rbegin(); it != cmd_it->input_bufs.rend(); ++it) {
-        dmp_dv_mem_release(it->first.mem);
+    // Stop the worker after it has waited for the scheduled executions
+    if (chain_worker_.joinable()) {
+      {
+        std::lock_guard<std::mutex> lock(exec_mutex_);
+        chain_stop_ = true;
       }
+      exec_cond_.notify_all();
+      chain_worker_.join();
+    }
+    chain_stop_ = false;
+    exec_errors_.clear();
+    next_exec_id_ = 0;
+    chain_exec_time_ = 0;
+    profile_times_.clear();
+    completed_exec_id_ = -1;
+    last_exec_id_ = -1;
+    tracked_exec_id_ = -1;
+
+    ReleaseSegments();
+
+    // Decrease reference counters on used memory pointers
+    for (auto it = output_bufs_.rbegin(); it != output_bufs_.rend(); ++it) {
+      dmp_dv_mem_release(it->first.mem);
     }
+    output_bufs_.clear();
+    for (auto it = input_bufs_.rbegin(); it != input_bufs_.rend(); ++it) {
+      dmp_dv_mem_release(it->first.mem);
+    }
+    input_bufs_.clear();
     commands_.clear();
+    arena_.clear();
 
     // Release device helpers
     for (int i = DMP_DV_DEV_COUNT - 1; i >= 0; --i) {
@@ -451,6 +1115,22 @@ class CDMPDVCmdList : public CDMPDVBase {
 
     // Reset other vars
     commited_ = false;
+    single_device_ = NULL;
+    profiling_ = false;
+  }
+
+  /// @brief Returns raw command stored in the arena.
+  inline struct dmp_dv_cmdraw *get_cmd(const DMPDVCommand& command) {
+    return (struct dmp_dv_cmdraw*)(arena_.data() + command.cmd_offs);
+  }
+
+  /// @brief Returns device type of the helper which checks the commands.
+  uint32_t GetDeviceType(CDMPDVCmdListDeviceHelper *device_helper) const {
+    uint32_t device_type = 0;
+    while ((device_type < DMP_DV_DEV_COUNT) && (device_helpers_[device_type] != device_helper)) {
+      ++device_type;
+    }
+    return device_type;
   }
 
   /// @brief Validates buffer.
@@ -463,9 +1143,9 @@ class CDMPDVCmdList : public CDMPDVBase {
       SET_ERR("Memory handle in buffer is NULL");
       return EINVAL;
     }
-    if (buf.offs & 1) {
-      SET_ERR("Offset in buffer must be 2-bytes aligned, got %llu",
-              (unsigned long long)buf.offs);
+    if ((buf.offs + CDMPDVMem::get_base_offs(buf.mem)) & 1) {
+      SET_ERR("Offset in buffer must be 2-bytes aligned, got %llu (%llu within the parent memory)",
+              (unsigned long long)buf.offs, (unsigned long long)(buf.offs + CDMPDVMem::get_base_offs(buf.mem)));
       return EINVAL;
     }
     uint64_t n = dmp_dv_mem_get_size(buf.mem);
@@ -478,61 +1158,336 @@ class CDMPDVCmdList : public CDMPDVBase {
     return 0;
   }
 
+  /// @brief Raises the maximum completed execution id.
+  inline void SetCompleted(int64_t exec_id) {
+    AtomicMax(&completed_exec_id_, exec_id);
+  }
+
+  /// @brief Atomically sets the value to the maximum of its current value and the given one.
+  /// @return true if the value was raised.
+  static bool AtomicMax(int64_t *ptr, int64_t value) {
+    for (int64_t prev = __sync_add_and_fetch(ptr, 0); prev < value;) {
+      int64_t cur = __sync_val_compare_and_swap(ptr, prev, value);
+      if (cur == prev) {
+        return true;
+      }
+      prev = cur;
+    }
+    return false;
+  }
+
+  /// @brief Commits the kept kernel commands again for the patched segments before the given one.
+  /// @details Used on failed rebind, the kept kernel commands were not replaced yet.
+  void RestoreSegments(const std::vector<std::vector<uint8_t> >& patched, size_t n_segments) {
+    for (size_t i_seg = 0; i_seg < n_segments; ++i_seg) {
+      if (patched[i_seg].empty()) {
+        continue;
+      }
+      DMPDVCmdListSegment& segment = segments_[i_seg];
+      segment.helper->KRecommit(segment.kcommand.data(), segment.kcommand.size(), segment.last - segment.first);
+    }
+  }
+
+  /// @brief Schedules commited command list for execution without cache maintenance.
+  int64_t Run() {
+    int64_t exec_id;
+    if (single_device_) {
+      exec_id = single_device_->Exec();
+      if (exec_id >= 0) {
+        AtomicMax(&last_exec_id_, exec_id);
+      }
+    }
+    else {
+      exec_id = ExecSegments();
+    }
+    if (exec_id >= 0) {
+      ctx_->TrackExec(this, exec_id);
+    }
+    return exec_id;
+  }
+
+  /// @brief Records the error of the failed execution for TakeResult(), exec_mutex_ must be locked.
+  void SetError(int64_t exec_id, int res) {
+    const char *msg = NULL;
+    std::pair<int, std::string>& err = exec_errors_[exec_id];
+    err.first = dmp_dv_get_last_error(NULL, &msg);
+    err.first = err.first ? err.first : res > 0 ? res : EIO;
+    err.second = msg ? msg : "";
+  }
+
+  /// @brief Writes CPU-dirty parts of the buffers used by the commands to RAM.
+  /// @details Dirty parts of the output buffers are also invalidated,
+  ///          so the evicted lines will not overwrite the device output and the CPU will not read stale data.
+  int FlushDirtyBuffers() {
+    std::vector<DMPDVCacheRange> ranges;
+    std::vector<std::pair<size_t, size_t> > dirty;
+    std::vector<DMPDVTakenDirty> taken;
+    int res = AppendFlushRanges(ranges, dirty, taken);
+    res = res ? res : CDMPDVCacheEngine::FlushBatch(ranges);
+    if (res) {
+      RestoreDirty(taken);
+    }
+    return res;
+  }
+
+  /// @brief Marks the ranges taken for the failed flush as CPU-dirty again, so the next execution will flush them.
+  static void RestoreDirty(const std::vector<DMPDVTakenDirty>& taken) {
+    for (auto it = taken.begin(); it != taken.end(); ++it) {
+      it->mem->MarkDirty(it->offs, it->size);
+    }
+  }
+
+  /// @brief Appends cache maintenance ranges for CPU-dirty parts of the buffers used by the commands.
+  /// @param taken Receives the ranges which were taken from the memory, even when an error is returned.
+  int AppendFlushRanges(std::vector<DMPDVCacheRange>& ranges, std::vector<std::pair<size_t, size_t> >& dirty,
+                        std::vector<DMPDVTakenDirty>& taken) {
+    for (auto it = input_bufs_.begin(); it != input_bufs_.end(); ++it) {
+      int res = AppendDirtyRanges(it->first, it->second, 0, ranges, dirty, taken);
+      if (res) {
+        return res;
+      }
+    }
+    for (auto it = output_bufs_.begin(); it != output_bufs_.end(); ++it) {
+      int res = AppendDirtyRanges(it->first, it->second, DMP_DV_MEM_CPU_WONT_READ, ranges, dirty, taken);
+      if (res) {
+        return res;
+      }
+    }
+    return 0;
+  }
+
+  /// @brief Appends cache maintenance ranges for CPU-dirty parts of the buffer and clears their dirty state.
+  /// @details Cleared ranges are recorded in taken, so the caller can restore them if the flush fails.
+  int AppendDirtyRanges(struct dmp_dv_buf& buf, uint64_t size, int flags,
+                        std::vector<DMPDVCacheRange>& ranges, std::vector<std::pair<size_t, size_t> >& dirty,
+                        std::vector<DMPDVTakenDirty>& taken) {
+    CDMPDVMem *mem = (CDMPDVMem*)buf.mem;
+    dirty.clear();
+    mem->TakeDirty(buf.offs, size, &dirty);
+    for (auto it = dirty.begin(); it != dirty.end(); ++it) {
+      DMPDVTakenDirty t;
+      t.mem = mem;
+      t.offs = it->first;
+      t.size = it->second - it->first;
+      taken.push_back(t);
+    }
+    for (auto it = dirty.begin(); it != dirty.end(); ++it) {
+      DMPDVCacheRange range;
+      int res = mem->GetCacheRange(it->first, it->second - it->first, true, flags, &range, true);
+      if (res) {
+        return res;
+      }
+      if (range.fd != -1) {
+        ranges.push_back(range);
+      }
+    }
+    return 0;
+  }
+
+  /// @brief Invalidates CPU caches for the output buffers of the commands.
+  /// @details Buffers without CPU mapping are only marked stale and will be invalidated when mapped.
+  int InvalidateOutputBuffers() {
+    std::vector<DMPDVCacheRange> ranges;
+    for (auto it = output_bufs_.begin(); it != output_bufs_.end(); ++it) {
+      CDMPDVMem *mem = (CDMPDVMem*)it->first.mem;
+      if (!mem->IsMapped()) {
+        mem->MarkStale();
+        continue;
+      }
+      DMPDVCacheRange range;
+      int res = mem->GetCacheRange(it->first.offs, it->second, false, 0, &range, true);
+      if (res) {
+        return res;
+      }
+      if (range.fd != -1) {
+        ranges.push_back(range);
+      }
+    }
+    return CDMPDVCacheEngine::FlushBatch(ranges);
+  }
+
+  /// @brief Releases helpers of the commited segments.
+  void ReleaseSegments() {
+    for (auto it = segments_.rbegin(); it != segments_.rend(); ++it) {
+      it->helper->Release();
+    }
+    segments_.clear();
+    single_device_ = NULL;
+  }
+
   /// @brief Commits command list in case of single device.
   int CommitSingleDevice() {
     if (!commands_.size()) {
       SET_ERR("Command list is empty");
       return EINVAL;
     }
-    int res;
-    size_t total_size = 0;
-    for (auto cmd_it = commands_.begin(); cmd_it != commands_.end(); ++cmd_it) {
-      uint32_t size = 0;
-      res = cmd_it->device_helper->FillKCommand(NULL, (dmp_dv_cmdraw*)cmd_it->cmd.data(), size);
+    DMPDVCmdListSegment segment;
+    segment.first = 0;
+    segment.last = commands_.size();
+    segment.helper = single_device_;
+    single_device_->Retain();
+    segments_.push_back(segment);
+    int res = CommitRange(segments_.back(), single_device_);
+    if (!res) {
+      commited_ = true;
+    }
+    return res;
+  }
+
+  /// @brief Splits command list into segments of consecutive commands for the same device and commits them.
+  /// @details In profiling mode each command forms its own segment.
+  int CommitSegments() {
+    for (size_t first = 0, last; first < commands_.size(); first = last) {
+      CDMPDVCmdListDeviceHelper *device_helper = commands_[first].device_helper;
+      for (last = first + 1;
+           (!profiling_) && (last < commands_.size()) && (commands_[last].device_helper == device_helper);
+           ++last) {
+        // Empty by design
+      }
+      int device_type = 0;
+      while ((device_type < DMP_DV_DEV_COUNT) && (device_helpers_[device_type] != device_helper)) {
+        ++device_type;
+      }
+      if (device_type >= DMP_DV_DEV_COUNT) {
+        SET_LOGIC_ERR();
+        return -1;
+      }
+
+      // Each segment needs its own helper as the kernel module accepts a single command list per file handle
+      DMPDVCmdListSegment segment;
+      segment.first = first;
+      segment.last = last;
+      segment.helper = NULL;
+      int res = CDMPDVCmdListDeviceHelper::Instantiate(ctx_, device_type, &segment.helper);
       if (res) {
         return res;
       }
-      total_size += size;
+      if (!segment.helper) {
+        SET_LOGIC_ERR();
+        return -1;
+      }
+      segments_.push_back(segment);
+      res = CommitRange(segments_.back(), device_helper);
+      if (res) {
+        return res;
+      }
+    }
+    commited_ = true;
+    return 0;
+  }
+
+  /// @brief Fills kernel commands for the segment and passes them to kernel module.
+  /// @param segment Segment to commit, kernel commands are kept in it.
+  /// @param fill_helper Helper which has checked the commands.
+  int CommitRange(DMPDVCmdListSegment& segment, CDMPDVCmdListDeviceHelper *fill_helper) {
+    size_t total_size = 0;
+    for (size_t i = segment.first; i < segment.last; ++i) {
+      commands_[i].kcmd_offs = total_size;
+      total_size += commands_[i].kcmd_size;
     }
     if (!total_size) {
       SET_ERR("Calculated memory size for command list raw representation is 0");
       return EINVAL;
     }
 
-    // Allocate temporary buffer for the kernel command
-    uint8_t *kcommand = (uint8_t*)malloc(total_size);
-    if (!kcommand) {
-      SET_ERR("Could not allocate %zu bytes of memory", total_size);
-      return ENOMEM;
-    }
+    // Allocate buffer for the kernel command
+    std::vector<uint8_t>& kcommand = segment.kcommand;
+    kcommand.resize(total_size);
 
-    // Fill buffer for the kernel command
-    size_t offs = 0;
-    for (auto cmd_it = commands_.begin(); cmd_it != commands_.end(); ++cmd_it) {
-      uint32_t size = total_size - offs;
-      res = cmd_it->device_helper->FillKCommand(
-          kcommand + offs, (dmp_dv_cmdraw*)cmd_it->cmd.data(), size);
+    // Fill buffer for the kernel command in a single pass using the sizes obtained in AddRaw()
+    for (size_t i = segment.first; i < segment.last; ++i) {
+      uint32_t size = commands_[i].kcmd_size;
+      int res = fill_helper->FillKCommand(kcommand.data() + commands_[i].kcmd_offs, get_cmd(commands_[i]), size);
       if (res) {
         return res;
       }
-      offs += size;
-      if (offs > total_size) {
+      if (size != commands_[i].kcmd_size) {
         SET_LOGIC_ERR();
-        free(kcommand);
         return -1;
       }
     }
 
     // Pass command to kernel module
-    res = single_device_->KCommit(kcommand, total_size, commands_.size());
+    return segment.helper->KCommit(kcommand.data(), total_size, segment.last - segment.first);
+  }
 
-    // Free temporary buffer
-    free(kcommand);
+  /// @brief Schedules execution of all segments.
+  int64_t ExecSegments() {
+    std::lock_guard<std::mutex> lock(exec_mutex_);
+    if (!chain_worker_.joinable()) {
+      try {
+        chain_worker_ = std::thread(&CDMPDVCmdList::ChainWorker, this);
+      }
+      catch (...) {
+        SET_ERR_CODE(EAGAIN, "Failed to start the worker thread for the command list spanning several devices");
+        return -1;
+      }
+    }
+    DMPDVChainExec chain;
+    chain.exec_id = next_exec_id_;
+    chain.seg_exec_id = -1;
+
+    // Start the device right away when it is idle, otherwise the worker starts the first segment
+    // after the previous execution completes, so it will not overwrite buffers still used by the later segments
+    if (chains_.empty()) {
+      chain.seg_exec_id = segments_[0].helper->Exec();
+      if (chain.seg_exec_id < 0) {
+        return -1;
+      }
+    }
+    AtomicMax(&last_exec_id_, chain.exec_id);
+    ++next_exec_id_;
+    chains_.push_back(chain);
+    exec_cond_.notify_all();
+    return chain.exec_id;
+  }
 
-    if (!res) {
-      commited_ = true;
+  /// @brief Passes executions from segment to segment in order of scheduling.
+  void ChainWorker() {
+    std::unique_lock<std::mutex> lock(exec_mutex_);
+    for (;;) {
+      exec_cond_.wait(lock, [this]{ return (chain_stop_) || (!chains_.empty()); });
+      if (chains_.empty()) {
+        break;
+      }
+      DMPDVChainExec chain = chains_.front();
+      lock.unlock();
+
+      int res = 0;
+      int64_t exec_time = 0;
+      std::vector<int64_t> seg_exec_times;
+      for (size_t i = 0; i < segments_.size(); ++i) {
+        CDMPDVCmdListDeviceHelper *helper = segments_[i].helper;
+        int64_t seg_exec_id = ((!i) && (chain.seg_exec_id >= 0)) ? chain.seg_exec_id : helper->Exec();
+        if (seg_exec_id < 0) {
+          res = -1;
+          break;
+        }
+        res = helper->Wait(seg_exec_id);
+        if (res) {
+          break;
+        }
+        exec_time += helper->GetLastExecTime();
+        if (profiling_) {
+          seg_exec_times.push_back(helper->GetLastExecTime());
+        }
+      }
+      if ((!res) && (managed_coherency_)) {
+        res = InvalidateOutputBuffers();
+      }
+
+      lock.lock();
+      chains_.pop_front();
+      if (res) {
+        SetError(chain.exec_id, res);
+      }
+      else {
+        chain_exec_time_ = exec_time;
+        profile_times_.swap(seg_exec_times);
+      }
+      SetCompleted(chain.exec_id);
+      exec_cond_.notify_all();
     }
-    return res;
   }
 
   /// @brief Reference to device context.
@@ -547,6 +1502,60 @@ class CDMPDVCmdList : public CDMPDVBase {
   /// @brief Commands.
   std::vector<DMPDVCommand> commands_;
 
+  /// @brief Storage for the raw commands, used parts of the commands are placed one after another at 8-bytes boundaries.
+  std::vector<uint8_t> arena_;
+
+  /// @brief Pairs of <buffer, size in bytes> read by the commands, one reference on the memory handle for each pair.
+  std::vector<std::pair<struct dmp_dv_buf, uint64_t> > input_bufs_;
+
+  /// @brief Pairs of <buffer, size in bytes> written by the commands, one reference on the memory handle for each pair.
+  std::vector<std::pair<struct dmp_dv_buf, uint64_t> > output_bufs_;
+
   /// @brief When the command list comntains the single device, this variable is assigned to it.
   CDMPDVCmdListDeviceHelper *single_device_;
+
+  /// @brief Flush dirty input and output buffers on Exec() and invalidate output buffers on Wait().
+  bool managed_coherency_;
+
+  /// @brief Each command is commited as a separate segment to get its execution time.
+  bool profiling_;
+
+  /// @brief Maximum completed execution id, -1 if none.
+  int64_t completed_exec_id_;
+
+  /// @brief Maximum execution id returned by Exec(), -1 if none.
+  int64_t last_exec_id_;
+
+  /// @brief Maximum execution id tracked by the reaper of the context, -1 if none.
+  int64_t tracked_exec_id_;
+
+  /// @brief Commited segments, the single one when the command list contains the single device.
+  std::vector<DMPDVCmdListSegment> segments_;
+
+  /// @brief Execution id for the next Exec() when the command list contains several devices.
+  int64_t next_exec_id_;
+
+  /// @brief Scheduled executions not yet completed, the front one is processed by the worker.
+  std::deque<DMPDVChainExec> chains_;
+
+  /// @brief Errors of the failed executions not yet reported by TakeResult().
+  std::map<int64_t, std::pair<int, std::string> > exec_errors_;
+
+  /// @brief Sum of the segments execution times of the last successful execution.
+  int64_t chain_exec_time_;
+
+  /// @brief Execution times of the segments of the last successful execution in profiling mode.
+  std::vector<int64_t> profile_times_;
+
+  /// @brief Request for the worker to exit when there are no scheduled executions.
+  bool chain_stop_;
+
+  /// @brief Mutex for protecting the above execution state.
+  std::mutex exec_mutex_;
+
+  /// @brief Condition signaled on scheduling and completion of executions.
+  std::condition_variable exec_cond_;
+
+  /// @brief Thread passing executions from segment to segment.
+  std::thread chain_worker_;
 };
@@ -25,7 +25,7 @@ class CDMPDVCmdListConvHelper : public CDMPDVCmdListKHelper {
  public:
   /// @brief Constructor.
   CDMPDVCmdListConvHelper(CDMPDVContext *ctx) : CDMPDVCmdListKHelper(ctx) {
-    fnme_acc_ = DMP_DV_DEV_PATH_CONV;
+    fnme_acc_ = ctx->get_path(DMP_DV_PATH_CONV);
   }
 
   /// @brief Destructor.
@@ -116,6 +116,150 @@ class CDMPDVCmdListConvHelper : public CDMPDVCmdListKHelper {
     return -1;
   }
 
+  /// @brief Returns number of bytes of the checked command up to the last active run.
+  virtual uint32_t GetRawSize(struct dmp_dv_cmdraw *cmd) {
+    if (cmd->device_type != DMP_DV_DEV_CONV) {
+      return cmd->size;
+    }
+    size_t offs = 0;
+    struct dmp_dv_cmdraw_conv_v0 *cmd_v0 = (struct dmp_dv_cmdraw_conv_v0*)cmd;
+    switch (cmd->version) {
+      case 0:
+        break;
+      case 1:
+        offs = offsetof(struct dmp_dv_cmdraw_conv_v1, conv_cmd);
+        cmd_v0 = &((struct dmp_dv_cmdraw_conv_v1*)cmd)->conv_cmd;
+        break;
+      default:
+        return cmd->size;
+    }
+    int n_run = 0;
+    for (uint32_t topo = cmd_v0->topo; topo; topo >>= 1) {
+      ++n_run;
+    }
+    return offs + offsetof(struct dmp_dv_cmdraw_conv_v0, run) + n_run * sizeof(cmd_v0->run[0]);
+  }
+
+  /// @brief Collects buffers referenced by the command together with their copies in the kernel command.
+  virtual int GetBufRefs(struct dmp_dv_cmdraw *cmd, uint8_t *kcmd,
+                         std::vector<std::pair<struct dmp_dv_buf*, struct dmp_dv_kbuf*> >& refs) {
+    switch (cmd->device_type) {
+      case DMP_DV_DEV_CONV:
+        switch (cmd->version) {
+          case 0:
+            GetBufRefs_v0((dmp_dv_cmdraw_conv_v0*)cmd, (dmp_dv_kcmdraw_conv_v0*)kcmd, refs);
+            return 0;
+
+          case 1:
+          {
+            struct dmp_dv_cmdraw_conv_v1 *cmd_v1 = (dmp_dv_cmdraw_conv_v1*)cmd;
+            struct dmp_dv_kcmdraw_conv_v1 *kcmd_v1 = (dmp_dv_kcmdraw_conv_v1*)kcmd;
+            refs.push_back(std::make_pair(&cmd_v1->u8tofp16_table, &kcmd_v1->u8tofp16_table));
+            GetBufRefs_v0(&cmd_v1->conv_cmd, (dmp_dv_kcmdraw_conv_v0*)(kcmd + sizeof(struct dmp_dv_kbuf) + 8), refs);
+            return 0;
+          }
+
+          default:
+            SET_ERR("Invalid argument: cmd->version %d is not supported", (int)cmd->version);
+            return ENOTSUP;
+        }
+        break;
+      case DMP_DV_DEV_FC:
+        switch (cmd->version) {
+          case 0:
+          {
+            // Weights were repacked to the helper buffer, so they can not be rebound
+            struct dmp_dv_cmdraw_fc_v0 *cmd_fc = (dmp_dv_cmdraw_fc_v0*)cmd;
+            struct dmp_dv_kcmdraw_conv_v0 *kcmd_conv = (dmp_dv_kcmdraw_conv_v0*)kcmd;
+            refs.push_back(std::make_pair(&cmd_fc->input_buf, &kcmd_conv->input_buf));
+            refs.push_back(std::make_pair(&cmd_fc->output_buf, &kcmd_conv->output_buf));
+            refs.push_back(std::make_pair(&cmd_fc->weight_buf, (struct dmp_dv_kbuf*)NULL));
+            return 0;
+          }
+
+          default:
+            SET_ERR("Invalid argument: cmd->version %d is not supported with device_type %d on device_type %d",
+                    (int)cmd->version, cmd->device_type, DMP_DV_DEV_CONV);
+            return ENOTSUP;
+        }
+        break;
+      default:
+        SET_ERR("Invalid argument: handling of cmd->device_type %d is not supported on device_type %d",
+                cmd->device_type, DMP_DV_DEV_CONV);
+        return ENOTSUP;
+    }
+    SET_LOGIC_ERR();
+    return -1;
+  }
+
+  /// @brief Returns number of arithmetic operations of the checked command, multiply-add counts as 2 operations.
+  virtual uint64_t GetOps(struct dmp_dv_cmdraw *cmd) {
+    switch (cmd->device_type) {
+      case DMP_DV_DEV_CONV:
+        switch (cmd->version) {
+          case 0:
+            return GetOps_v0((dmp_dv_cmdraw_conv_v0*)cmd);
+          case 1:
+            return GetOps_v0(&((dmp_dv_cmdraw_conv_v1*)cmd)->conv_cmd);
+          default:
+            break;
+        }
+        break;
+      case DMP_DV_DEV_FC:
+        if (!cmd->version) {
+          struct dmp_dv_cmdraw_fc_v0 *cmd_fc = (dmp_dv_cmdraw_fc_v0*)cmd;
+          return (uint64_t)cmd_fc->input_size * cmd_fc->output_size * 2;
+        }
+        break;
+      default:
+        break;
+    }
+    return 0;
+  }
+
+  /// @brief Returns number of arithmetic operations in convolutions of the command of version 0.
+  uint64_t GetOps_v0(struct dmp_dv_cmdraw_conv_v0 *cmd) {
+    struct dmp_dv_kcmdraw_conv_v0 kcmd;
+    uint32_t size = sizeof(kcmd);
+    if (FillKCommand_v0(&kcmd, cmd, size)) {
+      return 0;
+    }
+    struct conv_data_size conv_size, out_size;
+    init_conv_input_size_v0_4(cmd->w, cmd->h, cmd->z, cmd->c, &conv_size);
+    uint64_t n_macs = 0;
+    for (uint32_t topo = cmd->topo, i_run = 0; topo; topo >>= 1, ++i_run) {
+      struct dmp_dv_kcmdraw_conv_v0_run& run = kcmd.run[i_run];
+      uint32_t weights_size = 0;
+      if (run.conv_enable) {
+        // Output of the convolution is taken before pooling
+        struct dmp_dv_kcmdraw_conv_v0_run conv_run = run;
+        conv_run.pool_enable = 0;
+        get_conv_output_size_v0(&conv_run, &conv_size, &out_size, &weights_size);
+        const int kx = run.p & 0xFF;
+        const int ky = (run.p & 0xFF00) ? (run.p & 0xFF00) >> 8 : kx;
+        const int c = (run.conv_enable & 3) == 3 ? 1 : conv_size.c;  // depthwise convolution uses single channel
+        n_macs += (uint64_t)out_size.w * out_size.h * out_size.z * out_size.c * kx * ky * run.pz * c;
+      }
+      get_conv_output_size_v0(&run, &conv_size, &conv_size, &weights_size);
+      if (topo & 1) {  // next input will be the first
+        init_conv_input_size_v0_4(cmd->w, cmd->h, cmd->z, cmd->c, &conv_size);
+      }
+    }
+    return n_macs * 2;
+  }
+
+  /// @brief Collects buffers referenced by the command of version 0.
+  void GetBufRefs_v0(struct dmp_dv_cmdraw_conv_v0 *cmd, struct dmp_dv_kcmdraw_conv_v0 *kcmd,
+                     std::vector<std::pair<struct dmp_dv_buf*, struct dmp_dv_kbuf*> >& refs) {
+    refs.push_back(std::make_pair(&cmd->input_buf, &kcmd->input_buf));
+    refs.push_back(std::make_pair(&cmd->output_buf, &kcmd->output_buf));
+    refs.push_back(std::make_pair(&cmd->eltwise_buf, &kcmd->eltwise_buf));
+    int i_run = 0;
+    for (uint32_t topo = cmd->topo; topo; topo >>= 1, ++i_run) {
+      refs.push_back(std::make_pair(&cmd->run[i_run].weight_buf, &kcmd->run[i_run].weight_buf));
+    }
+  }
+
   /// @brief Checks command of version 0 for validness.
   int CheckRaw_v0(struct dmp_dv_cmdraw_conv_v0 *cmd,
                   std::vector<std::pair<struct dmp_dv_buf, uint64_t> >& input_bufs,
@@ -256,7 +400,7 @@ class CDMPDVCmdListConvHelper : public CDMPDVCmdListKHelper {
                     (int)cmd->w, (int)cmd->h, pool_pad[0], pool_pad[1], pool_pad[2], pool_pad[3], pool_kx, pool_ky);
             return -1;
           }
-          if ((pool_kx != pool_ky) && (ctx_->get_svn_version() < 93)) {
+          if ((pool_kx != pool_ky) && (!ctx_->has_features(DMP_DV_FEATURE_NON_SQUARE_POOL))) {
             SET_ERR("Non-square pooling support requires /sys/class/dmp_dv/dv_conv/svn_version to be at least 93, got %d",
                     ctx_->get_svn_version());
             return -1;
@@ -281,7 +425,7 @@ class CDMPDVCmdListConvHelper : public CDMPDVCmdListKHelper {
         }
       }
 
-      if ((is_deconv) && (ctx_->get_svn_version() < 93)) {
+      if ((is_deconv) && (!ctx_->has_features(DMP_DV_FEATURE_DECONV))) {
         SET_ERR("Deconvolution support requires /sys/class/dmp_dv/dv_conv/svn_version to be at least 93, got %d",
                 ctx_->get_svn_version());
         return -1;
@@ -309,7 +453,7 @@ class CDMPDVCmdListConvHelper : public CDMPDVCmdListKHelper {
           return -1;
         }
         const int min_svn_version = ctx_->is_zia_c2() ? 83 : 93;
-        if ((ctx_->get_svn_version() < min_svn_version) && ((w < pad[0]) || (w < pad[1]) || (h < pad[2]) || (h < pad[3]))) {
+        if ((!ctx_->has_features(DMP_DV_FEATURE_DILATION)) && ((w < pad[0]) || (w < pad[1]) || (h < pad[2]) || (h < pad[3]))) {
           SET_ERR("Input size %dx%d pad_lrtb=%dx%dx%dx%d is too small for convolution of size %dx%d dilated by %dx%d "
                   "for /sys/class/dmp_dv/dv_conv/svn_version less than %d, got %d",
                   w, h, pad[0], pad[1], pad[2], pad[3], kx, ky, dil[0], dil[1], min_svn_version, ctx_->get_svn_version());
@@ -487,15 +631,15 @@ class CDMPDVCmdListConvHelper : public CDMPDVCmdListKHelper {
 
       kcmd->input_buf.fd = CDMPDVMem::get_fd(cmd->input_buf.mem);
       kcmd->input_buf.rsvd = 0;
-      kcmd->input_buf.offs = cmd->input_buf.offs;
+      kcmd->input_buf.offs = cmd->input_buf.offs + CDMPDVMem::get_base_offs(cmd->input_buf.mem);
 
       kcmd->output_buf.fd = CDMPDVMem::get_fd(cmd->output_buf.mem);
       kcmd->output_buf.rsvd = 0;
-      kcmd->output_buf.offs = cmd->output_buf.offs;
+      kcmd->output_buf.offs = cmd->output_buf.offs + CDMPDVMem::get_base_offs(cmd->output_buf.mem);
 
       kcmd->eltwise_buf.fd = CDMPDVMem::get_fd(cmd->eltwise_buf.mem);
       kcmd->eltwise_buf.rsvd = 0;
-      kcmd->eltwise_buf.offs = cmd->eltwise_buf.offs;
+      kcmd->eltwise_buf.offs = cmd->eltwise_buf.offs + CDMPDVMem::get_base_offs(cmd->eltwise_buf.mem);
 
       kcmd->topo = cmd->topo;
       kcmd->w = cmd->w;
@@ -508,7 +652,8 @@ class CDMPDVCmdListConvHelper : public CDMPDVCmdListKHelper {
       for (int i_run = 0; i_run < n_run; ++i_run) {
         kcmd->run[i_run].weight_buf.fd = CDMPDVMem::get_fd(cmd->run[i_run].weight_buf.mem);
         kcmd->run[i_run].weight_buf.rsvd = 0;
-        kcmd->run[i_run].weight_buf.offs = cmd->run[i_run].weight_buf.offs;
+        kcmd->run[i_run].weight_buf.offs =
+            cmd->run[i_run].weight_buf.offs + CDMPDVMem::get_base_offs(cmd->run[i_run].weight_buf.mem);
         kcmd->run[i_run].conv_pad = cmd->run[i_run].conv_pad;
         kcmd->run[i_run].pool_pad = cmd->run[i_run].pool_pad;
         kcmd->run[i_run].m = cmd->run[i_run].m;
@@ -568,7 +713,7 @@ class CDMPDVCmdListConvHelper : public CDMPDVCmdListKHelper {
       kcmd->header.version = 1;
       kcmd->u8tofp16_table.fd = CDMPDVMem::get_fd(cmd->u8tofp16_table.mem);
       kcmd->u8tofp16_table.rsvd = 0;
-      kcmd->u8tofp16_table.offs = cmd->u8tofp16_table.offs;
+      kcmd->u8tofp16_table.offs = cmd->u8tofp16_table.offs + CDMPDVMem::get_base_offs(cmd->u8tofp16_table.mem);
       kcmd->to_bgr = cmd->to_bgr;
     }
 
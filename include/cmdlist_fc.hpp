@@ -27,7 +27,7 @@ class CDMPDVCmdListFCHelper : public CDMPDVCmdListKHelper {
  public:
   /// @brief Constructor.
   CDMPDVCmdListFCHelper(CDMPDVContext *ctx) : CDMPDVCmdListKHelper(ctx) {
-    fnme_acc_ = DMP_DV_DEV_PATH_FC;
+    fnme_acc_ = ctx->get_path(DMP_DV_PATH_FC);
   }
 
   /// @brief Destructor.
@@ -71,6 +71,37 @@ class CDMPDVCmdListFCHelper : public CDMPDVCmdListKHelper {
     return -1;
   }
 
+  /// @brief Collects buffers referenced by the command together with their copies in the kernel command.
+  virtual int GetBufRefs(struct dmp_dv_cmdraw *cmd, uint8_t *kcmd,
+                         std::vector<std::pair<struct dmp_dv_buf*, struct dmp_dv_kbuf*> >& refs) {
+    switch (cmd->version) {
+      case 0:
+      {
+        struct dmp_dv_cmdraw_fc_v0 *cmd_v0 = (struct dmp_dv_cmdraw_fc_v0*)cmd;
+        struct dmp_dv_kcmdraw_fc_v0 *kcmd_v0 = (struct dmp_dv_kcmdraw_fc_v0*)kcmd;
+        refs.push_back(std::make_pair(&cmd_v0->input_buf, &kcmd_v0->input_buf));
+        refs.push_back(std::make_pair(&cmd_v0->output_buf, &kcmd_v0->output_buf));
+        refs.push_back(std::make_pair(&cmd_v0->weight_buf, &kcmd_v0->weight_buf));
+        return 0;
+      }
+
+      default:
+        SET_ERR("Invalid argument: cmd->version %d is not supported", (int)cmd->version);
+        return ENOTSUP;
+    }
+    SET_LOGIC_ERR();
+    return -1;
+  }
+
+  /// @brief Returns number of arithmetic operations of the checked command, multiply-add counts as 2 operations.
+  virtual uint64_t GetOps(struct dmp_dv_cmdraw *cmd) {
+    if (cmd->version) {
+      return 0;
+    }
+    struct dmp_dv_cmdraw_fc_v0 *cmd_v0 = (struct dmp_dv_cmdraw_fc_v0*)cmd;
+    return (uint64_t)cmd_v0->input_size * cmd_v0->output_size * 2;
+  }
+
   /// @brief Checks command of version 0 for validness.
   int CheckRaw_v0(struct dmp_dv_cmdraw_fc_v0 *cmd,
                   std::vector<std::pair<struct dmp_dv_buf, uint64_t> >& input_bufs,
@@ -143,15 +174,15 @@ class CDMPDVCmdListFCHelper : public CDMPDVCmdListKHelper {
 
       kcmd->input_buf.fd = CDMPDVMem::get_fd(cmd->input_buf.mem);
       kcmd->input_buf.rsvd = 0;
-      kcmd->input_buf.offs = cmd->input_buf.offs;
+      kcmd->input_buf.offs = cmd->input_buf.offs + CDMPDVMem::get_base_offs(cmd->input_buf.mem);
 
       kcmd->output_buf.fd = CDMPDVMem::get_fd(cmd->output_buf.mem);
       kcmd->output_buf.rsvd = 0;
-      kcmd->output_buf.offs = cmd->output_buf.offs;
+      kcmd->output_buf.offs = cmd->output_buf.offs + CDMPDVMem::get_base_offs(cmd->output_buf.mem);
 
       kcmd->weight_buf.fd = CDMPDVMem::get_fd(cmd->weight_buf.mem);
       kcmd->weight_buf.rsvd = 0;
-      kcmd->weight_buf.offs = cmd->weight_buf.offs;
+      kcmd->weight_buf.offs = cmd->weight_buf.offs + CDMPDVMem::get_base_offs(cmd->weight_buf.mem);
 
       kcmd->input_size = cmd->input_size;
       kcmd->output_size = cmd->output_size;
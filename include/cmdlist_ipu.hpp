@@ -33,7 +33,7 @@ class CDMPDVCmdListIPUHelper : public CDMPDVCmdListKHelper {
 
     /// @brief Constructor.
     CDMPDVCmdListIPUHelper(CDMPDVContext *ctx) : CDMPDVCmdListKHelper(ctx) {
-      fnme_acc_ = DMP_DV_DEV_PATH_IPU;
+      fnme_acc_ = ctx->get_path(DMP_DV_PATH_IPU);
     }
 
     /// @brief Destructor.
@@ -77,6 +77,28 @@ class CDMPDVCmdListIPUHelper : public CDMPDVCmdListKHelper {
       return -1;
     }
 
+    /// @brief Collects buffers referenced by the command together with their copies in the kernel command.
+    virtual int GetBufRefs(dmp_dv_cmdraw *cmd, uint8_t *kcmd,
+        std::vector<std::pair<struct dmp_dv_buf*, struct dmp_dv_kbuf*> >& refs) {
+      switch (cmd->version) {
+        case 0:
+        {
+          dmp_dv_cmdraw_ipu_v0 *cmd_v0 = (dmp_dv_cmdraw_ipu_v0*)cmd;
+          dmp_dv_kcmdraw_ipu_v0 *kcmd_v0 = (dmp_dv_kcmdraw_ipu_v0*)kcmd;
+          refs.push_back(std::make_pair(&cmd_v0->tex, &kcmd_v0->tex));
+          refs.push_back(std::make_pair(&cmd_v0->rd, &kcmd_v0->rd));
+          refs.push_back(std::make_pair(&cmd_v0->wr, &kcmd_v0->wr));
+          return 0;
+        }
+
+        default:
+          SET_ERR("Invalid argument: cmd->version %d is not supported", (int)cmd->version);
+          return ENOTSUP;
+      }
+      SET_LOGIC_ERR();
+      return -1;
+    }
+
     /// @brief Checks command of version 0 for validness.
     int CheckRaw_v0(struct dmp_dv_cmdraw_ipu_v0 *cmd,
         std::vector<std::pair<struct dmp_dv_buf, uint64_t> >& input_bufs,
@@ -242,13 +264,13 @@ class CDMPDVCmdListIPUHelper : public CDMPDVCmdListKHelper {
 
         kcmd->tex.fd   = CDMPDVMem::get_fd(cmd->tex.mem);
         kcmd->tex.rsvd = 0;
-        kcmd->tex.offs = cmd->tex.offs;
+        kcmd->tex.offs = cmd->tex.offs + CDMPDVMem::get_base_offs(cmd->tex.mem);
         kcmd->rd.fd    = CDMPDVMem::get_fd(cmd->rd.mem);
         kcmd->rd.rsvd  = 0;
-        kcmd->rd.offs  = cmd->rd.offs;
+        kcmd->rd.offs  = cmd->rd.offs + CDMPDVMem::get_base_offs(cmd->rd.mem);
         kcmd->wr.fd    = CDMPDVMem::get_fd(cmd->wr.mem);
         kcmd->wr.rsvd  = 0;
-        kcmd->wr.offs  = cmd->wr.offs;
+        kcmd->wr.offs  = cmd->wr.offs + CDMPDVMem::get_base_offs(cmd->wr.mem);
 
         kcmd->fmt_tex      = cmd->fmt_tex;
         kcmd->fmt_rd       = cmd->fmt_rd;
@@ -29,7 +29,7 @@ class CDMPDVCmdListMaximizerHelper : public CDMPDVCmdListKHelper {
   public:
     /// @brief Constructor.
     CDMPDVCmdListMaximizerHelper(CDMPDVContext *ctx) : CDMPDVCmdListKHelper(ctx) {
-      fnme_acc_ = "/dev/dv_maximizer";
+      fnme_acc_ = ctx->get_path(DMP_DV_PATH_MAXIMIZER);
     }
 
     /// @brief Destructor.
@@ -109,6 +109,27 @@ class CDMPDVCmdListMaximizerHelper : public CDMPDVCmdListKHelper {
       return -1;
     }
 
+    /// @brief Collects buffers referenced by the command together with their copies in the kernel command.
+    virtual int GetBufRefs(dmp_dv_cmdraw *cmd, uint8_t *kcmd,
+                           std::vector<std::pair<struct dmp_dv_buf*, struct dmp_dv_kbuf*> >& refs) {
+      switch (cmd->version) {
+        case 0:
+        {
+          dmp_dv_cmdraw_maximizer_v0 *cmd_v0 = (dmp_dv_cmdraw_maximizer_v0*)cmd;
+          dmp_dv_kcmdraw_maximizer_v0 *kcmd_v0 = (dmp_dv_kcmdraw_maximizer_v0*)kcmd;
+          refs.push_back(std::make_pair(&cmd_v0->input_buf, &kcmd_v0->input_buf));
+          refs.push_back(std::make_pair(&cmd_v0->output_buf, &kcmd_v0->output_buf));
+          return 0;
+        }
+
+        default:
+          SET_ERR("Invalid argument: cmd->version %d is not supported", (int)cmd->version);
+          return ENOTSUP;
+      }
+      SET_LOGIC_ERR();
+      return -1;
+    }
+
     /// @brief Fills command of version 0 in the format suitable for later execution on the device.
     int FillKCommand_v0(struct dmp_dv_kcmdraw_maximizer_v0 *kcmd,
                         struct dmp_dv_cmdraw_maximizer_v0 *cmd, uint32_t& size) {
@@ -124,10 +145,10 @@ class CDMPDVCmdListMaximizerHelper : public CDMPDVCmdListKHelper {
         kcmd->header.size     = sizeof(*kcmd);
         kcmd->input_buf.fd    = CDMPDVMem::get_fd(cmd->input_buf.mem);
         kcmd->input_buf.rsvd  = 0;
-        kcmd->input_buf.offs  = cmd->input_buf.offs;
+        kcmd->input_buf.offs  = cmd->input_buf.offs + CDMPDVMem::get_base_offs(cmd->input_buf.mem);
         kcmd->output_buf.fd   = CDMPDVMem::get_fd(cmd->output_buf.mem);
         kcmd->output_buf.rsvd = 0;
-        kcmd->output_buf.offs = cmd->output_buf.offs;
+        kcmd->output_buf.offs = cmd->output_buf.offs + CDMPDVMem::get_base_offs(cmd->output_buf.mem);
 
         kcmd->width  = cmd->width;
         kcmd->height = cmd->height;
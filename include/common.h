@@ -43,31 +43,92 @@ extern "C" {
 #endif
 
 
-/// @brief Last error message (forward declaration).
-extern char s_last_error_message[256];
+/// @brief Maximum number of arguments of the lazily formatted error message.
+#define DMP_DV_LAST_ERROR_MAX_ARGS 12
 
+/// @brief Types of the captured error message arguments.
+#define DMP_DV_LAST_ERROR_ARG_INT 0
+#define DMP_DV_LAST_ERROR_ARG_DOUBLE 1
+#define DMP_DV_LAST_ERROR_ARG_STRING 2
+#define DMP_DV_LAST_ERROR_ARG_POINTER 3
 
-/// @brief Helper to set the last error message.
-#define SET_ERR(...) snprintf(s_last_error_message, sizeof(s_last_error_message), __VA_ARGS__)
+
+/// @brief Captured error message argument.
+typedef struct {
+  int type;         // one of DMP_DV_LAST_ERROR_ARG_*
+  union {
+    int64_t i;      // integer value or offset in dmp_dv_last_error::strings
+    double d;       // floating point value
+    const void *p;  // pointer value
+  } v;
+} DMPDVLastErrorArg;
+
+
+/// @brief Last error of the thread.
+struct dmp_dv_last_error {
+  int code;                                             // errno-style error code, 0 if no error was set
+  const char *format;                                   // format of the message which is not formatted yet, NULL otherwise
+  int n_args;                                           // number of captured arguments
+  DMPDVLastErrorArg args[DMP_DV_LAST_ERROR_MAX_ARGS];   // captured arguments
+  size_t strings_size;                                  // used size of strings
+  char strings[256];                                    // copies of string arguments
+  char message[256];                                    // formatted message
+};
+
+
+/// @brief Last error of the thread (forward declaration).
+extern __thread struct dmp_dv_last_error s_last_error;
+
+
+/// @brief Sets the last error of the calling thread formatting the message immediately.
+void dmp_dv_set_last_error_code(int code, const char *format, ...) __attribute__((format(printf, 2, 3)));
+
+
+/// @brief Helper to set the last error code and message.
+/// @details C++ code defers formatting of the message until it is requested,
+///          the unevaluated snprintf() keeps compile-time checking of the format.
+#ifdef __cplusplus
+#define SET_ERR_CODE(code, ...) (CDMPDVLastError::Set(code, __VA_ARGS__), (void)sizeof(snprintf(NULL, 0, __VA_ARGS__)))
+#else
+#define SET_ERR_CODE(code, ...) dmp_dv_set_last_error_code(code, __VA_ARGS__)
+#endif
+
+
+/// @brief Helper to set the last error message for invalid argument or unsupported configuration.
+#define SET_ERR(...) SET_ERR_CODE(EINVAL, __VA_ARGS__)
 
 
 /// @brief Helper to set the last error message for ioctl call.
-#define SET_IOCTL_ERR(retval, dev, cmd) SET_ERR("ioctl(%s) returned %d for %s with errno=%d: %s", cmd, retval, dev, errno, strerror(errno))
+#define SET_IOCTL_ERR(retval, dev, cmd) SET_ERR_CODE(errno, "ioctl(%s) returned %d for %s with errno=%d: %s", cmd, retval, dev, errno, strerror(errno))
 
 
 /// @brief Helper to set the last error message on implementation logic error.
 #define SET_LOGIC_ERR() SET_ERR("%s(): Control should not reach line %d of file %s", __func__, __LINE__, __FILE__)
 
 
-/// @brief Path to convolutional character device file.
-#define DMP_DV_DEV_PATH_CONV  "/dev/dv_conv"
+/// @brief Default directory with character device files, overridden by DMP_DV_DEV_ROOT environment variable.
+#define DMP_DV_DEV_ROOT  "/dev"
+
+/// @brief Default sysfs directory with device capabilities, overridden by DMP_DV_SYSFS_ROOT environment variable.
+#define DMP_DV_SYSFS_ROOT  "/sys/class/dmp_dv"
 
-/// @brief Path to fully connected character device file.
-#define DMP_DV_DEV_PATH_FC  "/dev/dv_fc"
+/// @brief Name of ION allocator character device file.
+#define DMP_DV_DEV_NAME_ION  "ion"
 
-/// @brief Path to IPU character device file.
-#define DMP_DV_DEV_PATH_IPU  "/dev/dv_ipu"
+/// @brief Name of convolutional character device file.
+#define DMP_DV_DEV_NAME_CONV  "dv_conv"
+
+/// @brief Name of fully connected character device file.
+#define DMP_DV_DEV_NAME_FC  "dv_fc"
+
+/// @brief Name of IPU character device file.
+#define DMP_DV_DEV_NAME_IPU  "dv_ipu"
+
+/// @brief Name of maximizer character device file.
+#define DMP_DV_DEV_NAME_MAXIMIZER  "dv_maximizer"
 
 #ifdef __cplusplus
 }  // extern "C"
+
+#include "last_error.hpp"
 #endif
@@ -18,8 +18,9 @@
 #pragma once
 
 #include "base.hpp"
-
-#include <string>
+#include "device_info.hpp"
+#include "mem_pool.hpp"
+#include "mem_usage.hpp"
 
 
 #ifndef ERESTARTSYS
@@ -27,21 +28,20 @@
 #endif
 
 
+class CDMPDVReaper;
+class CDMPDVCmdList;
+
+
 /// @brief Implementation of dmp_dv_context.
 class CDMPDVContext : public CDMPDVBase {
  public:
   /// @brief Constructor.
   CDMPDVContext() : CDMPDVBase() {
-    fd_ion_ = -1;
-    dma_heap_id_mask_ = 0;
-    ub_size_ = 0;
-    max_kernel_size_ = 3;
-    conv_freq_ = 0;
-    fc_freq_ = 0;
-    max_fc_vector_size_ = 16384;
-    mac_num_ = 0;
-    svn_version_ = 0;
-    zia_c2_ = false;
+    dev_ = NULL;
+    reaper_ = NULL;
+    track_execs_ = 0;
+    evict_callback_ = NULL;
+    evict_user_data_ = NULL;
   }
 
   /// @brief Called when the object is about to be destroyed.
@@ -51,165 +51,150 @@ class CDMPDVContext : public CDMPDVBase {
 
   /// @brief Releases held resources.
   void Cleanup() {
-    if (fd_ion_ != -1) {
-      close(fd_ion_);
-      fd_ion_ = -1;
+    ReleaseReaper();
+    mem_pool_.SetMaxCachedBytes(0);
+    if (dev_) {
+      dev_->Release();
+      dev_ = NULL;
     }
-    dma_heap_id_mask_ = 0;
   }
 
   /// @brief Initializes the DV device.
+  /// @details Device capabilities and ION file descriptor are taken from the process-wide snapshot,
+  ///          so only the first context in the process probes the device.
   bool Initialize() {
     Cleanup();
+    dev_ = CDMPDVDeviceInfo::Acquire();
+    return dev_ != NULL;
+  }
 
-    fd_ion_ = open("/dev/ion", O_RDONLY | O_CLOEXEC);  // O_CLOEXEC is suggested for security
-    if (fd_ion_ == -1) {
-      SET_ERR("open() failed for /dev/ion: %s", strerror(errno));
-      return false;
-    }
-
-    // Get ION heap counts
-    struct ion_heap_query query;
-    memset(&query, 0, sizeof(query));
-    int res = ioctl(fd_ion_, ION_IOC_HEAP_QUERY, &query);
-    if (res < 0) {
-      SET_IOCTL_ERR(res, "/dev/ion", "ION_IOC_HEAP_QUERY");
-      return false;
-    }
-    const int n = query.cnt;
-    if ((n < 1) || (n > 32)) {
-      SET_ERR("Got unexpected number of ION heaps: %d", n);
-      return false;
-    }
-
-    // Get ION heap informations
-    dma_heap_id_mask_ = 0;
-    struct ion_heap_data heaps[32];
-    query.heaps = (size_t)&heaps[0];
-    res = ioctl(fd_ion_, ION_IOC_HEAP_QUERY, &query);
-    if (res < 0) {
-      SET_IOCTL_ERR(res, "/dev/ion", "ION_IOC_HEAP_QUERY");
-      return false;
-    }
-    for (int i = 0; i < n; ++i) {
-      switch (heaps[i].type) {
-        case ION_HEAP_TYPE_SYSTEM:
-        case ION_HEAP_TYPE_SYSTEM_CONTIG:
-        case ION_HEAP_TYPE_CARVEOUT:
-        case ION_HEAP_TYPE_CHUNK:
-        case ION_HEAP_TYPE_CUSTOM:
-          break;
-        case ION_HEAP_TYPE_DMA:
-          dma_heap_id_mask_ |= (1 << heaps[i].heap_id);
-          break;
-        default:
-          break;
-      }
-    }
-    if (!dma_heap_id_mask_) {
-      SET_ERR("ION heaps doesn\'t contain ION_HEAP_TYPE_DMA");
-      return false;
-    }
-
-    ub_size_ = sysfs_read_int("conv/ub_size", 0);
-    max_kernel_size_ = sysfs_read_int("conv/max_kernel_size", 3);
-    conv_freq_ = sysfs_read_int("conv/conv_freq", 0);
-    fc_freq_ = sysfs_read_int("fc/fc_freq", 0);
-    max_fc_vector_size_ = sysfs_read_int("fc/max_fc_vector_size", 16384);
-    mac_num_ = sysfs_read_int("conv/mac_num", 0);
-    svn_version_ = sysfs_read_int("conv/svn_version", 0);
-
-    zia_c2_ = (sizeof(size_t) == 4) && (ub_size_ == 524288) && (mac_num_ == 576);  // TODO: add proper detection.
+  /// @brief Returns handle to ION file descriptor.
+  inline int get_fd_ion() const {
+    return dev_->get_fd_ion();
+  }
 
-    char s[256];
-    snprintf(s, sizeof(s), "DMP DV: ub_size=%d max_kernel_size=%d conv_freq=%d fc_freq=%d max_fc_vector_size=%d",
-             ub_size_, max_kernel_size_, conv_freq_, fc_freq_, max_fc_vector_size_);
-    info_ = s;
+  /// @brief Returns ION DMA heap id mask.
+  inline uint32_t get_dma_heap_id_mask() const {
+    return dev_->get_dma_heap_id_mask();
+  }
 
-    return true;
+  /// @brief Returns pool of device-accessible memory allocations.
+  inline CDMPDVMemPool *get_mem_pool() {
+    return &mem_pool_;
   }
 
-  /// @brief Reads single int value from sysfs file.
-  int sysfs_read_int(const char *key, int def) {
-    char path[256];
-    snprintf(path, sizeof(path), "/sys/class/dmp_dv/dv_%s", key);
-    FILE *fin = fopen(path, "r");
-    if (!fin) {
-      return def;
-    }
-    int res = def;
-    if (fscanf(fin, "%d", &res) != 1) {
-      res = def;
-    }
-    fclose(fin);
-    return res;
+  /// @brief Returns accounting of memory allocated within this context.
+  inline CDMPDVMemUsage *get_mem_usage() {
+    return &mem_usage_;
   }
 
-  /// @brief Returns handle to ION file descriptor.
-  inline int get_fd_ion() const {
-    return fd_ion_;
+  /// @brief Sets the memory budget and the eviction callback.
+  void SetMemBudget(size_t budget_bytes, dmp_dv_mem_evict_callback callback, void *user_data) {
+    std::lock_guard<std::mutex> lock(evict_mutex_);
+    mem_usage_.SetBudget(budget_bytes);
+    evict_callback_ = callback;
+    evict_user_data_ = user_data;
   }
 
-  /// @brief Returns ION DMA heap id mask.
-  inline uint32_t get_dma_heap_id_mask() const {
-    return dma_heap_id_mask_;
+  /// @brief Accounts memory which is about to be allocated from ION checking the memory budget.
+  /// @details When the budget would be exceeded, the memory pool is trimmed first,
+  ///          then the eviction callback is invoked once and the memory it has released is trimmed from the pool.
+  /// @return true on success, false if the budget would be exceeded.
+  bool ReserveMem(size_t bytes) {
+    if (mem_usage_.TryReserve(bytes, mem_pool_.GetCachedBytes())) {
+      return true;
+    }
+    mem_pool_.Trim(0);
+    if (mem_usage_.TryReserve(bytes, mem_pool_.GetCachedBytes())) {
+      return true;
+    }
+    dmp_dv_mem_evict_callback callback;
+    void *user_data;
+    {
+      std::lock_guard<std::mutex> lock(evict_mutex_);
+      callback = evict_callback_;
+      user_data = evict_user_data_;
+    }
+    if (callback) {
+      (*callback)((dmp_dv_context)this, bytes, user_data);
+      mem_pool_.Trim(0);  // memory released by the callback is returned to the pool
+      if (mem_usage_.TryReserve(bytes, mem_pool_.GetCachedBytes())) {
+        return true;
+      }
+    }
+    mem_usage_.CountBudgetFailure();
+    struct dmp_dv_mem_usage usage;
+    mem_usage_.GetUsage(&usage);
+    SET_ERR_CODE(ENOMEM, "Memory budget of %llu bytes would be exceeded: %llu bytes are in use while %zu more were requested",
+                         (unsigned long long)usage.budget_bytes, (unsigned long long)usage.live_bytes, bytes);
+    return false;
   }
 
   /// @brief Returns device information string.
   inline const char *GetInfoString() const {
-    return info_.c_str();
+    return dev_->GetInfoString();
   }
 
   /// @brief Returns maximum supported kernel size.
   inline int get_max_kernel_size() const {
-    return max_kernel_size_;
+    return dev_->get_max_kernel_size();
   }
 
   /// @brief Returns maximum supported fully connected block input size.
   inline int get_max_fc_vector_size() const {
-    return max_fc_vector_size_;
+    return dev_->get_max_fc_vector_size();
   }
 
   /// @brief Returns unified buffer size in bytes.
   inline int get_ub_size() const {
-    return ub_size_;
+    return dev_->get_ub_size();
   }
 
   /// @brief Returns frequency of CONV
   inline int get_conv_freq() const {
-    return conv_freq_;
+    return dev_->get_conv_freq();
   }
 
   /// @brief Returns frequency of FC
   inline int get_fc_freq() const {
-    return fc_freq_;
+    return dev_->get_fc_freq();
   }
 
   /// @brief Returns hardware SVN version of CONV.
   inline int get_svn_version() const {
-    return svn_version_;
+    return dev_->get_svn_version();
   }
 
   /// @brief Returns true if the hardware is ZIA-C2.
   inline bool is_zia_c2() const {
-    return zia_c2_;
+    return dev_->is_zia_c2();
   }
 
+  /// @brief Returns true if the hardware supports all features from the combination of DMP_DV_FEATURE_* bits.
+  inline bool has_features(uint32_t features) const {
+    return dev_->has_features(features);
+  }
+
+  /// @brief Returns path to the device or sysfs files, one of DMP_DV_PATH_*.
+  inline const char *get_path(int path_id) const {
+    return dev_->get_path(path_id);
+  }
+
+  /// @brief Returns the thread waiting on the scheduled executions of the context, creates it on the first call.
+  /// @return Reaper owned by the context or NULL on error.
+  CDMPDVReaper *GetReaper();
+
+  /// @brief Returns eventfd signaled on completion of every execution of the context's command lists.
+  /// @return File descriptor owned by the context or -1 on error.
+  /// @details After the first call all executions are tracked by the reaper.
+  int GetCompletionFd();
+
+  /// @brief Passes the scheduled execution to the reaper when the completion descriptor is in use.
+  void TrackExec(CDMPDVCmdList *cmdlist, int64_t exec_id);
+
+  /// @brief Fills structure with information about the context.
   int GetInfo(struct dmp_dv_info *p_info) {
-    if (p_info->size < 8) {
-      SET_ERR("Invalid argument: info->size is too small: %u", p_info->size);
-      return -1;
-    }
-    p_info->version = 0;
-    if (p_info->size >= sizeof(struct dmp_dv_info_v0)) {
-      struct dmp_dv_info_v0 *info = (struct dmp_dv_info_v0*)p_info;
-      info->ub_size = ub_size_;
-      info->max_kernel_size = max_kernel_size_;
-      info->conv_freq = conv_freq_;
-      info->fc_freq = fc_freq_;
-      info->max_fc_vector_size = max_fc_vector_size_;
-    }
-    return 0;
+    return dev_->GetInfo(p_info);
   }
 
   /// @brief If specified device exists.
@@ -223,7 +208,7 @@ class CDMPDVContext : public CDMPDVBase {
         {
           struct stat s;
           memset(&s, 0, sizeof(s));
-          if (stat(DMP_DV_DEV_PATH_IPU, &s) != 0) {
+          if (stat(get_path(DMP_DV_PATH_IPU), &s) != 0) {
             return 0;
           }
           return S_ISCHR(s.st_mode) ? 1 : 0;
@@ -236,36 +221,33 @@ class CDMPDVContext : public CDMPDVBase {
   }
 
  private:
-  /// @brief Size of the Unified Buffer.
-  int ub_size_;
-
-  /// @brief Size of the maximum kernel.
-  int max_kernel_size_;
+  /// @brief Stops and releases the reaper.
+  void ReleaseReaper();
 
-  /// @brief Convolutional block frequency in MHz.
-  int conv_freq_;
+  /// @brief Device capabilities and ION file descriptor shared by all contexts.
+  CDMPDVDeviceInfo *dev_;
 
-  /// @brief Fully Connected block frequency in MHz.
-  int fc_freq_;
+  /// @brief Thread waiting on the scheduled executions, NULL until GetReaper() is called.
+  CDMPDVReaper *reaper_;
 
-  /// @brief Fully Connected block maximum input vector size in elements.
-  int max_fc_vector_size_;
+  /// @brief Non-zero when all executions are tracked by the reaper.
+  int track_execs_;
 
-  /// @brief Number of MACs.
-  int mac_num_;
+  /// @brief Mutex for protecting reaper_.
+  std::mutex reaper_mutex_;
 
-  /// @brief Hardware SVN version.
-  int svn_version_;
+  /// @brief Pool of device-accessible memory allocations (disabled by default).
+  CDMPDVMemPool mem_pool_;
 
-  /// @brief If the hardware is ZIA-C2.
-  bool zia_c2_;
+  /// @brief Accounting of memory allocated within this context.
+  CDMPDVMemUsage mem_usage_;
 
-  /// @brief Device information.
-  std::string info_;
+  /// @brief Callback invoked when the memory budget would be exceeded.
+  dmp_dv_mem_evict_callback evict_callback_;
 
-  /// @brief File handle for ION memory allocator.
-  int fd_ion_;
+  /// @brief User data for evict_callback_.
+  void *evict_user_data_;
 
-  /// @brief ION heap selector.
-  uint32_t dma_heap_id_mask_;
+  /// @brief Mutex for protecting evict_callback_ and evict_user_data_.
+  std::mutex evict_mutex_;
 };
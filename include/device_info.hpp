@@ -0,0 +1,397 @@
+/*
+ *  Copyright 2018 Digital Media Professionals Inc.
+
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+
+ *      http://www.apache.org/licenses/LICENSE-2.0
+
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+/// @file
+/// @brief Process-wide snapshot of the DV device capabilities.
+#pragma once
+
+#include "base.hpp"
+
+#include <string>
+#include <mutex>
+#include <algorithm>
+
+
+/// @brief Snapshot of the DV device capabilities together with the ION file descriptor.
+/// @details The snapshot is immutable after Initialize(), so it is shared by all contexts of the process
+///          without locking, contexts retain the snapshot which was current at their creation.
+class CDMPDVDeviceInfo : public CDMPDVBase {
+ public:
+  /// @brief Constructor.
+  CDMPDVDeviceInfo() : CDMPDVBase() {
+    fd_ion_ = -1;
+    dma_heap_id_mask_ = 0;
+    ub_size_ = 0;
+    max_kernel_size_ = 3;
+    conv_freq_ = 0;
+    fc_freq_ = 0;
+    max_fc_vector_size_ = 16384;
+    mac_num_ = 0;
+    svn_version_ = 0;
+    zia_c2_ = false;
+    features_ = 0;
+  }
+
+  /// @brief Destructor.
+  virtual ~CDMPDVDeviceInfo() {
+    Cleanup();
+  }
+
+  /// @brief Returns the current process-wide snapshot creating it on first use.
+  /// @return Retained snapshot (caller must call Release()) or NULL on error.
+  static CDMPDVDeviceInfo *Acquire() {
+    std::lock_guard<std::mutex> lock(current_mutex_);
+    if (!current_) {
+      current_ = Create();
+      if (!current_) {
+        return NULL;
+      }
+    }
+    current_->Retain();
+    return current_;
+  }
+
+  /// @brief Probes the device again and makes the new snapshot current.
+  /// @return 0 on success, non-zero otherwise (the current snapshot is kept).
+  static int Refresh() {
+    CDMPDVDeviceInfo *info = Create();
+    if (!info) {
+      return -1;
+    }
+    CDMPDVDeviceInfo *prev;
+    {
+      std::lock_guard<std::mutex> lock(current_mutex_);
+      prev = current_;
+      current_ = info;
+    }
+    if (prev) {
+      prev->Release();
+    }
+    return 0;
+  }
+
+  /// @brief Overrides path for the snapshots created after this call.
+  /// @param path_id One of DMP_DV_PATH_*.
+  /// @param path New path or NULL to restore the default.
+  /// @return 0 on success, non-zero otherwise.
+  static int SetPath(int path_id, const char *path) {
+    if ((path_id < 0) || (path_id >= DMP_DV_PATH_COUNT)) {
+      SET_ERR("Invalid argument: path_id %d is out of bounds [0, %d)", path_id, DMP_DV_PATH_COUNT);
+      return EINVAL;
+    }
+    if ((path) && (!path[0])) {
+      SET_ERR("Invalid argument: path is empty");
+      return EINVAL;
+    }
+    std::lock_guard<std::mutex> lock(paths_mutex_);
+    path_overrides_[path_id] = path ? path : "";
+    return 0;
+  }
+
+  /// @brief Returns path to the device or sysfs files, one of DMP_DV_PATH_*.
+  inline const char *get_path(int path_id) const {
+    if ((path_id < 0) || (path_id >= DMP_DV_PATH_COUNT)) {
+      SET_ERR("Invalid argument: path_id %d is out of bounds [0, %d)", path_id, DMP_DV_PATH_COUNT);
+      return "";
+    }
+    return paths_[path_id].c_str();
+  }
+
+  /// @brief Returns information about the device as human-readable string.
+  inline const char *GetInfoString() const {
+    return info_.c_str();
+  }
+
+  /// @brief Returns handle to ION file descriptor.
+  inline int get_fd_ion() const {
+    return fd_ion_;
+  }
+
+  /// @brief Returns ION DMA heap id mask.
+  inline uint32_t get_dma_heap_id_mask() const {
+    return dma_heap_id_mask_;
+  }
+
+  /// @brief Returns maximum supported kernel size.
+  inline int get_max_kernel_size() const {
+    return max_kernel_size_;
+  }
+
+  /// @brief Returns maximum supported fully connected block input size.
+  inline int get_max_fc_vector_size() const {
+    return max_fc_vector_size_;
+  }
+
+  /// @brief Returns unified buffer size in bytes.
+  inline int get_ub_size() const {
+    return ub_size_;
+  }
+
+  /// @brief Returns frequency of CONV
+  inline int get_conv_freq() const {
+    return conv_freq_;
+  }
+
+  /// @brief Returns frequency of FC
+  inline int get_fc_freq() const {
+    return fc_freq_;
+  }
+
+  /// @brief Returns hardware SVN version of CONV.
+  inline int get_svn_version() const {
+    return svn_version_;
+  }
+
+  /// @brief Returns true if the hardware is ZIA-C2.
+  inline bool is_zia_c2() const {
+    return zia_c2_;
+  }
+
+  /// @brief Returns true if the hardware supports all features from the combination of DMP_DV_FEATURE_* bits.
+  inline bool has_features(uint32_t features) const {
+    return (features_ & features) == features;
+  }
+
+  /// @brief Fills structure with information about the device.
+  int GetInfo(struct dmp_dv_info *p_info) const {
+    if (p_info->size < 8) {
+      SET_ERR("Invalid argument: info->size is too small: %u", p_info->size);
+      return -1;
+    }
+    p_info->version = std::min(p_info->version, (uint32_t)1);
+    if ((p_info->version >= 1) && (p_info->size < sizeof(struct dmp_dv_info_v1))) {
+      p_info->version = 0;  // report only the version which fits the provided structure
+    }
+    if (p_info->size >= sizeof(struct dmp_dv_info_v0)) {
+      struct dmp_dv_info_v0 *info = (struct dmp_dv_info_v0*)p_info;
+      info->ub_size = ub_size_;
+      info->max_kernel_size = max_kernel_size_;
+      info->conv_freq = conv_freq_;
+      info->fc_freq = fc_freq_;
+      info->max_fc_vector_size = max_fc_vector_size_;
+    }
+    if (p_info->version >= 1) {
+      struct dmp_dv_info_v1 *info = (struct dmp_dv_info_v1*)p_info;
+      info->mac_num = mac_num_;
+      info->svn_version = svn_version_;
+      info->zia_c2 = zia_c2_ ? 1 : 0;
+      info->features = features_;
+      info->peak_macs = (uint64_t)mac_num_ * (uint64_t)conv_freq_ * 1000000ull;
+    }
+    return 0;
+  }
+
+ private:
+  /// @brief Creates and initializes new snapshot.
+  /// @return Snapshot with reference counter 1 or NULL on error.
+  static CDMPDVDeviceInfo *Create() {
+    CDMPDVDeviceInfo *info = new CDMPDVDeviceInfo();
+    if (!info) {
+      SET_ERR_CODE(ENOMEM, "Failed to allocate %zu bytes of memory", sizeof(CDMPDVDeviceInfo));
+      return NULL;
+    }
+    if (!info->Initialize()) {
+      info->Release();
+      return NULL;
+    }
+    return info;
+  }
+
+  /// @brief Releases held resources.
+  void Cleanup() {
+    if (fd_ion_ != -1) {
+      close(fd_ion_);
+      fd_ion_ = -1;
+    }
+    dma_heap_id_mask_ = 0;
+  }
+
+  /// @brief Opens ION and reads the device capabilities.
+  bool Initialize() {
+    Cleanup();
+    ResolvePaths();
+
+    const char *ion_path = paths_[DMP_DV_PATH_ION].c_str();
+    fd_ion_ = open(ion_path, O_RDONLY | O_CLOEXEC);  // O_CLOEXEC is suggested for security
+    if (fd_ion_ == -1) {
+      SET_ERR_CODE(errno, "open() failed for %s: %s", ion_path, strerror(errno));
+      return false;
+    }
+
+    // Get ION heap counts
+    struct ion_heap_query query;
+    memset(&query, 0, sizeof(query));
+    int res = ioctl(fd_ion_, ION_IOC_HEAP_QUERY, &query);
+    if (res < 0) {
+      SET_IOCTL_ERR(res, ion_path, "ION_IOC_HEAP_QUERY");
+      return false;
+    }
+    const int n = query.cnt;
+    if ((n < 1) || (n > 32)) {
+      SET_ERR_CODE(ENODEV, "Got unexpected number of ION heaps: %d", n);
+      return false;
+    }
+
+    // Get ION heap informations
+    dma_heap_id_mask_ = 0;
+    struct ion_heap_data heaps[32];
+    query.heaps = (size_t)&heaps[0];
+    res = ioctl(fd_ion_, ION_IOC_HEAP_QUERY, &query);
+    if (res < 0) {
+      SET_IOCTL_ERR(res, ion_path, "ION_IOC_HEAP_QUERY");
+      return false;
+    }
+    for (int i = 0; i < n; ++i) {
+      switch (heaps[i].type) {
+        case ION_HEAP_TYPE_SYSTEM:
+        case ION_HEAP_TYPE_SYSTEM_CONTIG:
+        case ION_HEAP_TYPE_CARVEOUT:
+        case ION_HEAP_TYPE_CHUNK:
+        case ION_HEAP_TYPE_CUSTOM:
+          break;
+        case ION_HEAP_TYPE_DMA:
+          dma_heap_id_mask_ |= (1 << heaps[i].heap_id);
+          break;
+        default:
+          break;
+      }
+    }
+    if (!dma_heap_id_mask_) {
+      SET_ERR_CODE(ENODEV, "ION heaps doesn\'t contain ION_HEAP_TYPE_DMA");
+      return false;
+    }
+
+    ub_size_ = sysfs_read_int("conv/ub_size", 0);
+    max_kernel_size_ = sysfs_read_int("conv/max_kernel_size", 3);
+    conv_freq_ = sysfs_read_int("conv/conv_freq", 0);
+    fc_freq_ = sysfs_read_int("fc/fc_freq", 0);
+    max_fc_vector_size_ = sysfs_read_int("fc/max_fc_vector_size", 16384);
+    mac_num_ = sysfs_read_int("conv/mac_num", 0);
+    svn_version_ = sysfs_read_int("conv/svn_version", 0);
+
+    zia_c2_ = (sizeof(size_t) == 4) && (ub_size_ == 524288) && (mac_num_ == 576);  // TODO: add proper detection.
+
+    features_ = 0;
+    if (svn_version_ >= 93) {
+      features_ |= DMP_DV_FEATURE_DECONV | DMP_DV_FEATURE_NON_SQUARE_POOL;
+    }
+    if (svn_version_ >= (zia_c2_ ? 83 : 93)) {
+      features_ |= DMP_DV_FEATURE_DILATION;
+    }
+
+    char s[256];
+    snprintf(s, sizeof(s), "DMP DV: ub_size=%d max_kernel_size=%d conv_freq=%d fc_freq=%d max_fc_vector_size=%d",
+             ub_size_, max_kernel_size_, conv_freq_, fc_freq_, max_fc_vector_size_);
+    info_ = s;
+
+    return true;
+  }
+
+  /// @brief Fills paths_ from the overrides, environment and defaults in that order.
+  void ResolvePaths() {
+    static const char *const dev_names[DMP_DV_PATH_COUNT] = {
+      DMP_DV_DEV_NAME_ION, DMP_DV_DEV_NAME_CONV, DMP_DV_DEV_NAME_FC,
+      DMP_DV_DEV_NAME_IPU, DMP_DV_DEV_NAME_MAXIMIZER, NULL
+    };
+    const char *dev_root = getenv("DMP_DV_DEV_ROOT");
+    if ((!dev_root) || (!dev_root[0])) {
+      dev_root = DMP_DV_DEV_ROOT;
+    }
+    const char *sysfs_root = getenv("DMP_DV_SYSFS_ROOT");
+    if ((!sysfs_root) || (!sysfs_root[0])) {
+      sysfs_root = DMP_DV_SYSFS_ROOT;
+    }
+
+    std::lock_guard<std::mutex> lock(paths_mutex_);
+    for (int i = 0; i < DMP_DV_PATH_COUNT; ++i) {
+      if (!path_overrides_[i].empty()) {
+        paths_[i] = path_overrides_[i];
+      }
+      else if (dev_names[i]) {
+        paths_[i] = std::string(dev_root) + "/" + dev_names[i];
+      }
+      else {
+        paths_[i] = sysfs_root;
+      }
+    }
+  }
+
+  /// @brief Reads single int value from sysfs file.
+  int sysfs_read_int(const char *key, int def) const {
+    char path[256];
+    snprintf(path, sizeof(path), "%s/dv_%s", paths_[DMP_DV_PATH_SYSFS].c_str(), key);
+    FILE *fin = fopen(path, "r");
+    if (!fin) {
+      return def;
+    }
+    int res = def;
+    if (fscanf(fin, "%d", &res) != 1) {
+      res = def;
+    }
+    fclose(fin);
+    return res;
+  }
+
+  /// @brief File handle for ION memory allocator.
+  int fd_ion_;
+
+  /// @brief ION heap selector.
+  uint32_t dma_heap_id_mask_;
+
+  /// @brief Size of the Unified Buffer.
+  int ub_size_;
+
+  /// @brief Maximum supported convolutional kernel size.
+  int max_kernel_size_;
+
+  /// @brief Convolutional block frequency in MHz.
+  int conv_freq_;
+
+  /// @brief Fully Connected block frequency in MHz.
+  int fc_freq_;
+
+  /// @brief Fully Connected block maximum input vector size in elements.
+  int max_fc_vector_size_;
+
+  /// @brief Number of MACs.
+  int mac_num_;
+
+  /// @brief Hardware SVN version.
+  int svn_version_;
+
+  /// @brief If the hardware is ZIA-C2.
+  bool zia_c2_;
+
+  /// @brief Supported features as a combination of DMP_DV_FEATURE_* bits.
+  uint32_t features_;
+
+  /// @brief Device information.
+  std::string info_;
+
+  /// @brief Resolved paths to the device and sysfs files indexed by DMP_DV_PATH_*.
+  std::string paths_[DMP_DV_PATH_COUNT];
+
+  /// @brief Current process-wide snapshot, NULL until first use.
+  static CDMPDVDeviceInfo *current_;
+
+  /// @brief Mutex for protecting current_.
+  static std::mutex current_mutex_;
+
+  /// @brief Paths set by SetPath() indexed by DMP_DV_PATH_*, empty means default.
+  static std::string path_overrides_[DMP_DV_PATH_COUNT];
+
+  /// @brief Mutex for protecting path_overrides_.
+  static std::mutex paths_mutex_;
+};
@@ -45,6 +45,9 @@ typedef struct dmp_dv_mem_impl *dmp_dv_mem;
 ///          thus reducing argument packing overhead.
 typedef struct dmp_dv_cmdlist_impl *dmp_dv_cmdlist;
 
+/// @brief Ring of equally sized device-accessible buffers for streaming input.
+typedef struct dmp_dv_ring_impl *dmp_dv_ring;
+
 
 /// @brief Returns version string of the driver interface.
 /// @details Starts with HW_MAJOR.HW_MINOR.YYYYMMDD for example "7.0.20181214".
@@ -55,23 +58,84 @@ typedef struct dmp_dv_cmdlist_impl *dmp_dv_cmdlist;
 const char *dmp_dv_get_version_string();
 
 
-/// @brief Returns last error message.
-/// @details It might return garbage if several functions will fail from multiple threads
-///          simultaneously during this function call.
+/// @brief Returns last error message of the calling thread.
+/// @details The returned string is valid until the next failing call from the same thread.
+///          It is thread-safe.
 const char *dmp_dv_get_last_error_message();
 
 
-/// @brief Sets last error message.
-/// @details It might set garbage when calling simultaneously from multiple threads.
+/// @brief Returns last error of the calling thread.
+/// @param code When not NULL, set to errno-style code of the last error (e.g. EINVAL for invalid arguments
+///             or unsupported configuration, ENOMEM for failed allocations, errno of the failed system call),
+///             0 if no error was set in the calling thread.
+/// @param msg When not NULL, set to the last error message which is valid until the next failing call from the same thread.
+/// @return Code of the last error.
+/// @details The message is formatted only when requested.
+///          It is thread-safe.
+int dmp_dv_get_last_error(int *code, const char **msg);
+
+
+/// @brief Sets last error message of the calling thread, the error code is set to EINVAL.
+/// @details It is thread-safe.
 void dmp_dv_set_last_error_message(const char *format, ...);
 
 
 /// @brief Creates context for working with DV accelerator.
 /// @return Non-NULL on success, NULL on error.
-/// @details It is thread-safe.
+/// @details Device capabilities and /dev/ion file descriptor are probed once per process on the first call
+///          and are shared by all contexts, so creating more contexts is cheap.
+///          It is thread-safe.
 dmp_dv_context dmp_dv_context_create();
 
 
+/// @brief Probes the device capabilities again for the contexts created after this call.
+/// @return 0 on success, non-zero otherwise (the previous capabilities are kept).
+/// @details Existing contexts keep the capabilities they were created with.
+///          It is thread-safe.
+int dmp_dv_context_refresh_device_info();
+
+
+/// @brief Path to ION allocator character device file (default /dev/ion).
+#define DMP_DV_PATH_ION 0
+
+/// @brief Path to convolutional character device file (default /dev/dv_conv).
+#define DMP_DV_PATH_CONV 1
+
+/// @brief Path to fully connected character device file (default /dev/dv_fc).
+#define DMP_DV_PATH_FC 2
+
+/// @brief Path to image processing unit character device file (default /dev/dv_ipu).
+#define DMP_DV_PATH_IPU 3
+
+/// @brief Path to maximizer character device file (default /dev/dv_maximizer).
+#define DMP_DV_PATH_MAXIMIZER 4
+
+/// @brief Path to sysfs directory with device capabilities (default /sys/class/dmp_dv).
+#define DMP_DV_PATH_SYSFS 5
+
+/// @brief Upper bound of different path ids.
+#define DMP_DV_PATH_COUNT 6
+
+
+/// @brief Overrides path to the device or sysfs files for the contexts created after the next device probe.
+/// @param path_id Path id, one of DMP_DV_PATH_*.
+/// @param path New path or NULL to restore the default.
+/// @return 0 on success, non-zero otherwise.
+/// @details Defaults are taken from the environment: DMP_DV_DEV_ROOT replaces /dev
+///          for the device files and DMP_DV_SYSFS_ROOT replaces /sys/class/dmp_dv.
+///          Together with a fake sysfs tree and user-space stand-in devices this allows running off-target.
+///          The new paths are used on the first dmp_dv_context_create() or after dmp_dv_context_refresh_device_info().
+///          It is thread-safe.
+int dmp_dv_set_path(int path_id, const char *path);
+
+
+/// @brief Returns path to the device or sysfs files used by the context.
+/// @param path_id Path id, one of DMP_DV_PATH_*.
+/// @return Path or empty string on error.
+/// @details It is thread-safe.
+const char *dmp_dv_context_get_path(dmp_dv_context ctx, int path_id);
+
+
 /// @brief Returns information about context as human-readable string.
 /// @details It is thread-safe.
 const char *dmp_dv_context_get_info_string(dmp_dv_context ctx);
@@ -96,6 +160,30 @@ struct dmp_dv_info_v0 {
 };
 
 
+/// @brief Feature bits for dmp_dv_info_v1::features.
+#define DMP_DV_FEATURE_DECONV 1           // deconvolution
+#define DMP_DV_FEATURE_NON_SQUARE_POOL 2  // pooling with different kernel width and height
+#define DMP_DV_FEATURE_DILATION 4         // dilated convolution on input smaller than the padding
+
+
+/// @brief Structure with information about the context (version 1).
+/// @details First fields are the same as in dmp_dv_info_v0.
+struct dmp_dv_info_v1 {
+  struct dmp_dv_info header;   // general structure information
+  int32_t ub_size;             // unified buffer size
+  int32_t max_kernel_size;     // maximum supported convolutional kernel size
+  int32_t conv_freq;           // convolutional block frequency in MHz
+  int32_t fc_freq;             // fully connected block frequency in MHz
+  int32_t max_fc_vector_size;  // fully connected block maximum input vector size in elements
+  int32_t rsvd;                // padding to 64-bits
+  int32_t mac_num;             // number of multiply-accumulate units in the convolutional block
+  int32_t svn_version;         // hardware revision of the convolutional block
+  int32_t zia_c2;              // non-zero if the hardware is ZIA-C2
+  uint32_t features;           // combination of DMP_DV_FEATURE_* bits
+  uint64_t peak_macs;          // peak throughput of the convolutional block in multiply-accumulates per second
+};
+
+
 /// @brief Fills structure with information about the context.
 /// @param ctx Context for working with DV accelerator, when NULL it is ignored.
 /// @param info Structure to be filled, fields size and version must be set.
@@ -130,6 +218,57 @@ int dmp_dv_context_retain(dmp_dv_context ctx);
 dmp_dv_mem dmp_dv_mem_alloc(dmp_dv_context ctx, size_t size);
 
 
+/// @brief Caching modes for dmp_dv_mem_alloc_ex().
+/// @details DMP_DV_MEM_CACHED - memory is cached by CPU (the same as dmp_dv_mem_alloc()),
+///          DMP_DV_MEM_UNCACHED - memory is not cached by CPU, suitable for buffers CPU writes once and never reads,
+///          DMP_DV_MEM_WRITE_COMBINED - memory is not cached by CPU but writes are combined,
+///                                      suitable for buffers CPU fills sequentially.
+///          ION maps memory which is not cached as write-combined,
+///          so currently DMP_DV_MEM_UNCACHED and DMP_DV_MEM_WRITE_COMBINED behave the same.
+///          For memory which is not cached, dmp_dv_mem_to_device() only issues the barrier
+///          and dmp_dv_mem_to_cpu() does nothing, CPU reads from such memory are slow.
+#define DMP_DV_MEM_CACHED 0
+#define DMP_DV_MEM_UNCACHED 1
+#define DMP_DV_MEM_WRITE_COMBINED 2
+
+
+/// @brief Allocates physically continuous chunk of memory with the specified caching mode.
+/// @param ctx Context for working with DV accelerator, when NULL the error is returned.
+/// @param size Memory size in bytes.
+/// @param flags One of DMP_DV_MEM_CACHED, DMP_DV_MEM_UNCACHED, DMP_DV_MEM_WRITE_COMBINED.
+/// @return Handle for the allocated memory or NULL on error.
+/// @details It is thread-safe.
+dmp_dv_mem dmp_dv_mem_alloc_ex(dmp_dv_context ctx, size_t size, int flags);
+
+
+/// @brief Wraps dma-buf file descriptor allocated outside of this library (e.g. by V4L2 or DRM) as memory handle.
+/// @param ctx Context for working with DV accelerator, when NULL the error is returned.
+/// @param fd dma-buf file descriptor, it is duplicated, so the caller can close it right after the call.
+/// @param size Usable size of the buffer in bytes, 0 to use the whole buffer.
+/// @return Handle for the memory or NULL on error.
+/// @details The handle can be used everywhere the allocated memory handle is expected,
+///          the buffer must be accessible by the accelerator (e.g. physically continuous when there is no IOMMU).
+///          Imported memory is not accounted in dmp_dv_mem_get_total_size() and is never returned to the memory pool.
+///          It is thread-safe.
+dmp_dv_mem dmp_dv_mem_import_fd(dmp_dv_context ctx, int fd, size_t size);
+
+
+/// @brief Creates handle to the region of previously allocated memory.
+/// @param parent Handle to the allocated memory, when NULL the error is returned.
+/// @param offs Offset of the region within the parent memory in bytes, must be 16-bytes aligned.
+/// @param size Size of the region in bytes, must be non-zero.
+/// @return Handle for the memory region or NULL on error.
+/// @details The region shares file descriptor and mapping with the parent and retains the parent,
+///          so a single allocation can back many tensors.
+///          The handle can be used everywhere the allocated memory handle is expected,
+///          offsets within the region are translated to the offsets within the parent automatically.
+///          dmp_dv_mem_map() on the region maps the parent and returns pointer to the start of the region,
+///          dmp_dv_mem_unmap() on the region does nothing, synchronization functions act on the parent.
+///          When parent is a region itself, the new region is created within its parent.
+///          It is thread-safe.
+dmp_dv_mem dmp_dv_mem_suballoc(dmp_dv_mem parent, size_t offs, size_t size);
+
+
 /// @brief Releases allocated memory (decreses reference counter).
 /// @param mem Handle for the allocated memory, when NULL it is ignored.
 /// @return Reference counter value after the function call, 0 if graph is NULL.
@@ -163,6 +302,36 @@ uint8_t *dmp_dv_mem_map(dmp_dv_mem mem);
 void dmp_dv_mem_unmap(dmp_dv_mem mem);
 
 
+/// @brief Flags for dmp_dv_mem_map_ex().
+/// @details DMP_DV_MEM_MAP_POPULATE prefaults page tables of the mapping, so the first access doesn't stall.
+///          DMP_DV_MEM_MAP_READ_ONLY maps memory without write permission.
+#define DMP_DV_MEM_MAP_POPULATE 1
+#define DMP_DV_MEM_MAP_READ_ONLY 2
+
+
+/// @brief Maps window of previously allocated memory to the user address space.
+/// @param mem Handle to the allocated memory, when NULL the error is returned.
+/// @param offs Offset of the window within the memory in bytes.
+/// @param size Size of the window in bytes, 0 maps till the end of the memory.
+/// @param flags Combination of DMP_DV_MEM_MAP_* flags.
+/// @return Pointer to the start of the window in user address space or NULL on error.
+/// @details Window is independent of dmp_dv_mem_map(), so only the required part of the big buffer is mapped.
+///          Mapping the same window with the same flags again returns the same pointer and increases its reference counter.
+///          Synchronization functions can be used on the ranges fully covered by the mapped windows.
+///          All windows are unmapped automatically when the memory is released.
+///          It is thread-safe.
+uint8_t *dmp_dv_mem_map_ex(dmp_dv_mem mem, size_t offs, size_t size, int flags);
+
+
+/// @brief Unmaps window previously mapped with dmp_dv_mem_map_ex().
+/// @param mem Handle to the allocated memory, when NULL the error is returned.
+/// @param ptr Pointer returned by dmp_dv_mem_map_ex(), pointer returned by dmp_dv_mem_map() is also accepted.
+/// @return 0 on success, non-zero otherwise.
+/// @details Window is unmapped when the number of unmaps matches the number of maps.
+///          It is thread-safe.
+int dmp_dv_mem_unmap_ex(dmp_dv_mem mem, uint8_t *ptr);
+
+
 /// @brief Starts Device <-> CPU synchronization of the memory buffer.
 /// @param mem Handle to the allocated memory, when NULL the error is returned.
 /// @param rd If non-zero, the Device -> CPU synchronization will occur before this function returns.
@@ -193,6 +362,146 @@ size_t dmp_dv_mem_get_size(dmp_dv_mem mem);
 int64_t dmp_dv_mem_get_total_size();
 
 
+/// @brief Statistics of the context memory pool.
+struct dmp_dv_mem_pool_stats {
+  uint64_t hits;              // number of allocations served from the pool
+  uint64_t misses;            // number of allocations of poolable size not found in the pool
+  uint64_t n_cached;          // number of allocations currently held in the pool
+  uint64_t cached_bytes;      // total size of allocations currently held in the pool in bytes
+  uint64_t max_cached_bytes;  // pool capacity in bytes, 0 when the pool is disabled
+};
+
+
+/// @brief Enables or disables pooling of memory allocations for the context.
+/// @param ctx Context for working with DV accelerator, when NULL the error is returned.
+/// @param max_cached_bytes Maximum total size of allocations kept in the pool, 0 disables the pool.
+/// @return 0 on success, non-zero otherwise.
+/// @details When the pool is enabled, dmp_dv_mem_alloc() rounds the requested size up to the size class
+///          (the overhead is at most 25%) and tries to reuse previously released memory of the same size class,
+///          dmp_dv_mem_release() returns the memory to the pool instead of freeing it while the pool has free capacity.
+///          Allocations larger than 64Mb are not pooled.
+///          Reused memory is not cleared.
+///          It is thread-safe.
+int dmp_dv_mem_pool_enable(dmp_dv_context ctx, size_t max_cached_bytes);
+
+
+/// @brief Frees memory held in the context memory pool.
+/// @param ctx Context for working with DV accelerator, when NULL the error is returned.
+/// @param keep_bytes Maximum total size of allocations to keep in the pool.
+/// @return 0 on success, non-zero otherwise.
+/// @details Allocations of the largest size classes are freed first.
+///          It is thread-safe.
+int dmp_dv_mem_pool_trim(dmp_dv_context ctx, size_t keep_bytes);
+
+
+/// @brief Fills statistics of the context memory pool.
+/// @param ctx Context for working with DV accelerator, when NULL the error is returned.
+/// @param stats Structure to be filled.
+/// @return 0 on success, non-zero otherwise.
+/// @details It is thread-safe.
+int dmp_dv_mem_pool_get_stats(dmp_dv_context ctx, struct dmp_dv_mem_pool_stats *stats);
+
+
+/// @brief Operations of the memory layer for struct dmp_dv_mem_stats.
+#define DMP_DV_MEM_OP_ALLOC 0         // ioctl(ION_IOC_ALLOC)
+#define DMP_DV_MEM_OP_MMAP 1          // mmap()
+#define DMP_DV_MEM_OP_MUNMAP 2        // munmap()
+#define DMP_DV_MEM_OP_DMA_BUF_SYNC 3  // ioctl(DMA_BUF_IOCTL_SYNC)
+#define DMP_DV_MEM_OP_TO_DEVICE 4     // dmp_dv_mem_to_device()
+#define DMP_DV_MEM_OP_TO_CPU 5        // dmp_dv_mem_to_cpu()
+#define DMP_DV_MEM_OP_SYNC_BATCH 6    // dmp_dv_mem_sync_batch()
+#define DMP_DV_MEM_OP_COUNT 7
+
+/// @brief Number of bins in the latency histograms.
+#define DMP_DV_MEM_STATS_N_BINS 32
+
+
+/// @brief Per-process cumulative counters of the memory layer.
+struct dmp_dv_mem_stats {
+  uint64_t n_calls[DMP_DV_MEM_OP_COUNT];   // number of calls
+  uint64_t total_ns[DMP_DV_MEM_OP_COUNT];  // total time spent in nanoseconds
+  uint64_t latency_histogram[DMP_DV_MEM_OP_COUNT][DMP_DV_MEM_STATS_N_BINS];  // number of calls with latency
+                                                                             // in [2^i, 2^(i+1)) nanoseconds,
+                                                                             // the last bin also counts slower calls
+  uint64_t bytes_cleaned;      // bytes written from CPU cache to RAM by cache maintenance
+  uint64_t bytes_invalidated;  // bytes invalidated in CPU cache by cache maintenance
+};
+
+
+/// @brief Enables or disables collection of the memory layer counters (disabled by default).
+/// @param enable Non-zero to enable, 0 to disable.
+/// @details When disabled, the overhead is a single relaxed load per operation.
+///          It is thread-safe.
+void dmp_dv_mem_stats_enable(int enable);
+
+
+/// @brief Fills per-process cumulative counters of the memory layer.
+/// @param stats Structure to be filled, when NULL the error is returned.
+/// @return 0 on success, non-zero otherwise.
+/// @details It is thread-safe.
+int dmp_dv_mem_get_stats(struct dmp_dv_mem_stats *stats);
+
+
+/// @brief Resets per-process cumulative counters of the memory layer.
+/// @details It is thread-safe.
+void dmp_dv_mem_reset_stats();
+
+
+/// @brief Number of bins in the allocation size histogram.
+#define DMP_DV_MEM_USAGE_N_BINS 32
+
+
+/// @brief Accounting of device-accessible memory allocated within the context.
+struct dmp_dv_mem_usage {
+  uint64_t live_bytes;         // bytes currently held by memory handles (excluding the memory pool)
+  uint64_t peak_bytes;         // maximum value of live_bytes
+  uint64_t n_allocs;           // total number of allocations
+  uint64_t n_live;             // number of allocations currently held by memory handles
+  uint64_t n_budget_failures;  // number of allocations rejected because of the budget
+  uint64_t budget_bytes;       // memory budget in bytes, 0 when there is no budget
+  uint64_t histogram[DMP_DV_MEM_USAGE_N_BINS];  // number of allocations with size in [2^i, 2^(i+1)) bytes,
+                                                // the last bin also counts bigger allocations
+};
+
+
+/// @brief Fills accounting of device-accessible memory allocated within the context.
+/// @param ctx Context for working with DV accelerator, when NULL the error is returned.
+/// @param usage Structure to be filled.
+/// @return 0 on success, non-zero otherwise.
+/// @details Imported memory and memory regions are not accounted.
+///          It is thread-safe.
+int dmp_dv_context_get_mem_usage(dmp_dv_context ctx, struct dmp_dv_mem_usage *usage);
+
+
+/// @brief Resets the memory high-water mark of the context to the currently allocated size.
+/// @param ctx Context for working with DV accelerator, when NULL the error is returned.
+/// @return 0 on success, non-zero otherwise.
+/// @details It is thread-safe.
+int dmp_dv_context_reset_mem_peak(dmp_dv_context ctx);
+
+
+/// @brief Callback which is invoked when the allocation would exceed the memory budget of the context.
+/// @param ctx Context for which the allocation is done.
+/// @param bytes_needed Size of the allocation in bytes.
+/// @param user_data User data passed to dmp_dv_context_set_mem_budget().
+/// @details Callback is invoked in the allocating thread and can release memory handles of the context.
+typedef void (*dmp_dv_mem_evict_callback)(dmp_dv_context ctx, size_t bytes_needed, void *user_data);
+
+
+/// @brief Sets the limit of device-accessible memory allocated within the context.
+/// @param ctx Context for working with DV accelerator, when NULL the error is returned.
+/// @param budget_bytes Maximum number of bytes held by memory handles and the memory pool, 0 removes the limit.
+/// @param callback Callback invoked when the allocation would exceed the budget, can be NULL.
+/// @param user_data User data for the callback.
+/// @return 0 on success, non-zero otherwise.
+/// @details When the allocation would exceed the budget, the memory pool is trimmed first,
+///          then the callback is invoked once and the memory it has released is trimmed from the pool,
+///          if the budget would still be exceeded, the allocation fails immediately without calling ION.
+///          It is thread-safe.
+int dmp_dv_context_set_mem_budget(dmp_dv_context ctx, size_t budget_bytes,
+                                  dmp_dv_mem_evict_callback callback, void *user_data);
+
+
 /// @brief Flags for memory synchronization.
 #define DMP_DV_MEM_CPU_WONT_READ 1
 #define DMP_DV_MEM_AS_DEV_OUTPUT 2
@@ -218,6 +527,16 @@ int64_t dmp_dv_mem_get_total_size();
 int dmp_dv_mem_to_device(dmp_dv_mem mem, size_t offs, size_t size, int flags);
 
 
+/// @brief Marks memory region as written by CPU for command lists with managed coherency.
+/// @param mem Handle to allocated memory, when NULL the error is returned.
+/// @param offs Offset in the memory buffer in bytes.
+/// @param size Size of the region in bytes, if 0 the function does nothing.
+/// @return 0 on success, non-zero otherwise.
+/// @details Call this after writing to the memory which stays mapped between executions.
+///          It is thread-safe.
+int dmp_dv_mem_mark_dirty(dmp_dv_mem mem, size_t offs, size_t size);
+
+
 /// @brief Prepares memory region to be accessible by CPU.
 /// @param mem Handle to allocated memory, when NULL the error is returned.
 /// @param offs Offset in the memory buffer in bytes.
@@ -235,6 +554,122 @@ int dmp_dv_mem_to_device(dmp_dv_mem mem, size_t offs, size_t size, int flags);
 int dmp_dv_mem_to_cpu(dmp_dv_mem mem, size_t offs, size_t size, int flags);
 
 
+/// @brief Flags for dmp_dv_mem_load_file().
+#define DMP_DV_MEM_LOAD_DIRECT 1  // bypass the page cache with O_DIRECT when the offsets allow it
+
+
+/// @brief Reads file contents directly to the memory region and prepares it to be accessible by Device.
+/// @param mem Handle to allocated memory, when NULL the error is returned.
+/// @param offs Offset in the memory buffer in bytes.
+/// @param path Path to the file.
+/// @param file_offs Offset in the file in bytes.
+/// @param size Number of bytes to read, if 0 the function does nothing.
+/// @param flags 0 or DMP_DV_MEM_LOAD_DIRECT, O_DIRECT is used only when both the destination address
+///              and file_offs are aligned to 4096 bytes and is silently dropped otherwise
+///              or when the kernel can not read directly to the mapped memory.
+/// @return 0 on success, non-zero otherwise (e.g. when the file is shorter than file_offs + size).
+/// @details The memory need not be mapped, the required part is mapped temporarily.
+///          Data is read in large chunks and the CPU caches are written back chunk by chunk,
+///          so dmp_dv_mem_to_device() is not required afterwards
+///          and no intermediate copy of the file contents is kept in user or page cache memory.
+int dmp_dv_mem_load_file(dmp_dv_mem mem, size_t offs, const char *path, uint64_t file_offs, size_t size, int flags);
+
+
+/// @brief Copies data between memory regions and prepares the destination to be accessible by Device.
+/// @param dst Handle to the destination memory, when NULL the error is returned.
+/// @param dst_offs Offset in the destination memory buffer in bytes.
+/// @param src Handle to the source memory, when NULL the error is returned.
+/// @param src_offs Offset in the source memory buffer in bytes.
+/// @param size Number of bytes to copy, if 0 the function does nothing.
+/// @param flags 0 or DMP_DV_MEM_CPU_WONT_READ with the same meaning as for dmp_dv_mem_to_device() on the destination.
+/// @return 0 on success, non-zero otherwise (e.g. when the source and destination ranges overlap).
+/// @details Each destination cache line is written to RAM right after it is copied,
+///          so dmp_dv_mem_to_device() is not required afterwards.
+///          The source range must be visible to CPU (call dmp_dv_mem_to_cpu() first if it was written by Device).
+///          The memory need not be mapped, the required parts are mapped temporarily.
+int dmp_dv_mem_copy(dmp_dv_mem dst, size_t dst_offs, dmp_dv_mem src, size_t src_offs, size_t size, int flags);
+
+
+/// @brief Fills memory region with the byte value and prepares it to be accessible by Device.
+/// @param mem Handle to allocated memory, when NULL the error is returned.
+/// @param offs Offset in the memory buffer in bytes.
+/// @param value Byte value to fill with (only the lower 8 bits are used).
+/// @param size Number of bytes to fill, if 0 the function does nothing.
+/// @param flags 0 or DMP_DV_MEM_CPU_WONT_READ with the same meaning as for dmp_dv_mem_to_device().
+/// @return 0 on success, non-zero otherwise.
+/// @details Each cache line is written to RAM right after it is filled,
+///          so dmp_dv_mem_to_device() is not required afterwards.
+///          The memory need not be mapped, the required part is mapped temporarily.
+int dmp_dv_mem_fill(dmp_dv_mem mem, size_t offs, int value, size_t size, int flags);
+
+
+/// @brief Directions of synchronization for dmp_dv_mem_sync_batch().
+#define DMP_DV_MEM_TO_DEVICE 0
+#define DMP_DV_MEM_TO_CPU 1
+
+
+/// @brief Memory range for dmp_dv_mem_sync_batch().
+struct dmp_dv_mem_range {
+  dmp_dv_mem mem;     // handle to the allocated memory or region
+  uint64_t offs;      // offset in the memory buffer in bytes
+  uint64_t size;      // size of the range in bytes, if 0 the range is ignored
+  int32_t direction;  // DMP_DV_MEM_TO_DEVICE or DMP_DV_MEM_TO_CPU
+  int32_t flags;      // flags as for dmp_dv_mem_to_device() or dmp_dv_mem_to_cpu() depending on direction
+};
+
+
+/// @brief Prepares the batch of memory ranges to be accessible by Device or CPU.
+/// @param ranges Array of memory ranges, when NULL and n is non-zero the error is returned.
+/// @param n Number of memory ranges.
+/// @return 0 on success, non-zero otherwise.
+/// @details Behaves as a sequence of dmp_dv_mem_to_device() and dmp_dv_mem_to_cpu() calls,
+///          but overlapping or adjacent ranges of the same buffer are merged (also across region handles)
+///          and a single barrier is issued for the whole batch.
+///          All ranges are validated before any synchronization is done.
+///          It is thread-safe only on different memory handles.
+int dmp_dv_mem_sync_batch(const struct dmp_dv_mem_range *ranges, int n);
+
+
+/// @brief Parameters of the cost model used by dmp_dv_mem_to_device() and dmp_dv_mem_to_cpu()
+///        to choose how to maintain CPU caches for the given range.
+/// @details The cheapest of the following paths is used:
+///          per-line maintenance by the calling thread: n_lines * line_ns,
+///          per-line maintenance split across n threads: n_lines * line_ns / n + (n - 1) * thread_ns,
+///          kernel maintenance of the whole buffer: sync_fixed_ns + buffer_size * sync_byte_ns.
+struct dmp_dv_cache_params {
+  double line_ns;        // cost of maintenance of a single cache line by CPU in nanoseconds
+  double sync_fixed_ns;  // fixed cost of DMA_BUF_IOCTL_SYNC start/end pair in nanoseconds
+  double sync_byte_ns;   // cost of DMA_BUF_IOCTL_SYNC per byte of the whole buffer in nanoseconds
+  double thread_ns;      // cost of starting and joining a worker thread in nanoseconds
+  int32_t max_threads;   // maximum number of threads for a single range, 1 disables splitting
+  int32_t use_dma_buf_sync;  // non-zero allows maintenance of the whole buffer with DMA_BUF_IOCTL_SYNC
+};
+
+
+/// @brief Fills the current cache maintenance cost model parameters.
+/// @param params Structure to be filled, when NULL the error is returned.
+/// @return 0 on success, non-zero otherwise.
+/// @details It is thread-safe.
+int dmp_dv_cache_get_params(struct dmp_dv_cache_params *params);
+
+
+/// @brief Sets the cache maintenance cost model parameters for the process.
+/// @param params New parameters, when NULL the error is returned.
+/// @return 0 on success, non-zero otherwise.
+/// @details It is thread-safe.
+int dmp_dv_cache_set_params(const struct dmp_dv_cache_params *params);
+
+
+/// @brief Measures the cache maintenance cost model parameters and makes them current for the process.
+/// @param ctx Context for working with DV accelerator, when NULL the error is returned.
+/// @param params Structure to be filled with the measured parameters, can be NULL.
+/// @return 0 on success, non-zero otherwise.
+/// @details Allocates temporary buffers of several megabytes and takes several tens of milliseconds,
+///          so it should be called once at application startup.
+///          It is thread-safe.
+int dmp_dv_cache_calibrate(dmp_dv_context ctx, struct dmp_dv_cache_params *params);
+
+
 /// @brief Creates command list.
 /// @param ctx Context for working with DV accelerator, when NULL the error is returned.
 /// @return Handle to command list or NULL on error.
@@ -260,14 +695,35 @@ int dmp_dv_cmdlist_retain(dmp_dv_cmdlist cmdlist);
 /// @brief Commits the command list, preparing device-specific structures for further execution.
 /// @param cmdlist Handle to command list, when NULL the error is returned.
 /// @return 0 on success, non-zero otherwise.
-/// @details It is thread-safe only on different command lists.
+/// @details The command list may contain commands for different devices (e.g. IPU, CONV and MAXIMIZER),
+///          consecutive commands for the same device form a segment and segments are executed in order of addition.
+///          It is thread-safe only on different command lists.
 int dmp_dv_cmdlist_commit(dmp_dv_cmdlist cmdlist);
 
 
+/// @brief Enables or disables managed coherency for the command list.
+/// @param cmdlist Handle to command list, when NULL the error is returned.
+/// @param enable Non-zero to enable, 0 to disable (default).
+/// @return 0 on success, non-zero otherwise.
+/// @details When enabled, dmp_dv_cmdlist_exec() writes to RAM only the CPU-dirty parts of the buffers
+///          used by the commands, and successful dmp_dv_cmdlist_wait() invalidates CPU caches for the output buffers,
+///          so dmp_dv_mem_to_device() and dmp_dv_mem_to_cpu() calls are not required.
+///          For the output buffers which are not mapped the invalidation is deferred to the next mapping.
+///          The memory is marked dirty as a whole by the first dmp_dv_mem_map(),
+///          by dmp_dv_mem_map_ex() without DMP_DV_MEM_MAP_READ_ONLY for the mapped window,
+///          and by dmp_dv_mem_mark_dirty() for the given range,
+///          dmp_dv_mem_to_device() clears dirty state of the range.
+///          It is thread-safe only on different command lists.
+int dmp_dv_cmdlist_set_managed_coherency(dmp_dv_cmdlist cmdlist, int enable);
+
+
 /// @brief Schedules command list for execution.
 /// @param cmdlist Handle to command list, when NULL the error is returned.
 /// @return exec_id >= 0 for this execution on success, < 0 on error.
 /// @details Each context is associated with a single execution queue.
+///          For the command list with several segments the first segment is scheduled immediately
+///          (or after the previous execution of this command list completes) and
+///          the next segments are scheduled by the internal thread as soon as the previous segment completes.
 ///          It is thread-safe.
 int64_t dmp_dv_cmdlist_exec(dmp_dv_cmdlist cmdlist);
 
@@ -276,16 +732,246 @@ int64_t dmp_dv_cmdlist_exec(dmp_dv_cmdlist cmdlist);
 /// @param cmdlist Handle to command list, when NULL the error is returned.
 /// @param exec_id Id of the scheduled command to wait for completion.
 /// @return 0 on success, non-zero otherwise.
-/// @details It is thread-safe.
+/// @details For the command list with several segments returns when the last segment completes.
+///          It is thread-safe.
 int dmp_dv_cmdlist_wait(dmp_dv_cmdlist cmdlist, int64_t exec_id);
 
 
+/// @brief Schedules several command lists for execution.
+/// @param cmdlists Array of handles to command lists, when NULL the error is returned.
+/// @param n Number of command lists.
+/// @param exec_ids Array of n elements to be filled with execution ids, -1 for the command lists which were not scheduled.
+/// @return 0 on success, non-zero otherwise.
+/// @details Behaves as a sequence of dmp_dv_cmdlist_exec() calls in the array order,
+///          but CPU caches for all command lists with managed coherency are maintained in a single batch
+///          (buffers shared by several command lists are maintained once) before the first command list is scheduled.
+///          On error the command lists before the failed one remain scheduled.
+///          It is thread-safe.
+int dmp_dv_cmdlist_exec_many(dmp_dv_cmdlist *cmdlists, int n, int64_t *exec_ids);
+
+
+/// @brief Callback which is invoked on completion of the command scheduled with dmp_dv_cmdlist_exec_async().
+/// @param cmdlist Command list which was executed.
+/// @param exec_id Execution id returned by dmp_dv_cmdlist_exec_async().
+/// @param result 0 if the execution has succeeded, non-zero error code otherwise.
+/// @param user_data User data passed to dmp_dv_cmdlist_exec_async().
+/// @details Callback is invoked in the internal thread of the context, while it runs the next completions are not reported,
+///          so it should pass the output for processing to another thread or be short.
+///          It can schedule command lists, but must not wait for them.
+typedef void (*dmp_dv_exec_callback)(dmp_dv_cmdlist cmdlist, int64_t exec_id, int result, void *user_data);
+
+
+/// @brief Schedules command list for execution and invokes the callback on completion.
+/// @param cmdlist Handle to command list, when NULL the error is returned.
+/// @param callback Callback to invoke on completion, when NULL the error is returned.
+/// @param user_data User data to pass to the callback.
+/// @return exec_id >= 0 for this execution on success, < 0 on error.
+/// @details Executions of the context are waited on by its internal thread in order of scheduling and
+///          the callbacks are invoked from that thread.
+///          When managed coherency is enabled on the command list (dmp_dv_cmdlist_set_managed_coherency()),
+///          CPU caches for the output buffers are invalidated before the callback is invoked,
+///          so the callback can read the output without dmp_dv_mem_to_cpu().
+///          The result is reported once to the callback, so the execution should not be waited on.
+///          If the command list was scheduled, but its execution could not be passed to the internal thread,
+///          the execution is waited on and the callback is invoked with the error before this function returns.
+///          It is thread-safe.
+int64_t dmp_dv_cmdlist_exec_async(dmp_dv_cmdlist cmdlist, dmp_dv_exec_callback callback, void *user_data);
+
+
+/// @brief Execution of the command list to wait for with dmp_dv_wait_all() or dmp_dv_wait_any().
+struct dmp_dv_wait_entry {
+  union {
+    dmp_dv_cmdlist cmdlist;  // handle to command list
+    uint64_t rsvd;           // padding to 64-bit size
+  };
+  int64_t exec_id;  // execution id returned by dmp_dv_cmdlist_exec(), the entry is skipped when negative
+  int32_t result;   // filled with the result of the completed execution: 0 on success, non-zero otherwise
+  int32_t rsvd2;    // padding to 64-bits
+};
+
+
+/// @brief Waits for all executions to be completed.
+/// @param entries Array of executions, when NULL the error is returned.
+/// @param n Number of executions.
+/// @return 0 if all executions have succeeded, otherwise the error of the first failed one.
+/// @details Result of each execution is written to its entry.
+///          It is thread-safe.
+int dmp_dv_wait_all(struct dmp_dv_wait_entry *entries, int n);
+
+
+/// @brief Waits until any of the executions is completed.
+/// @param entries Array of executions, when NULL the error is returned.
+/// @param n Number of executions.
+/// @param index Filled with the index of the completed execution, can be NULL.
+/// @return Result of the completed execution (0 on success), or error code on invalid arguments.
+/// @details Executions of each context are waited on by the internal thread in order of scheduling,
+///          so the caller does not need a thread per execution.
+///          Set exec_id of the returned entry to -1 to wait for the rest of executions with the same array.
+///          It is thread-safe.
+int dmp_dv_wait_any(struct dmp_dv_wait_entry *entries, int n, int *index);
+
+
+/// @brief Waits for the specific scheduled command to be completed at most for the given time.
+/// @param cmdlist Handle to command list, when NULL the error is returned.
+/// @param exec_id Id of the scheduled command to wait for completion.
+/// @param timeout_us Maximum time to wait in microseconds, negative to wait infinitely as dmp_dv_cmdlist_wait().
+/// @return 0 on success, ETIMEDOUT if the command has not completed within the timeout, non-zero error code otherwise.
+/// @details The wait is done by the internal thread of the context, the caller waits for its notification only,
+///          so the timeout is not rounded up to the internal timeout of the kernel module.
+///          It is thread-safe.
+int dmp_dv_cmdlist_wait_timeout(dmp_dv_cmdlist cmdlist, int64_t exec_id, int64_t timeout_us);
+
+
+/// @brief Checks if the specific scheduled command has completed without blocking.
+/// @param cmdlist Handle to command list, when NULL the error is returned.
+/// @param exec_id Id of the scheduled command.
+/// @return 0 if the command has completed successfully, EAGAIN if it has not completed yet, non-zero error code otherwise.
+/// @details When the command has not completed yet, it is passed to the internal thread of the context,
+///          so its completion will be signaled on the descriptor returned by dmp_dv_context_get_completion_fd().
+///          The error of the failed command is reported only once.
+///          It is thread-safe.
+int dmp_dv_cmdlist_poll(dmp_dv_cmdlist cmdlist, int64_t exec_id);
+
+
+/// @brief Returns eventfd descriptor signaled on completion of the commands scheduled on the context.
+/// @param ctx Context for working with DV accelerator, when NULL the error is returned.
+/// @return File descriptor >= 0 on success, -1 on error.
+/// @details After the first call every command scheduled on the context's command lists is waited on
+///          by the internal thread of the context, which increments the eventfd counter on each completion.
+///          The descriptor is non-blocking and can be added to epoll or poll() for reading:
+///          read it to reset the counter, then call dmp_dv_cmdlist_poll() for the commands in flight.
+///          The descriptor is owned by the context and must not be closed.
+///          It is thread-safe.
+int dmp_dv_context_get_completion_fd(dmp_dv_context ctx);
+
+
 /// @brief Get the last execution time in microseconds of specified command.
 /// @param cmdlist Handle to command list, when NULL the error is returned.
 /// @return last execution time in microseconds(us), or -1 if error.
+/// @details For the command list with several segments returns the sum of the segments execution times.
 int64_t dmp_dv_cmdlist_get_last_exec_time(dmp_dv_cmdlist cmdlist);
 
 
+/// @brief Enables or disables profiling mode for the command list.
+/// @param cmdlist Handle to command list, when NULL the error is returned.
+/// @param enable Non-zero to enable, 0 to disable (default).
+/// @return 0 on success, non-zero otherwise, known error codes:
+///         EALREADY - the command list is already commited.
+/// @details Must be called before dmp_dv_cmdlist_commit().
+///          The kernel module reports execution time for the whole command list only,
+///          so in profiling mode each command is commited separately and
+///          the commands are executed one after another by the internal thread,
+///          which adds the scheduling latency between the commands to the total execution time.
+///          It is thread-safe only on different command lists.
+int dmp_dv_cmdlist_set_profiling(dmp_dv_cmdlist cmdlist, int enable);
+
+
+/// @brief Execution profile of the single command.
+struct dmp_dv_cmd_profile {
+  int64_t exec_time;       // device execution time in microseconds of the last successful execution, -1 if none
+  uint64_t bytes_read;     // total size in bytes of the buffers read by the command
+  uint64_t bytes_written;  // total size in bytes of the buffers written by the command
+  uint64_t n_ops;          // number of arithmetic operations (multiply-add counts as 2), 0 if unknown for the command type
+  double intensity;        // arithmetic intensity in operations per byte: n_ops / (bytes_read + bytes_written)
+};
+
+
+/// @brief Fills the execution profile of the commands of the command list commited in profiling mode.
+/// @param cmdlist Handle to command list, when NULL the error is returned.
+/// @param profile Array of n elements to be filled in the order of commands addition, can be NULL.
+/// @param n Number of elements in the profile array.
+/// @return Number of commands in the command list on success, negative errno on error.
+/// @details Sizes of the buffers and number of operations are computed from the command parameters,
+///          the number of operations is counted for convolutions and fully connected layers.
+///          It is thread-safe.
+int dmp_dv_cmdlist_get_profile(dmp_dv_cmdlist cmdlist, struct dmp_dv_cmd_profile *profile, int n);
+
+
+/// @brief Serializes the commited command list, so it can be restored later without checking the commands again.
+/// @param cmdlist Handle to command list, when NULL the error is returned.
+/// @param buffer_table Memory handles used by the command list, the blob refers to them by index in this table.
+/// @param n_buffers Number of elements in buffer_table.
+/// @param blob Buffer to receive the serialized command list, can be NULL to get only the required size.
+/// @param size On enter must contain size of the blob, on exit will contain used or required size.
+/// @return 0 on success, ENOSPC when the blob is too small, other non-zero on error.
+/// @details Every memory handle referenced by the commands must be present in buffer_table.
+///          The blob stores the capabilities of the device, so it will be rejected by the device of different kind.
+///          It is thread-safe.
+int dmp_dv_cmdlist_serialize(dmp_dv_cmdlist cmdlist, const dmp_dv_mem *buffer_table, int n_buffers,
+                             void *blob, size_t *size);
+
+
+/// @brief Creates commited command list from the blob returned by dmp_dv_cmdlist_serialize().
+/// @param ctx Context for working with DV accelerator, when NULL the error is returned.
+/// @param blob Serialized command list.
+/// @param size Size of the blob in bytes.
+/// @param buffer_table Memory handles to use, indices must match the table passed to dmp_dv_cmdlist_serialize().
+/// @param n_buffers Number of elements in buffer_table.
+/// @return Handle to command list or NULL on error,
+///         the code of the last error is ESTALE when the blob was created for the device with different capabilities.
+/// @details Commands are not checked again, only sizes of the memory handles are validated,
+///          so it is much faster than adding and commiting the commands.
+///          It is thread-safe.
+dmp_dv_cmdlist dmp_dv_cmdlist_deserialize(dmp_dv_context ctx, const void *blob, size_t size,
+                                          const dmp_dv_mem *buffer_table, int n_buffers);
+
+
+/// @brief Creates ring of equally sized slots allocated from a single ION buffer.
+/// @param ctx Context for working with DV accelerator, when NULL the error is returned.
+/// @param slot_size Size of each slot in bytes, slots are placed at page boundaries.
+/// @param n_slots Number of slots.
+/// @return Handle to the ring or NULL on error.
+/// @details Typical producer loop is: dmp_dv_ring_acquire(), fill dmp_dv_ring_get_slot() memory,
+///          dmp_dv_cmdlist_exec() on the command list reading the slot, dmp_dv_ring_commit() with the returned exec_id.
+///          It is thread-safe.
+dmp_dv_ring dmp_dv_ring_create(dmp_dv_context ctx, size_t slot_size, int n_slots);
+
+
+/// @brief Releases the ring (decreases reference counter).
+/// @param ring Handle to the ring, when NULL it is ignored.
+/// @return Reference counter value after the function call, 0 if ring is NULL.
+/// @details It is thread-safe.
+int dmp_dv_ring_release(dmp_dv_ring ring);
+
+
+/// @brief Retains the ring (increases reference counter).
+/// @param ring Handle to the ring, when NULL it is ignored.
+/// @return Reference counter value after the function call, 0 if ring is NULL.
+/// @details It is thread-safe.
+int dmp_dv_ring_retain(dmp_dv_ring ring);
+
+
+/// @brief Returns memory handle of the slot.
+/// @param ring Handle to the ring, when NULL the error is returned.
+/// @param slot Slot index in [0, n_slots) range.
+/// @return Memory handle or NULL on error.
+/// @details Returned handle is owned by the ring, call dmp_dv_mem_retain() to keep it longer than the ring.
+///          Slot handles are stable, so command lists can be created once per slot.
+///          It is thread-safe.
+dmp_dv_mem dmp_dv_ring_get_slot(dmp_dv_ring ring, int slot);
+
+
+/// @brief Takes the next slot in round-robin order for filling by CPU.
+/// @param ring Handle to the ring, when NULL the error is returned.
+/// @param wait When non-zero and the device is still reading the slot, waits for the committed execution,
+///             otherwise returns -EAGAIN.
+/// @return Slot index >= 0 on success, negative errno on error (-EBUSY when the next slot is acquired and not committed).
+/// @details It is thread-safe.
+int dmp_dv_ring_acquire(dmp_dv_ring ring, int wait);
+
+
+/// @brief Passes the acquired slot to the device.
+/// @param ring Handle to the ring, when NULL the error is returned.
+/// @param slot Slot index returned by dmp_dv_ring_acquire().
+/// @param cmdlist Command list which reads the slot, NULL returns the slot to the ring without execution.
+/// @param exec_id Execution id returned by dmp_dv_cmdlist_exec() for the command list.
+/// @return 0 on success, non-zero otherwise.
+/// @details The slot will be reused after dmp_dv_cmdlist_wait() on the command list has succeeded
+///          for exec_id or a later execution id.
+///          It is thread-safe.
+int dmp_dv_ring_commit(dmp_dv_ring ring, int slot, dmp_dv_cmdlist cmdlist, int64_t exec_id);
+
+
 /// @brief Memory buffer specification.
 struct dmp_dv_buf {
   union {
@@ -329,6 +1015,21 @@ struct dmp_dv_cmdraw {
 int dmp_dv_cmdlist_add_raw(dmp_dv_cmdlist cmdlist, struct dmp_dv_cmdraw *cmd);
 
 
+/// @brief Replaces the memory handle in all buffers of the commited command list.
+/// @param cmdlist Handle to command list, when NULL the error is returned.
+/// @param old_mem Memory handle used by the commands to replace.
+/// @param new_buf Buffer to use instead, offset within old_mem becomes offset from new_buf->offs.
+/// @return 0 on success, non-zero otherwise (the command list is not changed), known error codes:
+///         EBUSY - the command list is executing,
+///         ENOTSUP - the buffer was converted on commit (weights of FC layer executed on CONV).
+/// @details Allows double-buffering of the inputs and outputs without building and committing the second command list:
+///          only the sizes of the affected buffers are checked again and
+///          the device commands are patched in place, the new buffer must keep the 16-bytes alignment of the old one.
+///          The command list must not be executing: dmp_dv_cmdlist_wait() must be called on the last execution.
+///          It is thread-safe only on different command lists.
+int dmp_dv_cmdlist_rebind(dmp_dv_cmdlist cmdlist, dmp_dv_mem old_mem, const struct dmp_dv_buf *new_buf);
+
+
 /// @brief Packs convolution layer weights and biases into output array.
 /// @param n_channels Number of input channels, for depthwise convolution this must be set to 1.
 /// @param kx Kernel width.
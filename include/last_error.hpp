@@ -0,0 +1,194 @@
+/*
+ *  Copyright 2018 Digital Media Professionals Inc.
+
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+
+ *      http://www.apache.org/licenses/LICENSE-2.0
+
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+/// @file
+/// @brief Lazily formatted thread-local last error.
+#pragma once
+
+#include <stddef.h>
+#include <string.h>
+
+#include <type_traits>
+#include <algorithm>
+
+
+/// @brief Records the error of the calling thread keeping the arguments for formatting on demand.
+/// @details Failing probes often never read the message, so only the arguments are captured
+///          (strings are copied as they may not outlive the call) and the message is formatted
+///          by Format() when requested.
+class CDMPDVLastError {
+ public:
+  /// @brief Sets the last error of the calling thread.
+  /// @param code errno-style error code.
+  /// @param format printf-style format string with static storage duration.
+  template <typename... Args>
+  static void Set(int code, const char *format, Args... args) {
+    struct dmp_dv_last_error *e = &s_last_error;
+    e->code = code;
+    e->n_args = 0;
+    e->strings_size = 0;
+    if (sizeof...(args) > DMP_DV_LAST_ERROR_MAX_ARGS) {
+      snprintf(e->message, sizeof(e->message), format, args...);
+      e->format = NULL;
+      return;
+    }
+    e->format = format;
+    CaptureArgs(e, args...);
+  }
+
+  /// @brief Formats the message of the calling thread if it was not formatted yet.
+  static void Format() {
+    struct dmp_dv_last_error *e = &s_last_error;
+    if (!e->format) {
+      return;
+    }
+    char *out = e->message;
+    char *const out_end = e->message + sizeof(e->message) - 1;
+    const char *f = e->format;
+    int i_arg = 0;
+    while ((*f) && (out < out_end)) {
+      if ((*f != '%') || (f[1] == '%')) {
+        *out++ = *f;
+        f += (*f == '%') ? 2 : 1;
+        continue;
+      }
+
+      // Split the conversion specification into flags with width and precision, length modifier and conversion
+      const char *spec = f++;
+      while ((*f) && (strchr("-+ #0123456789.", *f))) {
+        ++f;
+      }
+      const char *mod = f;
+      while ((*f) && (strchr("hlLqjzt", *f))) {
+        ++f;
+      }
+      const int mod_len = (int)(f - mod);
+      const char conv = *f;
+      if (conv) {
+        ++f;
+      }
+      char fmt[32];
+      snprintf(fmt, sizeof(fmt), "%.*s%s%c", (int)std::min(mod - spec, (ptrdiff_t)16), spec,
+               (conv) && (strchr("diouxX", conv)) ? "ll" : "", conv);
+
+      const DMPDVLastErrorArg *a = (conv) && (i_arg < e->n_args) ? &e->args[i_arg++] : NULL;
+      const size_t left = out_end - out + 1;
+      int n = 0;
+      if (!a) {
+        n = snprintf(out, left, "%.*s", (int)(f - spec), spec);
+      }
+      else if (strchr("di", conv)) {
+        n = snprintf(out, left, fmt, (long long)Narrow(a->v.i, mod, mod_len, false));
+      }
+      else if (strchr("ouxX", conv)) {
+        n = snprintf(out, left, fmt, (unsigned long long)Narrow(a->v.i, mod, mod_len, true));
+      }
+      else if (conv == 'c') {
+        n = snprintf(out, left, fmt, (int)a->v.i);
+      }
+      else if (strchr("eEfFgGaA", conv)) {
+        n = snprintf(out, left, fmt, a->v.d);
+      }
+      else if (conv == 's') {
+        n = snprintf(out, left, fmt, a->type == DMP_DV_LAST_ERROR_ARG_STRING ? e->strings + a->v.i : "(null)");
+      }
+      else if (conv == 'p') {
+        n = snprintf(out, left, fmt, a->v.p);
+      }
+      else {
+        n = snprintf(out, left, "%.*s", (int)(f - spec), spec);
+      }
+      out += std::min((size_t)std::max(n, 0), left - 1);
+    }
+    *out = 0;
+    e->format = NULL;
+  }
+
+ private:
+  /// @brief Stops the recursion over arguments.
+  static inline void CaptureArgs(struct dmp_dv_last_error *e) {
+    // Empty by design
+  }
+
+  /// @brief Captures the arguments one by one.
+  template <typename T, typename... Args>
+  static inline void CaptureArgs(struct dmp_dv_last_error *e, T arg, Args... args) {
+    CaptureArg(&e->args[e->n_args++], e, arg);
+    CaptureArgs(e, args...);
+  }
+
+  /// @brief Captures integer argument.
+  template <typename T>
+  static inline typename std::enable_if<std::is_integral<T>::value || std::is_enum<T>::value>::type
+  CaptureArg(DMPDVLastErrorArg *a, struct dmp_dv_last_error *e, T arg) {
+    a->type = DMP_DV_LAST_ERROR_ARG_INT;
+    a->v.i = std::is_signed<T>::value ? (int64_t)arg : (int64_t)(uint64_t)arg;
+  }
+
+  /// @brief Captures floating point argument.
+  static inline void CaptureArg(DMPDVLastErrorArg *a, struct dmp_dv_last_error *e, double arg) {
+    a->type = DMP_DV_LAST_ERROR_ARG_DOUBLE;
+    a->v.d = arg;
+  }
+
+  /// @brief Captures string argument copying it to the thread-local storage.
+  static inline void CaptureArg(DMPDVLastErrorArg *a, struct dmp_dv_last_error *e, const char *arg) {
+    if (!arg) {
+      a->type = DMP_DV_LAST_ERROR_ARG_POINTER;
+      a->v.p = NULL;
+      return;
+    }
+    a->type = DMP_DV_LAST_ERROR_ARG_STRING;
+    if (e->strings_size >= sizeof(e->strings)) {  // no space left, the string is printed as empty
+      e->strings[sizeof(e->strings) - 1] = 0;
+      a->v.i = (int64_t)(sizeof(e->strings) - 1);
+      return;
+    }
+    const size_t n = std::min(strlen(arg), sizeof(e->strings) - e->strings_size - 1);
+    a->v.i = (int64_t)e->strings_size;
+    memcpy(e->strings + e->strings_size, arg, n);
+    e->strings[e->strings_size + n] = 0;
+    e->strings_size += n + 1;
+  }
+
+  /// @brief Captures string argument copying it to the thread-local storage.
+  static inline void CaptureArg(DMPDVLastErrorArg *a, struct dmp_dv_last_error *e, char *arg) {
+    CaptureArg(a, e, (const char*)arg);
+  }
+
+  /// @brief Captures pointer argument.
+  template <typename T>
+  static inline void CaptureArg(DMPDVLastErrorArg *a, struct dmp_dv_last_error *e, T *arg) {
+    a->type = DMP_DV_LAST_ERROR_ARG_POINTER;
+    a->v.p = (const void*)arg;
+  }
+
+  /// @brief Converts captured integer to the type of the printf length modifier, no modifier means int.
+  static inline int64_t Narrow(int64_t value, const char *mod, int mod_len, bool is_unsigned) {
+    if (!mod_len) {
+      return is_unsigned ? (int64_t)(unsigned int)value : (int64_t)(int)value;
+    }
+    if ((mod_len == 1) && (mod[0] == 'h')) {
+      return is_unsigned ? (int64_t)(unsigned short)value : (int64_t)(short)value;
+    }
+    if ((mod_len == 2) && (mod[0] == 'h')) {
+      return is_unsigned ? (int64_t)(unsigned char)value : (int64_t)(signed char)value;
+    }
+    if ((mod_len == 1) && ((mod[0] == 'l') || (mod[0] == 'z') || (mod[0] == 't'))) {  // 32-bit on 32-bit targets
+      return is_unsigned ? (int64_t)(unsigned long)value : (int64_t)(long)value;
+    }
+    return value;
+  }
+};
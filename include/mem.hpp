@@ -18,10 +18,23 @@
 #pragma once
 
 #include "context.hpp"
-
-
-#define CACHE_LINE_SIZE 64
-#define CACHE_LINE_LOG2 6
+#include "cache.hpp"
+#include "mem_stats.hpp"
+
+#include <vector>
+#include <mutex>
+
+
+/// @brief Mapped window of the memory buffer.
+struct DMPDVMemWindow {
+  size_t offs;        // requested offset within the buffer
+  size_t size;        // requested size
+  int flags;          // DMP_DV_MEM_MAP_* flags
+  int n_ref;          // number of dmp_dv_mem_map_ex() calls which returned this window
+  uint8_t *map_base;  // address returned by mmap()
+  size_t map_offs;    // page aligned offset within the buffer passed to mmap()
+  size_t map_size;    // size passed to mmap()
+};
 
 
 /// @brief Implementation of dmp_dv_mem.
@@ -30,11 +43,17 @@ class CDMPDVMem : public CDMPDVBase {
   /// @brief Constructor.
   CDMPDVMem() : CDMPDVBase() {
     ctx_ = NULL;
+    parent_ = NULL;
+    parent_offs_ = 0;
     fd_mem_ = -1;
     requested_size_ = 0;
     real_size_ = 0;
+    pool_class_size_ = 0;
+    imported_ = false;
+    cache_mode_ = DMP_DV_MEM_CACHED;
     map_ptr_ = NULL;
     sync_flags_ = 0;
+    stale_ = 0;
   }
 
   /// @brief Destructor.
@@ -43,37 +62,122 @@ class CDMPDVMem : public CDMPDVBase {
   }
 
   /// @brief Allocates memory accessible by device associated with the provided context.
-  bool Initialize(CDMPDVContext *ctx, size_t size) {
+  /// @param flags One of DMP_DV_MEM_CACHED, DMP_DV_MEM_UNCACHED, DMP_DV_MEM_WRITE_COMBINED.
+  bool Initialize(CDMPDVContext *ctx, size_t size, int flags = DMP_DV_MEM_CACHED) {
     Cleanup();
     if (!ctx) {
       SET_ERR("Invalid argument: ctx is NULL");
       return NULL;
     }
+    if ((flags != DMP_DV_MEM_CACHED) && (flags != DMP_DV_MEM_UNCACHED) && (flags != DMP_DV_MEM_WRITE_COMBINED)) {
+      SET_ERR("Invalid argument: unsupported flags 0x%x", flags);
+      return false;
+    }
+    cache_mode_ = flags;
+
+    // Try to reuse a buffer from the pool
+    pool_class_size_ = ctx->get_mem_pool()->GetClassSize(size);
+    if (pool_class_size_) {
+      fd_mem_ = ctx->get_mem_pool()->Acquire(pool_class_size_, get_pool_kind());
+      if (fd_mem_ != -1) {
+        requested_size_ = size;
+        real_size_ = pool_class_size_;
+        __sync_add_and_fetch(&total_size_, (int64_t)real_size_);
+        ctx->get_mem_usage()->Reserve(real_size_);
+        ctx->get_mem_usage()->CountAllocation(real_size_);
+        ctx->Retain();
+        ctx_ = ctx;
+        return true;
+      }
+    }
 
     // Try to allocate a buffer
     struct ion_allocation_data alloc_param;
     memset(&alloc_param, 0, sizeof(alloc_param));
-    alloc_param.len = size;
+    alloc_param.len = pool_class_size_ ? pool_class_size_ : size;
     alloc_param.heap_id_mask = ctx->get_dma_heap_id_mask();
-    alloc_param.flags = ION_FLAG_CACHED;
-    int res = ioctl(ctx->get_fd_ion(), ION_IOC_ALLOC, &alloc_param);
+    // ION maps buffers without ION_FLAG_CACHED as write-combined,
+    // so uncached and write-combined modes are the same allocation
+    alloc_param.flags = cache_mode_ == DMP_DV_MEM_CACHED ? ION_FLAG_CACHED : 0;
+
+    // Check the context memory budget before ION will try to compact CMA
+    const size_t page_size = (size_t)sysconf(_SC_PAGESIZE);
+    const size_t reserved_size = (alloc_param.len + page_size - 1) / page_size * page_size;
+    if (!ctx->ReserveMem(reserved_size)) {
+      return false;
+    }
+
+    int res;
+    {
+      CDMPDVMemStatsTimer timer(DMP_DV_MEM_OP_ALLOC);
+      res = ioctl(ctx->get_fd_ion(), ION_IOC_ALLOC, &alloc_param);
+    }
     if (res < 0) {
       SET_IOCTL_ERR(res, "/dev/ion", "ION_IOC_ALLOC");
+      ctx->get_mem_usage()->Unreserve(reserved_size);
       return false;
     }
     fd_mem_ = alloc_param.fd;
     requested_size_ = size;
     off_t buf_size = lseek(fd_mem_, 0, SEEK_END);
     if ((buf_size < 0) || ((size_t)buf_size < size)) {
-      SET_ERR("Could not confirm size of allocated continuous memory for %zu bytes", size);
+      SET_ERR_CODE(EIO, "Could not confirm size of allocated continuous memory for %zu bytes", size);
+      ctx->get_mem_usage()->Unreserve(reserved_size);
       return false;
     }
     if (lseek(fd_mem_, 0, SEEK_SET)) {
-      SET_ERR("Could not confirm size of allocated continuous memory for %zu bytes", size);
+      SET_ERR_CODE(EIO, "Could not confirm size of allocated continuous memory for %zu bytes", size);
+      ctx->get_mem_usage()->Unreserve(reserved_size);
       return false;
     }
     real_size_ = buf_size;
     __sync_add_and_fetch(&total_size_, (int64_t)real_size_);
+    if (real_size_ != reserved_size) {
+      ctx->get_mem_usage()->Unreserve(reserved_size);
+      ctx->get_mem_usage()->Reserve(real_size_);
+    }
+    ctx->get_mem_usage()->CountAllocation(real_size_);
+
+    ctx->Retain();
+    ctx_ = ctx;
+
+    return true;
+  }
+
+  /// @brief Wraps dma-buf file descriptor allocated outside of this library.
+  /// @param fd dma-buf file descriptor, it is duplicated, so the caller keeps the ownership of the original one.
+  /// @param size Usable size of the buffer in bytes, 0 to use the whole buffer.
+  bool InitializeImport(CDMPDVContext *ctx, int fd, size_t size) {
+    Cleanup();
+    if (!ctx) {
+      SET_ERR("Invalid argument: ctx is NULL");
+      return false;
+    }
+    if (fd < 0) {
+      SET_ERR("Invalid argument: fd is %d", fd);
+      return false;
+    }
+    off_t buf_size = lseek(fd, 0, SEEK_END);
+    if (buf_size <= 0) {
+      SET_ERR_CODE(errno, "Could not determine size of the dma-buf with fd=%d: %s", fd, strerror(errno));
+      return false;
+    }
+    if (lseek(fd, 0, SEEK_SET)) {
+      SET_ERR_CODE(errno, "Could not determine size of the dma-buf with fd=%d: %s", fd, strerror(errno));
+      return false;
+    }
+    if ((size_t)buf_size < size) {
+      SET_ERR("Invalid argument: size %zu is greater than the size of the dma-buf %zu", size, (size_t)buf_size);
+      return false;
+    }
+    fd_mem_ = fcntl(fd, F_DUPFD_CLOEXEC, 0);
+    if (fd_mem_ == -1) {
+      SET_ERR_CODE(errno, "fcntl(F_DUPFD_CLOEXEC) failed for fd=%d: %s", fd, strerror(errno));
+      return false;
+    }
+    imported_ = true;
+    requested_size_ = size ? size : (size_t)buf_size;
+    real_size_ = requested_size_;
 
     ctx->Retain();
     ctx_ = ctx;
@@ -81,16 +185,135 @@ class CDMPDVMem : public CDMPDVBase {
     return true;
   }
 
+  /// @brief Creates region of the parent memory sharing its file descriptor and mapping.
+  bool InitializeChild(CDMPDVMem *parent, size_t offs, size_t size) {
+    Cleanup();
+    if (!parent) {
+      SET_ERR("Invalid argument: parent is NULL");
+      return false;
+    }
+    if (offs & 15) {
+      SET_ERR("Invalid argument: offs must be 16-bytes aligned, got %zu", offs);
+      return false;
+    }
+    if ((!size) || (offs >= parent->real_size_) || (parent->real_size_ - offs < size)) {
+      SET_ERR("Invalid memory range specified: offs=%zu size=%zu while memory buffer size is %zu",
+              offs, size, parent->real_size_);
+      return false;
+    }
+    if (parent->parent_) {  // always refer to the memory which owns the file descriptor
+      offs += parent->parent_offs_;
+      parent = parent->parent_;
+    }
+
+    parent->Retain();
+    parent_ = parent;
+    parent_offs_ = offs;
+    fd_mem_ = parent->fd_mem_;
+    requested_size_ = size;
+    real_size_ = size;
+
+    return true;
+  }
+
+  /// @brief Marks the range as written by CPU.
+  /// @details Dirty ranges are tracked on the memory which owns the file descriptor
+  ///          and are flushed only by command lists with managed coherency.
+  void MarkDirty(size_t offs, size_t size) {
+    if (parent_) {
+      parent_->MarkDirty(parent_offs_ + offs, size);
+      return;
+    }
+    if (!size) {
+      return;
+    }
+    size_t start = offs, end = offs + size;
+    std::lock_guard<std::mutex> lock(dirty_mutex_);
+    auto it = dirty_.begin();
+    for (; (it != dirty_.end()) && (it->second < start); ++it) {
+      // skip ranges before the new one
+    }
+    auto first = it;
+    for (; (it != dirty_.end()) && (it->first <= end); ++it) {
+      start = std::min(start, it->first);
+      end = std::max(end, it->second);
+    }
+    it = dirty_.erase(first, it);
+    dirty_.insert(it, std::make_pair(start, end));
+  }
+
+  /// @brief Removes dirty state from the range.
+  /// @param taken When not NULL, the removed dirty parts as [start, end) offsets within this memory are appended to it.
+  void TakeDirty(size_t offs, size_t size, std::vector<std::pair<size_t, size_t> > *taken) {
+    if (parent_) {
+      const size_t n0 = taken ? taken->size() : 0;
+      parent_->TakeDirty(parent_offs_ + offs, size, taken);
+      for (size_t i = n0; taken && (i < taken->size()); ++i) {
+        (*taken)[i].first -= parent_offs_;
+        (*taken)[i].second -= parent_offs_;
+      }
+      return;
+    }
+    const size_t start = offs, end = offs + size;
+    std::lock_guard<std::mutex> lock(dirty_mutex_);
+    if (dirty_.empty()) {
+      return;
+    }
+    std::vector<std::pair<size_t, size_t> > kept;
+    kept.reserve(dirty_.size() + 1);
+    for (auto it = dirty_.begin(); it != dirty_.end(); ++it) {
+      if ((it->second <= start) || (it->first >= end)) {
+        kept.push_back(*it);
+        continue;
+      }
+      if (it->first < start) {
+        kept.push_back(std::make_pair(it->first, start));
+      }
+      if (taken) {
+        taken->push_back(std::make_pair(std::max(it->first, start), std::min(it->second, end)));
+      }
+      if (it->second > end) {
+        kept.push_back(std::make_pair(end, it->second));
+      }
+    }
+    dirty_.swap(kept);
+  }
+
   /// @brief Releases held resources.
   void Cleanup() {
+    UnmapWindows();
+    if (parent_) {
+      fd_mem_ = -1;
+      requested_size_ = 0;
+      real_size_ = 0;
+      parent_offs_ = 0;
+      parent_->Release();
+      parent_ = NULL;
+      return;
+    }
     Unmap();
-    if (fd_mem_ != -1) {
+    if ((fd_mem_ != -1) && (imported_)) {
       close(fd_mem_);
       fd_mem_ = -1;
+    }
+    if (fd_mem_ != -1) {
+      if (ctx_) {
+        ctx_->get_mem_usage()->Unreserve(real_size_);
+        ctx_->get_mem_usage()->CountRelease();
+      }
+      if ((!ctx_) || (!pool_class_size_) || (!ctx_->get_mem_pool()->Put(fd_mem_, pool_class_size_, get_pool_kind()))) {
+        close(fd_mem_);
+      }
+      fd_mem_ = -1;
       __sync_add_and_fetch(&total_size_, -(int64_t)real_size_);
     }
+    imported_ = false;
+    cache_mode_ = DMP_DV_MEM_CACHED;
+    stale_ = 0;
     requested_size_ = 0;
     real_size_ = 0;
+    pool_class_size_ = 0;
+    dirty_.clear();
     if (ctx_) {
       ctx_->Release();
       ctx_ = NULL;
@@ -99,31 +322,161 @@ class CDMPDVMem : public CDMPDVBase {
 
   /// @brief Maps allocated memory to user address space with READ and WRITE permissions.
   uint8_t* Map() {
+    if (parent_) {
+      uint8_t *ptr = parent_->Map();
+      return ptr ? ptr + parent_offs_ : NULL;
+    }
     if (map_ptr_) {
       return map_ptr_;
     }
-    void *ptr = mmap(NULL, real_size_, PROT_READ | PROT_WRITE, MAP_SHARED, fd_mem_, 0);
+    void *ptr = TimedMmap(NULL, real_size_, PROT_READ | PROT_WRITE, MAP_SHARED, fd_mem_, 0);
     if (ptr == MAP_FAILED) {
-      SET_ERR("mmap() on allocated from /dev/ion file descriptor failed for %zu bytes", real_size_);
+      SET_ERR_CODE(errno, "mmap() on allocated from /dev/ion file descriptor failed for %zu bytes", real_size_);
       return NULL;
     }
     map_ptr_ = (uint8_t*)ptr;
+    if ((__sync_lock_test_and_set(&stale_, 0)) && (InvalidateMapped(map_ptr_, real_size_))) {
+      TimedMunmap(map_ptr_, real_size_);
+      map_ptr_ = NULL;
+      __sync_lock_test_and_set(&stale_, 1);
+      return NULL;
+    }
+    MarkDirty(0, real_size_);
     return map_ptr_;
   }
 
   /// @brief Unmaps allocated memory from user address space.
+  /// @details Does nothing for the memory region as the mapping is owned by the parent.
   void Unmap() {
     if (!map_ptr_) {
       return;
     }
     SyncEnd();
-    munmap(map_ptr_, real_size_);
+    TimedMunmap(map_ptr_, real_size_);
     map_ptr_ = NULL;
   }
 
+  /// @brief Maps window of the allocated memory to user address space.
+  /// @param offs Offset of the window in bytes.
+  /// @param size Size of the window in bytes, 0 maps till the end of the buffer.
+  /// @param flags Combination of DMP_DV_MEM_MAP_* flags.
+  /// @return Pointer to the start of the window or NULL on error.
+  uint8_t *MapEx(size_t offs, size_t size, int flags) {
+    if (flags & ~(DMP_DV_MEM_MAP_POPULATE | DMP_DV_MEM_MAP_READ_ONLY)) {
+      SET_ERR("Invalid argument: unsupported flags 0x%x", flags);
+      return NULL;
+    }
+    if (offs >= real_size_) {
+      SET_ERR("Invalid memory range specified: offs=%zu size=%zu while memory buffer size is %zu",
+              offs, size, real_size_);
+      return NULL;
+    }
+    if (!size) {
+      size = real_size_ - offs;
+    }
+    if (real_size_ - offs < size) {
+      SET_ERR("Invalid memory range specified: offs=%zu size=%zu while memory buffer size is %zu",
+              offs, size, real_size_);
+      return NULL;
+    }
+    if (parent_) {
+      return parent_->MapEx(parent_offs_ + offs, size, flags);
+    }
+
+    std::lock_guard<std::mutex> lock(windows_mutex_);
+    for (auto it = windows_.begin(); it != windows_.end(); ++it) {
+      if ((it->offs == offs) && (it->size == size) && (it->flags == flags)) {
+        if (!(flags & DMP_DV_MEM_MAP_READ_ONLY)) {
+          MarkDirty(offs, size);
+        }
+        ++it->n_ref;
+        return it->map_base + (offs - it->map_offs);
+      }
+    }
+
+    const size_t page_size = (size_t)sysconf(_SC_PAGESIZE);
+    DMPDVMemWindow window;
+    window.offs = offs;
+    window.size = size;
+    window.flags = flags;
+    window.n_ref = 1;
+    window.map_offs = offs / page_size * page_size;
+    window.map_size = std::min((offs + size + page_size - 1) / page_size * page_size, real_size_) - window.map_offs;
+    void *ptr = TimedMmap(NULL, window.map_size,
+                          (flags & DMP_DV_MEM_MAP_READ_ONLY) ? PROT_READ : PROT_READ | PROT_WRITE,
+                          MAP_SHARED | ((flags & DMP_DV_MEM_MAP_POPULATE) ? MAP_POPULATE : 0),
+                          fd_mem_, window.map_offs);
+    if (ptr == MAP_FAILED) {
+      SET_ERR_CODE(errno, "mmap() on allocated from /dev/ion file descriptor failed for %zu bytes at offset %zu: %s",
+                          window.map_size, window.map_offs, strerror(errno));
+      return NULL;
+    }
+    window.map_base = (uint8_t*)ptr;
+    if ((__sync_fetch_and_add(&stale_, 0)) && (InvalidateMapped(window.map_base + (offs - window.map_offs), size))) {
+      TimedMunmap(window.map_base, window.map_size);
+      return NULL;
+    }
+    windows_.push_back(window);
+    if (!(flags & DMP_DV_MEM_MAP_READ_ONLY)) {
+      MarkDirty(offs, size);
+    }
+    return window.map_base + (offs - window.map_offs);
+  }
+
+  /// @brief Unmaps window previously mapped with MapEx() when its reference counter reaches zero.
+  /// @param ptr Pointer returned by MapEx() or Map().
+  /// @return 0 on success, non-zero otherwise.
+  int UnmapEx(uint8_t *ptr) {
+    if (parent_) {
+      return parent_->UnmapEx(ptr);
+    }
+    {
+      std::lock_guard<std::mutex> lock(windows_mutex_);
+      for (auto it = windows_.begin(); it != windows_.end(); ++it) {
+        if (it->map_base + (it->offs - it->map_offs) != ptr) {
+          continue;
+        }
+        if (--it->n_ref > 0) {
+          return 0;
+        }
+        TimedMunmap(it->map_base, it->map_size);
+        windows_.erase(it);
+        return 0;
+      }
+    }
+    if ((map_ptr_) && (ptr >= map_ptr_) && (ptr < map_ptr_ + real_size_)) {
+      Unmap();
+      return 0;
+    }
+    SET_ERR("Invalid argument: pointer %p was not returned by dmp_dv_mem_map_ex() for this memory handle", ptr);
+    return EINVAL;
+  }
+
+  /// @brief Returns CPU address of the memory range from the full mapping or from the window which contains it.
+  /// @param writable Skip windows mapped with DMP_DV_MEM_MAP_READ_ONLY.
+  /// @return Pointer to the start of the range or NULL if the range is not mapped.
+  uint8_t *GetCPUAddr(size_t offs, size_t size, bool writable = false) {
+    if (map_ptr_) {
+      return map_ptr_ + offs;
+    }
+    std::lock_guard<std::mutex> lock(windows_mutex_);
+    for (auto it = windows_.begin(); it != windows_.end(); ++it) {
+      if ((writable) && (it->flags & DMP_DV_MEM_MAP_READ_ONLY)) {
+        continue;
+      }
+      if ((offs >= it->map_offs) && (offs + size <= it->map_offs + it->map_size)) {
+        return it->map_base + (offs - it->map_offs);
+      }
+    }
+    return NULL;
+  }
+
   /// @brief Starts CPU <-> Device memory syncronization.
   int SyncStart(int rd, int wr) {
-    if (!map_ptr_) {
+    if (parent_) {
+      return parent_->SyncStart(rd, wr);
+    }
+    if ((!map_ptr_) && (!HasWindows())) {
       SET_ERR("Memory must be mapped before starting synchronization");
       return EINVAL;
     }
@@ -143,7 +496,7 @@ class CDMPDVMem : public CDMPDVBase {
     struct dma_buf_sync sync_args;
     memset(&sync_args, 0, sizeof(sync_args));
     sync_args.flags = DMA_BUF_SYNC_START | sync_flags_;
-    res = ioctl(fd_mem_, DMA_BUF_IOCTL_SYNC, &sync_args);
+    res = TimedDmaBufSync(fd_mem_, &sync_args);
     if (res < 0) {
       SET_IOCTL_ERR(res, "/dev/ion", "DMA_BUF_SYNC_START");
       return res;
@@ -153,13 +506,16 @@ class CDMPDVMem : public CDMPDVBase {
 
   /// @brief Ends CPU <-> Device memory syncronization.
   int SyncEnd() {
+    if (parent_) {
+      return parent_->SyncEnd();
+    }
     if (!sync_flags_) {
       return 0;
     }
     struct dma_buf_sync sync_args;
     memset(&sync_args, 0, sizeof(sync_args));
     sync_args.flags = DMA_BUF_SYNC_END | sync_flags_;
-    int res = ioctl(fd_mem_, DMA_BUF_IOCTL_SYNC, &sync_args);
+    int res = TimedDmaBufSync(fd_mem_, &sync_args);
     if (res < 0) {
       SET_IOCTL_ERR(res, "/dev/ion", "DMA_BUF_SYNC_END");
       return res;
@@ -168,6 +524,11 @@ class CDMPDVMem : public CDMPDVBase {
     return 0;
   }
 
+  /// @brief Returns caching mode of the memory.
+  inline int get_cache_mode() const {
+    return parent_ ? parent_->cache_mode_ : cache_mode_;
+  }
+
   /// @brief Returns real size of the allocated memory which can be greater than requested.
   inline size_t get_size() const {
     return real_size_;
@@ -178,19 +539,81 @@ class CDMPDVMem : public CDMPDVBase {
     return mem ? ((CDMPDVMem*)mem)->fd_mem_ : -1;
   }
 
+  /// @brief Returns offset of the memory region within the memory referenced by get_fd() or 0 when memory handle is NULL.
+  static inline uint64_t get_base_offs(dmp_dv_mem mem) {
+    return mem ? ((CDMPDVMem*)mem)->parent_offs_ : 0;
+  }
+
   /// @brief Returns total per-process allocated device-accessible memory size in bytes.
   static inline int64_t get_total_size() {
     return __sync_add_and_fetch(&total_size_, 0);
   }
 
+  /// @brief Returns true if the memory or its parent is mapped with Map() or MapEx().
+  bool IsMapped() {
+    if (parent_) {
+      return parent_->IsMapped();
+    }
+    return (map_ptr_ != NULL) || (HasWindows());
+  }
+
+  /// @brief Marks CPU caches for the unmapped memory as possibly stale after the device has written to it.
+  /// @details Invalidation is deferred until the memory is mapped, so device-only buffers need no maintenance.
+  void MarkStale() {
+    if (parent_) {
+      parent_->MarkStale();
+      return;
+    }
+    if ((cache_mode_ == DMP_DV_MEM_CACHED) && (!sync_flags_)) {
+      __sync_lock_test_and_set(&stale_, 1);
+    }
+  }
+
+  /// @brief Returns true if at least one window is mapped with MapEx().
+  bool HasWindows() {
+    std::lock_guard<std::mutex> lock(windows_mutex_);
+    return !windows_.empty();
+  }
+
+  /// @brief Returns kind of the allocation in the context memory pool.
+  inline int get_pool_kind() const {
+    return cache_mode_ == DMP_DV_MEM_CACHED ? 0 : 1;
+  }
+
+  /// @brief Returns CPU address of the range mapping it with MapEx() when it is not mapped yet.
+  /// @param flags Flags for MapEx().
+  /// @param window Set to the pointer to be passed to UnmapEx() when the range was mapped by this call, NULL otherwise.
+  /// @return Pointer to the start of the range or NULL on error.
+  uint8_t *GetOrMapCPUAddr(size_t offs, size_t size, int flags, uint8_t **window) {
+    *window = NULL;
+    uint8_t *ptr = GetCPUAddr(offs, size, !(flags & DMP_DV_MEM_MAP_READ_ONLY));
+    if (!ptr) {
+      ptr = MapEx(offs, size, flags);
+      *window = ptr;
+    }
+    return ptr;
+  }
+
+  /// @brief Unmaps all windows mapped with MapEx().
+  void UnmapWindows() {
+    std::lock_guard<std::mutex> lock(windows_mutex_);
+    for (auto it = windows_.rbegin(); it != windows_.rend(); ++it) {
+      TimedMunmap(it->map_base, it->map_size);
+    }
+    windows_.clear();
+  }
+
   /// @brief Returns pointer to mapped memory.
   inline uint8_t *get_ptr() const {
+    if (parent_) {
+      return parent_->map_ptr_ ? parent_->map_ptr_ + parent_offs_ : NULL;
+    }
     return map_ptr_;
   }
 
   /// @brief Returns sync flags.
   inline int get_sync_flags() const {
-    return sync_flags_;
+    return parent_ ? parent_->sync_flags_ : sync_flags_;
   }
 
   int ToDevice(size_t offs, size_t size, int flags) {
@@ -199,73 +622,288 @@ class CDMPDVMem : public CDMPDVBase {
               offs, size, real_size_);
       return EINVAL;
     }
+    if (parent_) {
+      return parent_->ToDevice(parent_offs_ + offs, size, flags);
+    }
     if (!size) {
       return 0;
     }
-    if (!map_ptr_) {
+    CDMPDVMemStatsTimer timer(DMP_DV_MEM_OP_TO_DEVICE);  // after the delegation, so regions are recorded once
+    if (cache_mode_ != DMP_DV_MEM_CACHED) {  // only drain write buffers
+      TakeDirty(offs, size, NULL);
+      CDMPDVCacheEngine::Barrier();
+      return 0;
+    }
+    uint8_t *ptr = GetCPUAddr(offs, size);
+    if (!ptr) {
       SET_ERR("Memory must be mapped before starting synchronization");
       return EINVAL;
     }
-    uint8_t *end = map_ptr_ + offs + size;
-#ifdef __aarch64__
-    if (flags & DMP_DV_MEM_CPU_WONT_READ) {
-      for (uint8_t *addr = (uint8_t*)((((size_t)(map_ptr_ + offs)) >> CACHE_LINE_LOG2) << CACHE_LINE_LOG2);
-           addr < end; addr += CACHE_LINE_SIZE) {
-        asm("DC CIVAC, %0" /* Write changes to RAM and Invalidate cache */
-            : /* No outputs */
-            : "r" (addr));
-      }
+    TakeDirty(offs, size, NULL);
+    return CDMPDVCacheEngine::ToDevice(fd_mem_, ptr, size, real_size_,
+                                       (flags & DMP_DV_MEM_CPU_WONT_READ) != 0, !sync_flags_);
+  }
+
+  int ToCPU(size_t offs, size_t size, int flags) {
+    if (flags & DMP_DV_MEM_CPU_HADNT_READ) {
+      return 0;
+    }
+    if (offs + size > real_size_) {
+      SET_ERR("Invalid memory range specified: offs=%zu size=%zu while memory buffer size is %zu",
+              offs, size, real_size_);
+      return EINVAL;
+    }
+    if (parent_) {
+      return parent_->ToCPU(parent_offs_ + offs, size, flags);
+    }
+    if ((!size) || (cache_mode_ != DMP_DV_MEM_CACHED)) {
+      return 0;
+    }
+    CDMPDVMemStatsTimer timer(DMP_DV_MEM_OP_TO_CPU);  // after the delegation, so regions are recorded once
+    uint8_t *ptr = GetCPUAddr(offs, size);
+    if (!ptr) {
+      SET_ERR("Memory must be mapped before starting synchronization");
+      return EINVAL;
+    }
+    return CDMPDVCacheEngine::ToCPU(fd_mem_, ptr, size, real_size_, !sync_flags_);
+  }
+
+  /// @brief Reads file contents directly to the memory range making it visible to the device.
+  /// @param flags 0 or DMP_DV_MEM_LOAD_DIRECT.
+  /// @return 0 on success, non-zero otherwise.
+  /// @details The file is read in chunks to the mapped memory (the range is temporarily mapped when it is not),
+  ///          readahead of the next chunk is started before CPU caches for the current one are written back,
+  ///          and the page cache for the read chunk is dropped, so the file contents are held in RAM only once.
+  ///          With DMP_DV_MEM_LOAD_DIRECT the page cache is bypassed when the kernel supports O_DIRECT reads
+  ///          to the mapping, otherwise it falls back to the buffered reads.
+  int LoadFile(size_t offs, const char *path, uint64_t file_offs, size_t size, int flags) {
+    static const size_t chunk_size = 4 << 20;
+    static const size_t direct_align = 4096;
+
+    if (offs + size > real_size_) {
+      SET_ERR("Invalid memory range specified: offs=%zu size=%zu while memory buffer size is %zu",
+              offs, size, real_size_);
+      return EINVAL;
+    }
+    if (parent_) {
+      return parent_->LoadFile(parent_offs_ + offs, path, file_offs, size, flags);
+    }
+    if (!size) {
+      return 0;
     }
-    else {
-      for (uint8_t *addr = (uint8_t*)((((size_t)(map_ptr_ + offs)) >> CACHE_LINE_LOG2) << CACHE_LINE_LOG2);
-           addr < end; addr += CACHE_LINE_SIZE) {
-        asm("DC CVAC, %0" /* Write changes to RAM and Leave data in cache */
-            : /* No outputs */
-            : "r" (addr));
+
+    uint8_t *window = NULL;
+    uint8_t *ptr = GetOrMapCPUAddr(offs, size, 0, &window);
+    if (!ptr) {
+      return ENOMEM;
+    }
+
+    // O_DIRECT requires aligned destination address and file offset, fallback to the page cache otherwise
+    bool direct = (flags & DMP_DV_MEM_LOAD_DIRECT) &&
+                  (!((size_t)ptr % direct_align)) && (!(file_offs % direct_align));
+    int fd = direct ? open(path, O_RDONLY | O_CLOEXEC | O_DIRECT) : -1;
+    if (fd == -1) {
+      direct = false;
+      fd = open(path, O_RDONLY | O_CLOEXEC);
+    }
+    int result = 0;
+    if (fd == -1) {
+      result = errno;
+      SET_ERR_CODE(result, "open() failed for %s: %s", path, strerror(result));
+    }
+    else if (!direct) {
+      posix_fadvise(fd, file_offs, size, POSIX_FADV_SEQUENTIAL);
+      posix_fadvise(fd, file_offs, std::min(chunk_size, size), POSIX_FADV_WILLNEED);
+    }
+
+    for (size_t pos = 0; (!result) && (pos < size);) {
+      const size_t n = std::min(chunk_size, size - pos);
+      if ((direct) && (n % direct_align)) {  // unaligned tail
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_DIRECT);
+        direct = false;
+      }
+      size_t n_read = 0;
+      while (n_read < n) {
+        ssize_t res = pread(fd, ptr + pos + n_read, n - n_read, file_offs + pos + n_read);
+        if (res > 0) {
+          n_read += res;
+          continue;
+        }
+        if ((res < 0) && (errno == EINTR)) {
+          continue;
+        }
+        if ((res < 0) && (direct) && ((errno == EFAULT) || (errno == EINVAL))) {
+          // ION mapping can not be pinned for O_DIRECT (VM_PFNMAP), continue through the page cache
+          fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_DIRECT);
+          direct = false;
+          posix_fadvise(fd, file_offs + pos + n_read, size - pos - n_read, POSIX_FADV_SEQUENTIAL);
+          continue;
+        }
+        result = res < 0 ? errno : EIO;
+        if (res < 0) {
+          SET_ERR_CODE(result, "pread() failed for %s at offset %llu: %s",
+                               path, (unsigned long long)(file_offs + pos + n_read), strerror(result));
+        }
+        else {
+          SET_ERR_CODE(EIO, "Unexpected end of file %s at offset %llu while loading %zu bytes from offset %llu",
+                            path, (unsigned long long)(file_offs + pos + n_read), size, (unsigned long long)file_offs);
+        }
+        break;
       }
+      if (result) {
+        break;
+      }
+      if (!direct) {
+        posix_fadvise(fd, file_offs + pos, n, POSIX_FADV_DONTNEED);
+        if (pos + n < size) {
+          posix_fadvise(fd, file_offs + pos + n, std::min(chunk_size, size - pos - n), POSIX_FADV_WILLNEED);
+        }
+      }
+      MarkDirty(offs + pos, n);
+      result = ToDevice(offs + pos, n, DMP_DV_MEM_CPU_WONT_READ);
+      pos += n;
     }
-    asm("DSB SY");  // data sync barrier
-#else
-    __builtin___clear_cache(map_ptr_ + offs, end);
-#endif
-    return 0;
+
+    if (fd != -1) {
+      close(fd);
+    }
+    if (window) {
+      UnmapEx(window);
+    }
+    return result;
   }
 
-  int ToCPU(size_t offs, size_t size, int flags) {
-    if (flags & DMP_DV_MEM_CPU_HADNT_READ) {
+  /// @brief Copies data from another memory range making it visible to the device.
+  /// @param offs Offset of the destination range in this memory.
+  /// @param src Source memory, the source range must be visible to CPU and must not overlap with the destination.
+  /// @param flags 0 or DMP_DV_MEM_CPU_WONT_READ.
+  /// @return 0 on success, non-zero otherwise.
+  int CopyFrom(size_t offs, CDMPDVMem *src, size_t src_offs, size_t size, int flags) {
+    if ((offs + size > real_size_) || (src_offs + size > src->real_size_)) {
+      SET_ERR("Invalid memory range specified: offs=%zu src_offs=%zu size=%zu while memory buffer sizes are %zu and %zu",
+              offs, src_offs, size, real_size_, src->real_size_);
+      return EINVAL;
+    }
+    if (parent_) {
+      return parent_->CopyFrom(parent_offs_ + offs, src, src_offs, size, flags);
+    }
+    if (src->parent_) {
+      return CopyFrom(offs, src->parent_, src->parent_offs_ + src_offs, size, flags);
+    }
+    if (!size) {
       return 0;
     }
+    if ((src == this) && (src_offs < offs + size) && (offs < src_offs + size)) {
+      SET_ERR("Invalid memory range specified: source range [%zu, %zu) overlaps with destination range [%zu, %zu)",
+              src_offs, src_offs + size, offs, offs + size);
+      return EINVAL;
+    }
+
+    uint8_t *src_window = NULL, *window = NULL;
+    uint8_t *src_ptr = src->GetOrMapCPUAddr(src_offs, size, DMP_DV_MEM_MAP_READ_ONLY, &src_window);
+    uint8_t *ptr = src_ptr ? GetOrMapCPUAddr(offs, size, 0, &window) : NULL;
+    if (ptr) {
+      TakeDirty(offs, size, NULL);
+      CDMPDVCacheEngine::CopyToDevice(ptr, src_ptr, size, cache_mode_ == DMP_DV_MEM_CACHED,
+                                      (flags & DMP_DV_MEM_CPU_WONT_READ) != 0);
+    }
+    if (window) {
+      UnmapEx(window);
+    }
+    if (src_window) {
+      src->UnmapEx(src_window);
+    }
+    return ptr ? 0 : ENOMEM;
+  }
+
+  /// @brief Fills memory range with the byte value making it visible to the device.
+  /// @param flags 0 or DMP_DV_MEM_CPU_WONT_READ.
+  /// @return 0 on success, non-zero otherwise.
+  int Fill(size_t offs, uint8_t value, size_t size, int flags) {
     if (offs + size > real_size_) {
       SET_ERR("Invalid memory range specified: offs=%zu size=%zu while memory buffer size is %zu",
               offs, size, real_size_);
       return EINVAL;
     }
+    if (parent_) {
+      return parent_->Fill(parent_offs_ + offs, value, size, flags);
+    }
     if (!size) {
       return 0;
     }
-    if (!map_ptr_) {
+    uint8_t *window = NULL;
+    uint8_t *ptr = GetOrMapCPUAddr(offs, size, 0, &window);
+    if (!ptr) {
+      return ENOMEM;
+    }
+    TakeDirty(offs, size, NULL);
+    CDMPDVCacheEngine::FillToDevice(ptr, value, size, cache_mode_ == DMP_DV_MEM_CACHED,
+                                    (flags & DMP_DV_MEM_CPU_WONT_READ) != 0);
+    if (window) {
+      UnmapEx(window);
+    }
+    return 0;
+  }
+
+  /// @brief Fills the cache maintenance range for the batched synchronization.
+  /// @param to_device Prepare the range for device access when true, for CPU access otherwise.
+  /// @param flags Flags as for ToDevice() or ToCPU().
+  /// @param range Range to be filled, fd will be set to -1 when no maintenance is required.
+  /// @param allow_unmapped When the range is not mapped, fill the range for DMA_BUF_IOCTL_SYNC
+  ///                       over the whole buffer (start and end are set to NULL) instead of returning the error.
+  /// @return 0 on success, non-zero otherwise.
+  int GetCacheRange(size_t offs, size_t size, bool to_device, int flags, DMPDVCacheRange *range,
+                    bool allow_unmapped = false) {
+    memset(range, 0, sizeof(*range));
+    range->fd = -1;
+    if (offs + size > real_size_) {
+      SET_ERR("Invalid memory range specified: offs=%zu size=%zu while memory buffer size is %zu",
+              offs, size, real_size_);
+      return EINVAL;
+    }
+    if (parent_) {
+      return parent_->GetCacheRange(parent_offs_ + offs, size, to_device, flags, range, allow_unmapped);
+    }
+    if ((!size) || ((!to_device) && ((flags & DMP_DV_MEM_CPU_HADNT_READ) || (cache_mode_ != DMP_DV_MEM_CACHED)))) {
+      return 0;
+    }
+    if (cache_mode_ != DMP_DV_MEM_CACHED) {
+      range->fd = fd_mem_;
+      range->barrier_only = true;
+      return 0;
+    }
+    uint8_t *ptr = GetCPUAddr(offs, size);
+    if ((!ptr) && (!allow_unmapped)) {
       SET_ERR("Memory must be mapped before starting synchronization");
       return EINVAL;
     }
-    uint8_t *end = map_ptr_ + offs + size;
-#ifdef __aarch64__
-    for (uint8_t *addr = (uint8_t*)((((size_t)(map_ptr_ + offs)) >> CACHE_LINE_LOG2) << CACHE_LINE_LOG2);
-         addr < end; addr += CACHE_LINE_SIZE) {
-      asm("DC CIVAC, %0"
-          : /* No outputs. */
-          : "r" (addr));
-    }
-    asm("DSB SY");  // data sync barrier
-#else
-    __builtin___clear_cache(map_ptr_ + offs, end);
-#endif
+    if ((!ptr) && (sync_flags_)) {
+      return 0;  // CPU access is managed by the user with SyncStart()/SyncEnd()
+    }
+    range->fd = fd_mem_;
+    range->start = ptr;
+    range->end = ptr ? ptr + size : NULL;
+    range->buf_size = real_size_;
+    range->invalidate = to_device ? (flags & DMP_DV_MEM_CPU_WONT_READ) != 0 : true;
+    range->dma_buf_flags = sync_flags_ ? 0 : to_device ? DMA_BUF_SYNC_WRITE : DMA_BUF_SYNC_READ;
     return 0;
   }
 
  private:
+  /// @brief Invalidates CPU caches for the newly mapped range of the memory marked with MarkStale().
+  int InvalidateMapped(uint8_t *ptr, size_t size) {
+    return CDMPDVCacheEngine::ToCPU(fd_mem_, ptr, size, real_size_, true);
+  }
+
   /// @brief Pointer to dv context.
   CDMPDVContext *ctx_;
 
+  /// @brief Memory which owns the file descriptor and the mapping when this object is a region of it, NULL otherwise.
+  CDMPDVMem *parent_;
+
+  /// @brief Offset of this region within the parent memory.
+  size_t parent_offs_;
+
   /// @brief File handle for allocated memory.
   int fd_mem_;
 
@@ -275,12 +913,36 @@ class CDMPDVMem : public CDMPDVBase {
   /// @brief Real size of allocated memory.
   size_t real_size_;
 
+  /// @brief Size class in the context memory pool, 0 when the memory is not pooled.
+  size_t pool_class_size_;
+
+  /// @brief File descriptor was imported with InitializeImport() and is not accounted in total_size_.
+  bool imported_;
+
+  /// @brief Caching mode: DMP_DV_MEM_CACHED, DMP_DV_MEM_UNCACHED or DMP_DV_MEM_WRITE_COMBINED.
+  int cache_mode_;
+
   /// @brief Mapped memory pointer.
   uint8_t *map_ptr_;
 
   /// @brief Last used DMA synchronization flags.
   int sync_flags_;
 
+  /// @brief Non-zero when CPU caches must be invalidated on the next mapping, see MarkStale().
+  int stale_;
+
+  /// @brief Windows mapped with MapEx().
+  std::vector<DMPDVMemWindow> windows_;
+
+  /// @brief Mutex for protecting windows_.
+  std::mutex windows_mutex_;
+
+  /// @brief Sorted non-overlapping [start, end) ranges written by CPU and not yet flushed.
+  std::vector<std::pair<size_t, size_t> > dirty_;
+
+  /// @brief Mutex for protecting dirty_.
+  std::mutex dirty_mutex_;
+
   /// @brief Total per-process allocated device-accessible memory size in bytes.
   static int64_t total_size_;
 };
@@ -0,0 +1,222 @@
+/*
+ *  Copyright 2018 Digital Media Professionals Inc.
+
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+
+ *      http://www.apache.org/licenses/LICENSE-2.0
+
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+/// @file
+/// @brief Pool of device-accessible memory allocations.
+#pragma once
+
+#include "common.h"
+
+#include <vector>
+#include <mutex>
+#include <algorithm>
+
+
+/// @brief Smallest size class of the pool (one page).
+#define DMP_DV_MEM_POOL_MIN_CLASS_LOG2 12
+
+/// @brief Largest size class of the pool, bigger allocations always go directly to ION.
+#define DMP_DV_MEM_POOL_MAX_CLASS_LOG2 26
+
+/// @brief Number of size classes per power of two.
+#define DMP_DV_MEM_POOL_CLASSES_PER_LOG2 4
+
+/// @brief Number of kinds of allocations which are cached separately (with and without ION_FLAG_CACHED).
+#define DMP_DV_MEM_POOL_N_KINDS 2
+
+/// @brief Total number of size classes.
+#define DMP_DV_MEM_POOL_N_CLASSES \
+  ((DMP_DV_MEM_POOL_MAX_CLASS_LOG2 - DMP_DV_MEM_POOL_MIN_CLASS_LOG2) * DMP_DV_MEM_POOL_CLASSES_PER_LOG2 + 1)
+
+
+/// @brief Pool of ION file descriptors grouped by size classes.
+/// @details Size classes are spaced by 1/4 of the power of two (but not less than a page),
+///          so the memory overhead of the rounding is limited to 25%.
+///          The pool is disabled until the capacity is set to non-zero value.
+class CDMPDVMemPool {
+ public:
+  /// @brief Constructor.
+  CDMPDVMemPool() {
+    max_cached_bytes_ = 0;
+    cached_bytes_ = 0;
+    n_cached_ = 0;
+    hits_ = 0;
+    misses_ = 0;
+  }
+
+  /// @brief Destructor, closes all cached file descriptors.
+  ~CDMPDVMemPool() {
+    Trim(0);
+  }
+
+  /// @brief Returns size class for the specified allocation size or 0 if the pool is disabled or the size is too big.
+  size_t GetClassSize(size_t size) {
+    if (!__sync_add_and_fetch(&max_cached_bytes_, 0)) {
+      return 0;
+    }
+    const size_t min_size = (size_t)1 << DMP_DV_MEM_POOL_MIN_CLASS_LOG2;
+    if (size <= min_size) {
+      return min_size;
+    }
+    if (size > ((size_t)1 << DMP_DV_MEM_POOL_MAX_CLASS_LOG2)) {
+      return 0;
+    }
+    const size_t base = (size_t)1 << GetLog2(size);
+    if (size == base) {
+      return size;
+    }
+    const size_t step = GetClassStep(base);
+    return (size + step - 1) / step * step;
+  }
+
+  /// @brief Takes cached file descriptor of the specified size class from the pool.
+  /// @param kind Kind of the allocation in [0, DMP_DV_MEM_POOL_N_KINDS) range.
+  /// @return File descriptor or -1 if the pool has no cached allocations of this size class.
+  int Acquire(size_t class_size, int kind) {
+    const int i_class = GetClassIndex(class_size);
+    if (i_class < 0) {
+      return -1;
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::vector<int>& free_list = free_lists_[kind][i_class];
+    if (free_list.empty()) {
+      ++misses_;
+      return -1;
+    }
+    int fd = free_list.back();
+    free_list.pop_back();
+    cached_bytes_ -= class_size;
+    --n_cached_;
+    ++hits_;
+    return fd;
+  }
+
+  /// @brief Returns file descriptor of the specified size class to the pool.
+  /// @param kind Kind of the allocation in [0, DMP_DV_MEM_POOL_N_KINDS) range.
+  /// @return true if the file descriptor was cached, false if the caller must close it.
+  bool Put(int fd, size_t class_size, int kind) {
+    const int i_class = GetClassIndex(class_size);
+    if (i_class < 0) {
+      return false;
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (cached_bytes_ + class_size > max_cached_bytes_) {
+      return false;
+    }
+    free_lists_[kind][i_class].push_back(fd);
+    cached_bytes_ += class_size;
+    ++n_cached_;
+    return true;
+  }
+
+  /// @brief Sets the maximum total size of cached allocations, 0 disables the pool.
+  void SetMaxCachedBytes(size_t max_cached_bytes) {
+    __sync_lock_test_and_set(&max_cached_bytes_, max_cached_bytes);
+    Trim(max_cached_bytes);
+  }
+
+  /// @brief Closes cached file descriptors starting from the largest size class
+  ///        until the total size of cached allocations becomes less or equal to keep_bytes.
+  void Trim(size_t keep_bytes) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (int i_class = DMP_DV_MEM_POOL_N_CLASSES - 1; (i_class >= 0) && (cached_bytes_ > keep_bytes); --i_class) {
+      const size_t class_size = GetSizeOfClass(i_class);
+      for (int kind = 0; kind < DMP_DV_MEM_POOL_N_KINDS; ++kind) {
+        std::vector<int>& free_list = free_lists_[kind][i_class];
+        while ((!free_list.empty()) && (cached_bytes_ > keep_bytes)) {
+          close(free_list.back());
+          free_list.pop_back();
+          cached_bytes_ -= class_size;
+          --n_cached_;
+        }
+      }
+    }
+  }
+
+  /// @brief Returns current total size of cached allocations in bytes.
+  size_t GetCachedBytes() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return cached_bytes_;
+  }
+
+  /// @brief Fills pool statistics.
+  void GetStats(struct dmp_dv_mem_pool_stats *stats) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stats->hits = hits_;
+    stats->misses = misses_;
+    stats->n_cached = n_cached_;
+    stats->cached_bytes = cached_bytes_;
+    stats->max_cached_bytes = max_cached_bytes_;
+  }
+
+ private:
+  /// @brief Returns index of the size class or -1 if the size is not a valid size class.
+  static int GetClassIndex(size_t class_size) {
+    const int log2 = GetLog2(class_size);
+    if ((log2 < DMP_DV_MEM_POOL_MIN_CLASS_LOG2) || (log2 > DMP_DV_MEM_POOL_MAX_CLASS_LOG2)) {
+      return -1;
+    }
+    const size_t base = (size_t)1 << log2;
+    const size_t step = GetClassStep(base);
+    if ((class_size - base) % step) {
+      return -1;
+    }
+    const int i_class = (log2 - DMP_DV_MEM_POOL_MIN_CLASS_LOG2) * DMP_DV_MEM_POOL_CLASSES_PER_LOG2 +
+                        (int)((class_size - base) / step);
+    return i_class < DMP_DV_MEM_POOL_N_CLASSES ? i_class : -1;
+  }
+
+  /// @brief Returns size in bytes of the size class with the given index.
+  /// @details Indices which are skipped because of the page granularity map to sizes which are never cached.
+  static size_t GetSizeOfClass(int i_class) {
+    const size_t base = (size_t)1 << (DMP_DV_MEM_POOL_MIN_CLASS_LOG2 + i_class / DMP_DV_MEM_POOL_CLASSES_PER_LOG2);
+    return base + GetClassStep(base) * (i_class % DMP_DV_MEM_POOL_CLASSES_PER_LOG2);
+  }
+
+  /// @brief Returns distance between size classes within [base, 2 * base) range.
+  static inline size_t GetClassStep(size_t base) {
+    return std::max(base / DMP_DV_MEM_POOL_CLASSES_PER_LOG2, (size_t)1 << DMP_DV_MEM_POOL_MIN_CLASS_LOG2);
+  }
+
+  /// @brief Returns floor(log2(n)) for n > 0.
+  static inline int GetLog2(size_t n) {
+    int log2 = 0;
+    for (; n > 1; n >>= 1) {
+      ++log2;
+    }
+    return log2;
+  }
+
+  /// @brief Maximum total size of cached allocations in bytes, 0 means the pool is disabled.
+  size_t max_cached_bytes_;
+
+  /// @brief Current total size of cached allocations in bytes.
+  size_t cached_bytes_;
+
+  /// @brief Current number of cached allocations.
+  uint64_t n_cached_;
+
+  /// @brief Number of allocations served from the pool.
+  uint64_t hits_;
+
+  /// @brief Number of allocations of poolable size which were not found in the pool.
+  uint64_t misses_;
+
+  /// @brief Free lists of cached file descriptors for each kind and size class.
+  std::vector<int> free_lists_[DMP_DV_MEM_POOL_N_KINDS][DMP_DV_MEM_POOL_N_CLASSES];
+
+  /// @brief Mutex for protecting free lists and counters.
+  std::mutex mutex_;
+};
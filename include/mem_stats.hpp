@@ -0,0 +1,138 @@
+/*
+ *  Copyright 2018 Digital Media Professionals Inc.
+
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+
+ *      http://www.apache.org/licenses/LICENSE-2.0
+
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+/// @file
+/// @brief Per-process instrumentation of the memory layer.
+#pragma once
+
+#include "common.h"
+
+#include <time.h>
+
+
+/// @brief Per-process counters of memory operations.
+/// @details Counters are updated with atomics only when the collection is enabled,
+///          otherwise the cost is a single relaxed load per operation.
+class CDMPDVMemStats {
+ public:
+  /// @brief Returns true if the collection is enabled.
+  static inline bool IsEnabled() {
+    return __atomic_load_n(&enabled_, __ATOMIC_RELAXED) != 0;
+  }
+
+  /// @brief Enables or disables the collection.
+  static void Enable(bool enable) {
+    __atomic_store_n(&enabled_, enable ? 1 : 0, __ATOMIC_RELAXED);
+  }
+
+  /// @brief Returns monotonic time in nanoseconds.
+  static inline uint64_t GetNs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+  }
+
+  /// @brief Records operation with the specified latency.
+  static void Record(int op, uint64_t dt_ns) {
+    int i_bin = 0;
+    for (uint64_t n = dt_ns; (n > 1) && (i_bin < DMP_DV_MEM_STATS_N_BINS - 1); n >>= 1) {
+      ++i_bin;
+    }
+    __sync_add_and_fetch(&stats_.n_calls[op], 1);
+    __sync_add_and_fetch(&stats_.total_ns[op], dt_ns);
+    __sync_add_and_fetch(&stats_.latency_histogram[op][i_bin], 1);
+  }
+
+  /// @brief Records bytes processed by the CPU cache maintenance.
+  static inline void RecordBytes(uint64_t bytes, bool invalidated) {
+    if (!IsEnabled()) {
+      return;
+    }
+    __sync_add_and_fetch(&stats_.bytes_cleaned, bytes);
+    if (invalidated) {
+      __sync_add_and_fetch(&stats_.bytes_invalidated, bytes);
+    }
+  }
+
+  /// @brief Fills the counters.
+  static void GetStats(struct dmp_dv_mem_stats *stats) {
+    uint64_t *dst = (uint64_t*)stats;
+    uint64_t *src = (uint64_t*)&stats_;
+    for (size_t i = 0; i < sizeof(stats_) / sizeof(uint64_t); ++i) {
+      dst[i] = __atomic_load_n(&src[i], __ATOMIC_RELAXED);
+    }
+  }
+
+  /// @brief Resets the counters.
+  static void Reset() {
+    uint64_t *dst = (uint64_t*)&stats_;
+    for (size_t i = 0; i < sizeof(stats_) / sizeof(uint64_t); ++i) {
+      __atomic_store_n(&dst[i], 0, __ATOMIC_RELAXED);
+    }
+  }
+
+ private:
+  /// @brief Non-zero when the collection is enabled.
+  static int enabled_;
+
+  /// @brief Counters.
+  static struct dmp_dv_mem_stats stats_;
+};
+
+
+/// @brief Records latency of the operation from construction to destruction when the collection is enabled.
+class CDMPDVMemStatsTimer {
+ public:
+  /// @brief Constructor.
+  explicit CDMPDVMemStatsTimer(int op) {
+    op_ = op;
+    t0_ = CDMPDVMemStats::IsEnabled() ? CDMPDVMemStats::GetNs() : 0;
+  }
+
+  /// @brief Destructor.
+  ~CDMPDVMemStatsTimer() {
+    if (t0_) {
+      CDMPDVMemStats::Record(op_, CDMPDVMemStats::GetNs() - t0_);
+    }
+  }
+
+ private:
+  /// @brief Operation, one of DMP_DV_MEM_OP_*.
+  int op_;
+
+  /// @brief Start time in nanoseconds, 0 when the collection is disabled.
+  uint64_t t0_;
+};
+
+
+/// @brief mmap() with latency recording.
+static inline void *TimedMmap(void *addr, size_t length, int prot, int flags, int fd, off_t offs) {
+  CDMPDVMemStatsTimer timer(DMP_DV_MEM_OP_MMAP);
+  return mmap(addr, length, prot, flags, fd, offs);
+}
+
+
+/// @brief munmap() with latency recording.
+static inline int TimedMunmap(void *addr, size_t length) {
+  CDMPDVMemStatsTimer timer(DMP_DV_MEM_OP_MUNMAP);
+  return munmap(addr, length);
+}
+
+
+/// @brief ioctl(DMA_BUF_IOCTL_SYNC) with latency recording.
+static inline int TimedDmaBufSync(int fd, struct dma_buf_sync *sync_args) {
+  CDMPDVMemStatsTimer timer(DMP_DV_MEM_OP_DMA_BUF_SYNC);
+  return ioctl(fd, DMA_BUF_IOCTL_SYNC, sync_args);
+}
@@ -0,0 +1,116 @@
+/*
+ *  Copyright 2018 Digital Media Professionals Inc.
+
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+
+ *      http://www.apache.org/licenses/LICENSE-2.0
+
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+/// @file
+/// @brief Accounting of device-accessible memory allocated within the context.
+#pragma once
+
+#include "common.h"
+
+#include <mutex>
+
+
+/// @brief Counters of device-accessible memory allocated within the context with optional budget.
+/// @details Budget is checked against the sum of live bytes and bytes cached by the context memory pool,
+///          as both are held from CMA.
+class CDMPDVMemUsage {
+ public:
+  /// @brief Constructor.
+  CDMPDVMemUsage() {
+    memset(&usage_, 0, sizeof(usage_));
+  }
+
+  /// @brief Adds bytes to the live counter if the budget allows.
+  /// @param bytes Number of bytes to be allocated.
+  /// @param pool_bytes Number of bytes currently cached by the context memory pool.
+  /// @return true on success, false if the budget would be exceeded.
+  bool TryReserve(size_t bytes, size_t pool_bytes) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if ((usage_.budget_bytes) && (usage_.live_bytes + pool_bytes + bytes > usage_.budget_bytes)) {
+      return false;
+    }
+    AddLocked(bytes);
+    return true;
+  }
+
+  /// @brief Adds bytes to the live counter ignoring the budget (e.g. when the allocation is taken from the pool).
+  void Reserve(size_t bytes) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    AddLocked(bytes);
+  }
+
+  /// @brief Removes bytes from the live counter.
+  void Unreserve(size_t bytes) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    usage_.live_bytes -= bytes;
+  }
+
+  /// @brief Counts successful allocation of the specified size.
+  void CountAllocation(size_t size) {
+    int i_bin = 0;
+    for (size_t n = size; (n > 1) && (i_bin < DMP_DV_MEM_USAGE_N_BINS - 1); n >>= 1) {
+      ++i_bin;
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    ++usage_.n_allocs;
+    ++usage_.n_live;
+    ++usage_.histogram[i_bin];
+  }
+
+  /// @brief Counts release of the allocation.
+  void CountRelease() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    --usage_.n_live;
+  }
+
+  /// @brief Counts allocation which was rejected because of the budget.
+  void CountBudgetFailure() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    ++usage_.n_budget_failures;
+  }
+
+  /// @brief Sets the budget in bytes, 0 disables the budget.
+  void SetBudget(size_t budget_bytes) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    usage_.budget_bytes = budget_bytes;
+  }
+
+  /// @brief Resets the high-water mark to the current live bytes.
+  void ResetPeak() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    usage_.peak_bytes = usage_.live_bytes;
+  }
+
+  /// @brief Fills usage counters.
+  void GetUsage(struct dmp_dv_mem_usage *usage) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    *usage = usage_;
+  }
+
+ private:
+  /// @brief Adds bytes to the live counter updating the high-water mark, mutex_ must be locked.
+  inline void AddLocked(size_t bytes) {
+    usage_.live_bytes += bytes;
+    if (usage_.live_bytes > usage_.peak_bytes) {
+      usage_.peak_bytes = usage_.live_bytes;
+    }
+  }
+
+  /// @brief Current counters.
+  struct dmp_dv_mem_usage usage_;
+
+  /// @brief Mutex for protecting usage_.
+  std::mutex mutex_;
+};
@@ -0,0 +1,415 @@
+/*
+ *  Copyright 2018 Digital Media Professionals Inc.
+
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+
+ *      http://www.apache.org/licenses/LICENSE-2.0
+
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+/// @file
+/// @brief Thread waiting on the scheduled executions of the context.
+#pragma once
+
+#include "context.hpp"
+#include "cmdlist.hpp"
+
+#include <sys/eventfd.h>
+
+#include <deque>
+#include <chrono>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+
+
+/// @brief Execution tracked by the reaper.
+struct DMPDVReaperEntry {
+  CDMPDVCmdList *cmdlist;  // command list, one reference is held while the entry is pending
+  int64_t exec_id;         // execution id to wait for
+  dmp_dv_exec_callback callback;  // callback to invoke on completion, NULL if none
+  void *user_data;                // user data for the callback
+};
+
+
+/// @brief Waits on the tracked executions of the context in submission order from its own thread.
+/// @details The kernel module waits on a single execution id per call,
+///          so the executions of any number of command lists are waited on by one thread per context,
+///          each completion invokes the callback of the execution if any and is signaled on the process-wide condition.
+///          The thread holds a reference on the reaper, so it may release the last reference on the context.
+class CDMPDVReaper : public CDMPDVBase {
+ public:
+  /// @brief Constructor.
+  CDMPDVReaper() : CDMPDVBase() {
+    stop_ = false;
+    event_fd_ = -1;
+  }
+
+  /// @brief Destructor.
+  virtual ~CDMPDVReaper() {
+    for (auto it = pending_.rbegin(); it != pending_.rend(); ++it) {
+      it->cmdlist->Release();
+    }
+    pending_.clear();
+    if (event_fd_ != -1) {
+      close(event_fd_);
+      event_fd_ = -1;
+    }
+  }
+
+  /// @brief Returns eventfd incremented on every completion, creates it on the first call.
+  /// @return File descriptor owned by the reaper or -1 on error.
+  int GetEventFd() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (event_fd_ == -1) {
+      event_fd_ = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+      if (event_fd_ == -1) {
+        SET_ERR_CODE(errno, "eventfd() failed: %s", strerror(errno));
+      }
+    }
+    return event_fd_;
+  }
+
+  /// @brief Starts the thread if it is not running yet.
+  /// @return 0 on success, non-zero on error.
+  int Start() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return StartLocked();
+  }
+
+  /// @brief Adds the execution to be waited on.
+  /// @param callback Callback to invoke on completion, when NULL executions covered by the already tracked ones are skipped.
+  /// @return 0 on success, non-zero on error.
+  int Track(CDMPDVCmdList *cmdlist, int64_t exec_id, dmp_dv_exec_callback callback = NULL, void *user_data = NULL) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    int res = StartLocked();
+    if (res) {
+      return res;
+    }
+    if ((!cmdlist->MarkTracked(exec_id)) && (!callback)) {
+      return 0;
+    }
+    DMPDVReaperEntry entry;
+    entry.cmdlist = cmdlist;
+    entry.exec_id = exec_id;
+    entry.callback = callback;
+    entry.user_data = user_data;
+    cmdlist->Retain();
+    pending_.push_back(entry);
+    cond_.notify_all();
+    return 0;
+  }
+
+  /// @brief Stops the thread after it has waited on the tracked executions.
+  /// @details When called from the thread itself (it has released the last reference on the context),
+  ///          the thread is detached and exits on its own.
+  void Stop() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stop_ = true;
+    }
+    cond_.notify_all();
+    if (!thread_.joinable()) {
+      return;
+    }
+    if (thread_.get_id() == std::this_thread::get_id()) {
+      thread_.detach();
+    }
+    else {
+      thread_.join();
+    }
+  }
+
+  /// @brief Waits for all executions.
+  /// @return 0 if all executions have succeeded, otherwise the error of the first failed one.
+  static int WaitAll(struct dmp_dv_wait_entry *entries, int n) {
+    int res = ValidateEntries(entries, n);
+    if (res) {
+      return res;
+    }
+    int first_err = 0;
+    for (int i = 0; i < n; ++i) {
+      if (entries[i].exec_id < 0) {
+        continue;
+      }
+      entries[i].result = ((CDMPDVCmdList*)entries[i].cmdlist)->Wait(entries[i].exec_id);
+      first_err = first_err ? first_err : entries[i].result;
+    }
+    return first_err;
+  }
+
+  /// @brief Waits until any of the executions is completed.
+  /// @param index Filled with the index of the completed execution.
+  /// @param timeout_us Maximum time to wait in microseconds, negative to wait infinitely.
+  /// @return Result of the completed execution, ETIMEDOUT if none has completed within the timeout.
+  static int WaitAny(struct dmp_dv_wait_entry *entries, int n, int *index, int64_t timeout_us) {
+    int res = ValidateEntries(entries, n);
+    if (res) {
+      return res;
+    }
+    int i_done = FindCompleted(entries, n);
+    if (i_done >= n) {
+      SET_ERR("Invalid argument: all entries have negative exec_id");
+      return EINVAL;
+    }
+    if (i_done < 0) {
+      for (int i = 0; i < n; ++i) {
+        if (entries[i].exec_id < 0) {
+          continue;
+        }
+        res = TrackEntry((CDMPDVCmdList*)entries[i].cmdlist, entries[i].exec_id);
+        if (res) {
+          return res;
+        }
+      }
+      auto completed = [entries, n, &i_done]{ return (i_done = FindCompleted(entries, n)) >= 0; };
+      std::unique_lock<std::mutex> lock(completion_mutex_);
+      if (timeout_us < 0) {
+        completion_cond_.wait(lock, completed);
+      }
+      else if (!completion_cond_.wait_for(lock, std::chrono::microseconds(timeout_us), completed)) {
+        SET_ERR_CODE(ETIMEDOUT, "None of %d executions has completed within %lld us", n, (long long)timeout_us);
+        return ETIMEDOUT;
+      }
+    }
+    entries[i_done].result = ((CDMPDVCmdList*)entries[i_done].cmdlist)->Wait(entries[i_done].exec_id);
+    if (index) {
+      *index = i_done;
+    }
+    return entries[i_done].result;
+  }
+
+  /// @brief Returns the result of the completed execution without blocking.
+  /// @return Result of the completed execution, EAGAIN if it has not completed yet.
+  /// @details The execution is passed to the reaper, so completion will be signaled on the context's eventfd.
+  static int Poll(CDMPDVCmdList *cmdlist, int64_t exec_id) {
+    int res = cmdlist->ValidateExecId(exec_id);
+    if (res) {
+      return res;
+    }
+    if (!cmdlist->IsCompleted(exec_id)) {
+      res = TrackEntry(cmdlist, exec_id);
+      if (res) {
+        return res;
+      }
+      if (!cmdlist->IsCompleted(exec_id)) {
+        SET_ERR_CODE(EAGAIN, "Execution %lld has not completed yet", (long long)exec_id);
+        return EAGAIN;
+      }
+    }
+    return cmdlist->TakeResult(exec_id);
+  }
+
+  /// @brief Schedules the command list for execution and invokes the callback on completion from the reaper thread.
+  /// @return >= 0 - execution id on sucess, < 0 on error.
+  /// @details When the scheduled execution could not be tracked, the callback is invoked from the calling thread
+  ///          after the execution has completed, so it is never lost.
+  static int64_t ExecAsync(CDMPDVCmdList *cmdlist, dmp_dv_exec_callback callback, void *user_data) {
+    CDMPDVReaper *reaper = cmdlist->get_ctx()->GetReaper();
+    if (!reaper) {
+      return -ENOMEM;
+    }
+
+    // Start the thread in advance, so the scheduled execution is always tracked
+    int res = reaper->Start();
+    if (res) {
+      return -res;
+    }
+    int64_t exec_id = cmdlist->Exec();
+    if (exec_id < 0) {
+      return exec_id;
+    }
+    res = reaper->Track(cmdlist, exec_id, callback, user_data);
+    if (res) {
+      // The execution is already scheduled, so it is waited on here and the callback still receives the error
+      int exec_res = cmdlist->Wait(exec_id);
+      (*callback)((dmp_dv_cmdlist)cmdlist, exec_id, exec_res ? exec_res : res, user_data);
+    }
+    return exec_id;
+  }
+
+ private:
+  /// @brief Starts the thread if it is not running yet, mutex_ must be locked.
+  int StartLocked() {
+    if (stop_) {
+      SET_ERR("Context is being destroyed");
+      return EINVAL;
+    }
+    if (thread_.joinable()) {
+      return 0;
+    }
+    Retain();
+    try {
+      thread_ = std::thread(&CDMPDVReaper::ThreadMain, this);
+    }
+    catch (...) {
+      Release();
+      SET_ERR_CODE(EAGAIN, "Failed to start the thread waiting on the scheduled executions");
+      return EAGAIN;
+    }
+    return 0;
+  }
+
+  /// @brief Passes the execution to the reaper of the command list's context.
+  static int TrackEntry(CDMPDVCmdList *cmdlist, int64_t exec_id) {
+    CDMPDVReaper *reaper = cmdlist->get_ctx()->GetReaper();
+    if (!reaper) {
+      return ENOMEM;
+    }
+    return reaper->Track(cmdlist, exec_id);
+  }
+
+  /// @brief Waits on the tracked executions in submission order.
+  void ThreadMain() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    for (;;) {
+      cond_.wait(lock, [this]{ return (stop_) || (!pending_.empty()); });
+      if (pending_.empty()) {
+        break;
+      }
+      DMPDVReaperEntry entry = pending_.front();
+      lock.unlock();
+
+      entry.cmdlist->Reap(entry.exec_id);
+      if (entry.callback) {
+        int res = entry.cmdlist->TakeResult(entry.exec_id);
+        (*entry.callback)((dmp_dv_cmdlist)entry.cmdlist, entry.exec_id, res, entry.user_data);
+      }
+      {
+        std::lock_guard<std::mutex> completion_lock(completion_mutex_);
+      }
+      completion_cond_.notify_all();
+
+      lock.lock();
+      pending_.pop_front();
+      if (event_fd_ != -1) {
+        uint64_t one = 1;
+        if (write(event_fd_, &one, sizeof(one)) < 0) {
+          // Fails only on counter overflow which keeps the descriptor readable
+        }
+      }
+      lock.unlock();
+      entry.cmdlist->Release();  // may release the last reference on the context which stops this thread
+      lock.lock();
+    }
+    lock.unlock();
+    Release();
+  }
+
+  /// @brief Checks the entries, all entries with negative exec_id are allowed.
+  static int ValidateEntries(struct dmp_dv_wait_entry *entries, int n) {
+    if ((!entries) || (n < 1)) {
+      SET_ERR("Invalid argument: entries=%p n=%d", entries, n);
+      return EINVAL;
+    }
+    for (int i = 0; i < n; ++i) {
+      if (entries[i].exec_id < 0) {
+        continue;
+      }
+      if (!entries[i].cmdlist) {
+        SET_ERR("Invalid argument: entries[%d].cmdlist is NULL", i);
+        return EINVAL;
+      }
+      int res = ((CDMPDVCmdList*)entries[i].cmdlist)->ValidateExecId(entries[i].exec_id);
+      if (res) {
+        return res;
+      }
+    }
+    return 0;
+  }
+
+  /// @brief Returns index of the first completed execution, n if all entries are skipped, -1 if none is completed.
+  static int FindCompleted(struct dmp_dv_wait_entry *entries, int n) {
+    bool found = false;
+    for (int i = 0; i < n; ++i) {
+      if (entries[i].exec_id < 0) {
+        continue;
+      }
+      found = true;
+      if (((CDMPDVCmdList*)entries[i].cmdlist)->IsCompleted(entries[i].exec_id)) {
+        return i;
+      }
+    }
+    return found ? -1 : n;
+  }
+
+  /// @brief Tracked executions in submission order, the front one is waited on by the thread.
+  std::deque<DMPDVReaperEntry> pending_;
+
+  /// @brief Request for the thread to exit when there are no tracked executions.
+  bool stop_;
+
+  /// @brief Eventfd incremented on every completion, -1 until GetEventFd() is called.
+  int event_fd_;
+
+  /// @brief Mutex for protecting pending_, stop_ and event_fd_.
+  std::mutex mutex_;
+
+  /// @brief Condition signaled on tracking and stop.
+  std::condition_variable cond_;
+
+  /// @brief Thread waiting on the tracked executions.
+  std::thread thread_;
+
+  /// @brief Mutex for completion_cond_.
+  static std::mutex completion_mutex_;
+
+  /// @brief Condition signaled on completion of any tracked execution in the process.
+  static std::condition_variable completion_cond_;
+};
+
+
+inline CDMPDVReaper *CDMPDVContext::GetReaper() {
+  std::lock_guard<std::mutex> lock(reaper_mutex_);
+  if (!reaper_) {
+    reaper_ = new CDMPDVReaper();
+    if (!reaper_) {
+      SET_ERR_CODE(ENOMEM, "Failed to allocate %zu bytes of memory", sizeof(CDMPDVReaper));
+    }
+  }
+  return reaper_;
+}
+
+
+inline int CDMPDVContext::GetCompletionFd() {
+  CDMPDVReaper *reaper = GetReaper();
+  if (!reaper) {
+    return -1;
+  }
+  int fd = reaper->GetEventFd();
+  if (fd != -1) {
+    __sync_lock_test_and_set(&track_execs_, 1);
+  }
+  return fd;
+}
+
+
+inline void CDMPDVContext::TrackExec(CDMPDVCmdList *cmdlist, int64_t exec_id) {
+  if (!__sync_add_and_fetch(&track_execs_, 0)) {
+    return;
+  }
+  CDMPDVReaper *reaper = GetReaper();
+  if (reaper) {
+    reaper->Track(cmdlist, exec_id);  // on failure the execution is tracked by the next poll
+  }
+}
+
+
+inline void CDMPDVContext::ReleaseReaper() {
+  CDMPDVReaper *reaper;
+  {
+    std::lock_guard<std::mutex> lock(reaper_mutex_);
+    reaper = reaper_;
+    reaper_ = NULL;
+  }
+  if (reaper) {
+    reaper->Stop();
+    reaper->Release();
+  }
+}
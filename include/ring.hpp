@@ -0,0 +1,223 @@
+/*
+ *  Copyright 2018 Digital Media Professionals Inc.
+
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+
+ *      http://www.apache.org/licenses/LICENSE-2.0
+
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+/// @file
+/// @brief dmp_dv_ring implementation.
+#pragma once
+
+#include "mem.hpp"
+#include "cmdlist.hpp"
+
+#include <vector>
+#include <mutex>
+
+
+/// @brief Slot of the ring.
+struct DMPDVRingSlot {
+  CDMPDVMem *mem;          // region of the ring memory
+  int state;               // one of DMP_DV_RING_SLOT_*
+  CDMPDVCmdList *cmdlist;  // command list which reads the slot when in-flight
+  int64_t exec_id;         // execution id of the command list which reads the slot when in-flight
+};
+
+/// @brief Slot states.
+#define DMP_DV_RING_SLOT_FREE 0
+#define DMP_DV_RING_SLOT_ACQUIRED 1
+#define DMP_DV_RING_SLOT_IN_FLIGHT 2
+
+
+/// @brief Implementation of dmp_dv_ring.
+/// @details Slots are regions of a single allocation and are handed out in round-robin order,
+///          slot becomes reusable when Wait() on the command list has succeeded for the committed execution id.
+class CDMPDVRing : public CDMPDVBase {
+ public:
+  /// @brief Constructor.
+  CDMPDVRing() : CDMPDVBase() {
+    mem_ = NULL;
+    slot_stride_ = 0;
+    next_ = 0;
+  }
+
+  /// @brief Destructor.
+  virtual ~CDMPDVRing() {
+    Cleanup();
+  }
+
+  /// @brief Allocates memory for the slots.
+  bool Initialize(CDMPDVContext *ctx, size_t slot_size, int n_slots) {
+    Cleanup();
+    if (!ctx) {
+      SET_ERR("Invalid argument: ctx is NULL");
+      return false;
+    }
+    if ((!slot_size) || (n_slots < 1)) {
+      SET_ERR("Invalid argument: slot_size=%zu n_slots=%d", slot_size, n_slots);
+      return false;
+    }
+
+    // Slots are page aligned, so they never share cache lines and can be mapped separately
+    const size_t page_size = (size_t)sysconf(_SC_PAGESIZE);
+    slot_stride_ = (slot_size + page_size - 1) / page_size * page_size;
+
+    mem_ = new CDMPDVMem();
+    if (!mem_) {
+      SET_ERR_CODE(ENOMEM, "Failed to allocate %zu bytes of memory", sizeof(CDMPDVMem));
+      return false;
+    }
+    if (!mem_->Initialize(ctx, slot_stride_ * n_slots)) {
+      return false;
+    }
+    slots_.resize(n_slots);
+    for (int i = 0; i < n_slots; ++i) {
+      DMPDVRingSlot& slot = slots_[i];
+      slot.state = DMP_DV_RING_SLOT_FREE;
+      slot.cmdlist = NULL;
+      slot.exec_id = -1;
+      slot.mem = new CDMPDVMem();
+      if (!slot.mem) {
+        SET_ERR_CODE(ENOMEM, "Failed to allocate %zu bytes of memory", sizeof(CDMPDVMem));
+        return false;
+      }
+      if (!slot.mem->InitializeChild(mem_, slot_stride_ * i, slot_size)) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  /// @brief Returns memory handle of the slot (owned by the ring) or NULL on error.
+  CDMPDVMem *GetSlot(int i_slot) {
+    if ((i_slot < 0) || (i_slot >= (int)slots_.size())) {
+      SET_ERR("Invalid argument: slot index %d is out of bounds [0, %d)", i_slot, (int)slots_.size());
+      return NULL;
+    }
+    return slots_[i_slot].mem;
+  }
+
+  /// @brief Returns number of slots.
+  inline int get_n_slots() const {
+    return (int)slots_.size();
+  }
+
+  /// @brief Takes the next slot for filling by CPU.
+  /// @param wait When true, waits for the device to finish reading the slot, otherwise returns -EAGAIN.
+  /// @return Slot index on success, negative errno on error.
+  int Acquire(bool wait) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (slots_.empty()) {
+      SET_ERR("Ring is not initialized");
+      return -EINVAL;
+    }
+    const int i_slot = next_;
+    DMPDVRingSlot& slot = slots_[i_slot];
+    if (slot.state == DMP_DV_RING_SLOT_ACQUIRED) {
+      SET_ERR_CODE(EBUSY, "All %d slots of the ring are acquired and not yet committed", (int)slots_.size());
+      return -EBUSY;
+    }
+    if (slot.state == DMP_DV_RING_SLOT_IN_FLIGHT) {
+      if (!slot.cmdlist->IsCompleted(slot.exec_id)) {
+        if (!wait) {
+          SET_ERR_CODE(EAGAIN, "Slot %d of the ring is still used by the device", i_slot);
+          return -EAGAIN;
+        }
+        CDMPDVCmdList *cmdlist = slot.cmdlist;
+        const int64_t exec_id = slot.exec_id;
+        cmdlist->Retain();
+        lock.unlock();
+        int res = cmdlist->Wait(exec_id);
+        cmdlist->Release();
+        if (res) {
+          return res > 0 ? -res : res;
+        }
+        lock.lock();
+        if ((next_ != i_slot) || (slot.state != DMP_DV_RING_SLOT_IN_FLIGHT) || (slot.exec_id != exec_id)) {
+          SET_ERR_CODE(EBUSY, "Ring slot %d was concurrently acquired by another thread", i_slot);
+          return -EBUSY;
+        }
+      }
+      slot.cmdlist->Release();
+      slot.cmdlist = NULL;
+      slot.exec_id = -1;
+    }
+    slot.state = DMP_DV_RING_SLOT_ACQUIRED;
+    next_ = (next_ + 1) % (int)slots_.size();
+    return i_slot;
+  }
+
+  /// @brief Passes the acquired slot to the device.
+  /// @param cmdlist Command list which reads the slot, NULL returns the slot to the ring without execution.
+  /// @param exec_id Execution id of the command list returned by Exec().
+  /// @return 0 on success, non-zero on error.
+  int Commit(int i_slot, CDMPDVCmdList *cmdlist, int64_t exec_id) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if ((i_slot < 0) || (i_slot >= (int)slots_.size())) {
+      SET_ERR("Invalid argument: slot index %d is out of bounds [0, %d)", i_slot, (int)slots_.size());
+      return EINVAL;
+    }
+    DMPDVRingSlot& slot = slots_[i_slot];
+    if (slot.state != DMP_DV_RING_SLOT_ACQUIRED) {
+      SET_ERR("Ring slot %d is not acquired", i_slot);
+      return EINVAL;
+    }
+    if (!cmdlist) {
+      slot.state = DMP_DV_RING_SLOT_FREE;
+      return 0;
+    }
+    if (exec_id < 0) {
+      SET_ERR("Invalid argument: exec_id = %lld", (long long)exec_id);
+      return EINVAL;
+    }
+    cmdlist->Retain();
+    slot.cmdlist = cmdlist;
+    slot.exec_id = exec_id;
+    slot.state = DMP_DV_RING_SLOT_IN_FLIGHT;
+    return 0;
+  }
+
+ private:
+  /// @brief Releases held resources.
+  void Cleanup() {
+    for (auto it = slots_.rbegin(); it != slots_.rend(); ++it) {
+      if (it->cmdlist) {
+        it->cmdlist->Release();
+      }
+      if (it->mem) {
+        it->mem->Release();
+      }
+    }
+    slots_.clear();
+    if (mem_) {
+      mem_->Release();
+      mem_ = NULL;
+    }
+    slot_stride_ = 0;
+    next_ = 0;
+  }
+
+  /// @brief Memory for all slots.
+  CDMPDVMem *mem_;
+
+  /// @brief Distance between slots in bytes.
+  size_t slot_stride_;
+
+  /// @brief Slots.
+  std::vector<DMPDVRingSlot> slots_;
+
+  /// @brief Index of the slot to be acquired next.
+  int next_;
+
+  /// @brief Mutex for protecting slots_ and next_.
+  std::mutex mutex_;
+};
@@ -28,6 +28,8 @@
 #include "cmdlist_fc.hpp"
 #include "cmdlist_ipu.hpp"
 #include "cmdlist_maximizer.hpp"
+#include "ring.hpp"
+#include "reaper.hpp"
 
 
 /// @brief Creators for the specific device types.
@@ -44,31 +46,104 @@ CDMPDVCmdListDeviceHelper* (*CDMPDVCmdListDeviceHelper::creators_[DMP_DV_DEV_COU
 int64_t CDMPDVMem::total_size_ = 0;
 
 
+/// @brief Cache maintenance cost model parameters instantiation (defaults are measured on ZIA C2 board).
+struct dmp_dv_cache_params CDMPDVCacheEngine::params_ = {
+  4.0,      // line_ns
+  30000.0,  // sync_fixed_ns
+  0.02,     // sync_byte_ns
+  40000.0,  // thread_ns
+  4,        // max_threads
+  1         // use_dma_buf_sync
+};
+
+
+/// @brief Mutex for protecting cache maintenance cost model parameters instantiation.
+std::mutex CDMPDVCacheEngine::params_mutex_;
+
+
+/// @brief Memory layer counters collection flag instantiation.
+int CDMPDVMemStats::enabled_ = 0;
+
+
+/// @brief Memory layer counters instantiation.
+struct dmp_dv_mem_stats CDMPDVMemStats::stats_;
+
+
+/// @brief Mutex for the process-wide completion condition instantiation.
+std::mutex CDMPDVReaper::completion_mutex_;
+
+
+/// @brief Condition signaled on completion of any tracked execution instantiation.
+std::condition_variable CDMPDVReaper::completion_cond_;
+
+
+/// @brief Process-wide device capabilities snapshot instantiation.
+CDMPDVDeviceInfo *CDMPDVDeviceInfo::current_ = NULL;
+
+
+/// @brief Mutex for protecting process-wide device capabilities snapshot instantiation.
+std::mutex CDMPDVDeviceInfo::current_mutex_;
+
+
+/// @brief Overridden paths to the device and sysfs files (instantiation).
+std::string CDMPDVDeviceInfo::path_overrides_[DMP_DV_PATH_COUNT];
+
+
+/// @brief Mutex for protecting overridden paths (instantiation).
+std::mutex CDMPDVDeviceInfo::paths_mutex_;
+
+
 extern "C" {
 
 
-/// @brief Last error message (instantiation).
-char s_last_error_message[256];
+/// @brief Last error of the thread (instantiation).
+__thread struct dmp_dv_last_error s_last_error;
 
 /// @brief Verbosity level for debug messages.
 static int s_verbosity_level = -1;
 
 
 const char *dmp_dv_get_last_error_message() {
-  return s_last_error_message;
+  CDMPDVLastError::Format();
+  return s_last_error.message;
+}
+
+
+int dmp_dv_get_last_error(int *code, const char **msg) {
+  if (msg) {
+    CDMPDVLastError::Format();
+    *msg = s_last_error.message;
+  }
+  if (code) {
+    *code = s_last_error.code;
+  }
+  return s_last_error.code;
+}
+
+
+void dmp_dv_set_last_error_code(int code, const char *format, ...) {
+  va_list args;
+  va_start(args, format);
+  vsnprintf(s_last_error.message, sizeof(s_last_error.message), format, args);
+  va_end(args);
+  s_last_error.code = code;
+  s_last_error.format = NULL;
 }
 
 
 void dmp_dv_set_last_error_message(const char *format, ...) {
   va_list args;
   va_start(args, format);
-  vsnprintf(s_last_error_message, sizeof(s_last_error_message), format, args);
+  vsnprintf(s_last_error.message, sizeof(s_last_error.message), format, args);
+  va_end(args);
+  s_last_error.code = EINVAL;
+  s_last_error.format = NULL;
   if (s_verbosity_level == -1) {
     const char *s = getenv("VERBOSITY");
     s_verbosity_level = s ? atoi(s) : 0;
   }
   if (s_verbosity_level >= 1) {
-    fprintf(stderr, "%s\n", s_last_error_message);
+    fprintf(stderr, "%s\n", s_last_error.message);
     fflush(stderr);
   }
 }
@@ -82,7 +157,7 @@ const char *dmp_dv_get_version_string() {
 dmp_dv_context dmp_dv_context_create() {
   CDMPDVContext *ctx = new CDMPDVContext();
   if (!ctx) {
-    SET_ERR("Failed to allocate %zu bytes of memory", sizeof(CDMPDVContext));
+    SET_ERR_CODE(ENOMEM, "Failed to allocate %zu bytes of memory", sizeof(CDMPDVContext));
     return NULL;
   }
   if (!ctx->Initialize()) {
@@ -93,6 +168,25 @@ dmp_dv_context dmp_dv_context_create() {
 }
 
 
+int dmp_dv_context_refresh_device_info() {
+  return CDMPDVDeviceInfo::Refresh();
+}
+
+
+int dmp_dv_set_path(int path_id, const char *path) {
+  return CDMPDVDeviceInfo::SetPath(path_id, path);
+}
+
+
+const char *dmp_dv_context_get_path(dmp_dv_context ctx, int path_id) {
+  if (!ctx) {
+    SET_ERR("Invalid argument: ctx is NULL");
+    return "";
+  }
+  return ((CDMPDVContext*)ctx)->get_path(path_id);
+}
+
+
 const char *dmp_dv_context_get_info_string(dmp_dv_context ctx) {
   if (!ctx) {
     SET_ERR("Invalid argument: ctx is NULL");
@@ -130,7 +224,7 @@ int dmp_dv_context_retain(dmp_dv_context ctx) {
 dmp_dv_mem dmp_dv_mem_alloc(dmp_dv_context ctx, size_t size) {
   CDMPDVMem *mem = new CDMPDVMem();
   if (!mem) {
-    SET_ERR("Failed to allocate %zu bytes of memory", sizeof(CDMPDVMem));
+    SET_ERR_CODE(ENOMEM, "Failed to allocate %zu bytes of memory", sizeof(CDMPDVMem));
     return NULL;
   }
   if (!mem->Initialize((CDMPDVContext*)ctx, size)) {
@@ -142,6 +236,51 @@ dmp_dv_mem dmp_dv_mem_alloc(dmp_dv_context ctx, size_t size) {
 }
 
 
+dmp_dv_mem dmp_dv_mem_alloc_ex(dmp_dv_context ctx, size_t size, int flags) {
+  CDMPDVMem *mem = new CDMPDVMem();
+  if (!mem) {
+    SET_ERR_CODE(ENOMEM, "Failed to allocate %zu bytes of memory", sizeof(CDMPDVMem));
+    return NULL;
+  }
+  if (!mem->Initialize((CDMPDVContext*)ctx, size, flags)) {
+    mem->Release();
+    return NULL;
+  }
+
+  return (dmp_dv_mem)mem;
+}
+
+
+dmp_dv_mem dmp_dv_mem_import_fd(dmp_dv_context ctx, int fd, size_t size) {
+  CDMPDVMem *mem = new CDMPDVMem();
+  if (!mem) {
+    SET_ERR_CODE(ENOMEM, "Failed to allocate %zu bytes of memory", sizeof(CDMPDVMem));
+    return NULL;
+  }
+  if (!mem->InitializeImport((CDMPDVContext*)ctx, fd, size)) {
+    mem->Release();
+    return NULL;
+  }
+
+  return (dmp_dv_mem)mem;
+}
+
+
+dmp_dv_mem dmp_dv_mem_suballoc(dmp_dv_mem parent, size_t offs, size_t size) {
+  CDMPDVMem *mem = new CDMPDVMem();
+  if (!mem) {
+    SET_ERR_CODE(ENOMEM, "Failed to allocate %zu bytes of memory", sizeof(CDMPDVMem));
+    return NULL;
+  }
+  if (!mem->InitializeChild((CDMPDVMem*)parent, offs, size)) {
+    mem->Release();
+    return NULL;
+  }
+
+  return (dmp_dv_mem)mem;
+}
+
+
 int dmp_dv_mem_release(dmp_dv_mem mem) {
   if (!mem) {
     return 0;
@@ -176,6 +315,24 @@ void dmp_dv_mem_unmap(dmp_dv_mem mem) {
 }
 
 
+uint8_t *dmp_dv_mem_map_ex(dmp_dv_mem mem, size_t offs, size_t size, int flags) {
+  if (!mem) {
+    SET_ERR("Invalid argument: mem is NULL");
+    return NULL;
+  }
+  return ((CDMPDVMem*)mem)->MapEx(offs, size, flags);
+}
+
+
+int dmp_dv_mem_unmap_ex(dmp_dv_mem mem, uint8_t *ptr) {
+  if (!mem) {
+    SET_ERR("Invalid argument: mem is NULL");
+    return EINVAL;
+  }
+  return ((CDMPDVMem*)mem)->UnmapEx(ptr);
+}
+
+
 int dmp_dv_mem_sync_start(dmp_dv_mem mem, int rd, int wr) {
   if (!mem) {
     SET_ERR("Invalid argument: mem is NULL");
@@ -208,6 +365,95 @@ int64_t dmp_dv_mem_get_total_size() {
 }
 
 
+void dmp_dv_mem_stats_enable(int enable) {
+  CDMPDVMemStats::Enable(enable != 0);
+}
+
+
+int dmp_dv_mem_get_stats(struct dmp_dv_mem_stats *stats) {
+  if (!stats) {
+    SET_ERR("Invalid argument: stats is NULL");
+    return EINVAL;
+  }
+  CDMPDVMemStats::GetStats(stats);
+  return 0;
+}
+
+
+void dmp_dv_mem_reset_stats() {
+  CDMPDVMemStats::Reset();
+}
+
+
+int dmp_dv_context_get_mem_usage(dmp_dv_context ctx, struct dmp_dv_mem_usage *usage) {
+  if (!ctx) {
+    SET_ERR("Invalid argument: ctx is NULL");
+    return EINVAL;
+  }
+  if (!usage) {
+    SET_ERR("Invalid argument: usage is NULL");
+    return EINVAL;
+  }
+  ((CDMPDVContext*)ctx)->get_mem_usage()->GetUsage(usage);
+  return 0;
+}
+
+
+int dmp_dv_context_reset_mem_peak(dmp_dv_context ctx) {
+  if (!ctx) {
+    SET_ERR("Invalid argument: ctx is NULL");
+    return EINVAL;
+  }
+  ((CDMPDVContext*)ctx)->get_mem_usage()->ResetPeak();
+  return 0;
+}
+
+
+int dmp_dv_context_set_mem_budget(dmp_dv_context ctx, size_t budget_bytes,
+                                  dmp_dv_mem_evict_callback callback, void *user_data) {
+  if (!ctx) {
+    SET_ERR("Invalid argument: ctx is NULL");
+    return EINVAL;
+  }
+  ((CDMPDVContext*)ctx)->SetMemBudget(budget_bytes, callback, user_data);
+  return 0;
+}
+
+
+int dmp_dv_mem_pool_enable(dmp_dv_context ctx, size_t max_cached_bytes) {
+  if (!ctx) {
+    SET_ERR("Invalid argument: ctx is NULL");
+    return EINVAL;
+  }
+  ((CDMPDVContext*)ctx)->get_mem_pool()->SetMaxCachedBytes(max_cached_bytes);
+  return 0;
+}
+
+
+int dmp_dv_mem_pool_trim(dmp_dv_context ctx, size_t keep_bytes) {
+  if (!ctx) {
+    SET_ERR("Invalid argument: ctx is NULL");
+    return EINVAL;
+  }
+  ((CDMPDVContext*)ctx)->get_mem_pool()->Trim(keep_bytes);
+  return 0;
+}
+
+
+int dmp_dv_mem_pool_get_stats(dmp_dv_context ctx, struct dmp_dv_mem_pool_stats *stats) {
+  if (!ctx) {
+    SET_ERR("Invalid argument: ctx is NULL");
+    return EINVAL;
+  }
+  if (!stats) {
+    SET_ERR("Invalid argument: stats is NULL");
+    return EINVAL;
+  }
+  ((CDMPDVContext*)ctx)->get_mem_pool()->GetStats(stats);
+  return 0;
+}
+
+
 int dmp_dv_mem_to_device(dmp_dv_mem mem, size_t offs, size_t size, int flags) {
   if (!mem) {
     SET_ERR("Invalid argument: mem is NULL");
@@ -217,6 +463,69 @@ int dmp_dv_mem_to_device(dmp_dv_mem mem, size_t offs, size_t size, int flags) {
 }
 
 
+int dmp_dv_mem_load_file(dmp_dv_mem mem, size_t offs, const char *path, uint64_t file_offs, size_t size, int flags) {
+  if (!mem) {
+    SET_ERR("Invalid argument: mem is NULL");
+    return EINVAL;
+  }
+  if (!path) {
+    SET_ERR("Invalid argument: path is NULL");
+    return EINVAL;
+  }
+  if (flags & ~DMP_DV_MEM_LOAD_DIRECT) {
+    SET_ERR("Invalid argument: unsupported flags 0x%x", flags);
+    return EINVAL;
+  }
+  return ((CDMPDVMem*)mem)->LoadFile(offs, path, file_offs, size, flags);
+}
+
+
+int dmp_dv_mem_copy(dmp_dv_mem dst, size_t dst_offs, dmp_dv_mem src, size_t src_offs, size_t size, int flags) {
+  if (!dst) {
+    SET_ERR("Invalid argument: dst is NULL");
+    return EINVAL;
+  }
+  if (!src) {
+    SET_ERR("Invalid argument: src is NULL");
+    return EINVAL;
+  }
+  if (flags & ~DMP_DV_MEM_CPU_WONT_READ) {
+    SET_ERR("Invalid argument: unsupported flags 0x%x", flags);
+    return EINVAL;
+  }
+  return ((CDMPDVMem*)dst)->CopyFrom(dst_offs, (CDMPDVMem*)src, src_offs, size, flags);
+}
+
+
+int dmp_dv_mem_fill(dmp_dv_mem mem, size_t offs, int value, size_t size, int flags) {
+  if (!mem) {
+    SET_ERR("Invalid argument: mem is NULL");
+    return EINVAL;
+  }
+  if (flags & ~DMP_DV_MEM_CPU_WONT_READ) {
+    SET_ERR("Invalid argument: unsupported flags 0x%x", flags);
+    return EINVAL;
+  }
+  return ((CDMPDVMem*)mem)->Fill(offs, (uint8_t)value, size, flags);
+}
+
+
+int dmp_dv_mem_mark_dirty(dmp_dv_mem mem, size_t offs, size_t size) {
+  if (!mem) {
+    SET_ERR("Invalid argument: mem is NULL");
+    return EINVAL;
+  }
+  CDMPDVMem *obj = (CDMPDVMem*)mem;
+  if ((offs > obj->get_size()) || (obj->get_size() - offs < size)) {
+    SET_ERR("Invalid memory range specified: offs=%zu size=%zu while memory buffer size is %zu",
+            offs, size, obj->get_size());
+    return EINVAL;
+  }
+  obj->MarkDirty(offs, size);
+  return 0;
+}
+
+
 int dmp_dv_mem_to_cpu(dmp_dv_mem mem, size_t offs, size_t size, int flags) {
   if (!mem) {
     SET_ERR("Invalid argument: mem is NULL");
@@ -226,10 +535,87 @@ int dmp_dv_mem_to_cpu(dmp_dv_mem mem, size_t offs, size_t size, int flags) {
 }
 
 
+int dmp_dv_mem_sync_batch(const struct dmp_dv_mem_range *ranges, int n) {
+  CDMPDVMemStatsTimer timer(DMP_DV_MEM_OP_SYNC_BATCH);
+  if ((n < 0) || ((!ranges) && (n))) {
+    SET_ERR("Invalid argument: ranges is NULL or n is negative");
+    return EINVAL;
+  }
+  std::vector<DMPDVCacheRange> cache_ranges;
+  cache_ranges.reserve(n);
+  for (int i = 0; i < n; ++i) {
+    const struct dmp_dv_mem_range& range = ranges[i];
+    if (!range.mem) {
+      SET_ERR("Invalid argument: ranges[%d].mem is NULL", i);
+      return EINVAL;
+    }
+    if ((range.direction != DMP_DV_MEM_TO_DEVICE) && (range.direction != DMP_DV_MEM_TO_CPU)) {
+      SET_ERR("Invalid argument: ranges[%d].direction is %d", i, (int)range.direction);
+      return EINVAL;
+    }
+    DMPDVCacheRange cache_range;
+    int res = ((CDMPDVMem*)range.mem)->GetCacheRange(
+        range.offs, range.size, range.direction == DMP_DV_MEM_TO_DEVICE, range.flags, &cache_range);
+    if (res) {
+      return res;
+    }
+    if (cache_range.fd != -1) {
+      cache_ranges.push_back(cache_range);
+    }
+  }
+  return CDMPDVCacheEngine::FlushBatch(cache_ranges);
+}
+
+
+int dmp_dv_cache_get_params(struct dmp_dv_cache_params *params) {
+  if (!params) {
+    SET_ERR("Invalid argument: params is NULL");
+    return EINVAL;
+  }
+  CDMPDVCacheEngine::GetParams(params);
+  return 0;
+}
+
+
+int dmp_dv_cache_set_params(const struct dmp_dv_cache_params *params) {
+  if (!params) {
+    SET_ERR("Invalid argument: params is NULL");
+    return EINVAL;
+  }
+  return CDMPDVCacheEngine::SetParams(params);
+}
+
+
+int dmp_dv_cache_calibrate(dmp_dv_context ctx, struct dmp_dv_cache_params *params) {
+  if (!ctx) {
+    SET_ERR("Invalid argument: ctx is NULL");
+    return EINVAL;
+  }
+  static const size_t size_big = 4 << 20, size_small = 64 << 10;
+  CDMPDVMem *mem_big = new CDMPDVMem();
+  CDMPDVMem *mem_small = new CDMPDVMem();
+  int res;
+  uint8_t *ptr_big;
+  if ((mem_big->Initialize((CDMPDVContext*)ctx, size_big)) &&
+      (mem_small->Initialize((CDMPDVContext*)ctx, size_small)) &&
+      ((ptr_big = mem_big->Map()))) {
+    res = CDMPDVCacheEngine::Calibrate(CDMPDVMem::get_fd((dmp_dv_mem)mem_big), ptr_big, mem_big->get_size(),
+                                       CDMPDVMem::get_fd((dmp_dv_mem)mem_small), mem_small->get_size(), params);
+  }
+  else {
+    res = dmp_dv_get_last_error(NULL, NULL);  // code recorded by the failed allocation or mapping
+    res = res ? res : ENOMEM;
+  }
+  mem_small->Release();
+  mem_big->Release();
+  return res;
+}
+
+
 dmp_dv_cmdlist dmp_dv_cmdlist_create(dmp_dv_context ctx) {
   CDMPDVCmdList *cmdlist = new CDMPDVCmdList();
   if (!cmdlist) {
-    SET_ERR("Failed to allocate %zu bytes of memory", sizeof(CDMPDVCmdList));
+    SET_ERR_CODE(ENOMEM, "Failed to allocate %zu bytes of memory", sizeof(CDMPDVCmdList));
     return NULL;
   }
   if (!cmdlist->Initialize((CDMPDVContext*)ctx)) {
@@ -265,6 +651,29 @@ int dmp_dv_cmdlist_commit(dmp_dv_cmdlist cmdlist) {
 }
 
 
+int dmp_dv_cmdlist_set_managed_coherency(dmp_dv_cmdlist cmdlist, int enable) {
+  if (!cmdlist) {
+    SET_ERR("Invalid argument: cmdlist is NULL");
+    return EINVAL;
+  }
+  ((CDMPDVCmdList*)cmdlist)->SetManagedCoherency(enable != 0);
+  return 0;
+}
+
+
+int dmp_dv_cmdlist_rebind(dmp_dv_cmdlist cmdlist, dmp_dv_mem old_mem, const struct dmp_dv_buf *new_buf) {
+  if (!cmdlist) {
+    SET_ERR("Invalid argument: cmdlist is NULL");
+    return EINVAL;
+  }
+  if (!new_buf) {
+    SET_ERR("Invalid argument: new_buf is NULL");
+    return EINVAL;
+  }
+  return ((CDMPDVCmdList*)cmdlist)->Rebind(old_mem, *new_buf);
+}
+
+
 int64_t dmp_dv_cmdlist_exec(dmp_dv_cmdlist cmdlist) {
   if (!cmdlist) {
     SET_ERR("Invalid argument: cmdlist is NULL");
@@ -283,6 +692,68 @@ int dmp_dv_cmdlist_wait(dmp_dv_cmdlist cmdlist, int64_t exec_id) {
 }
 
 
+int dmp_dv_cmdlist_exec_many(dmp_dv_cmdlist *cmdlists, int n, int64_t *exec_ids) {
+  if ((!cmdlists) || (!exec_ids) || (n < 1)) {
+    SET_ERR("Invalid argument: cmdlists=%p exec_ids=%p n=%d", cmdlists, exec_ids, n);
+    return EINVAL;
+  }
+  return CDMPDVCmdList::ExecMany((CDMPDVCmdList**)cmdlists, n, exec_ids);
+}
+
+
+int64_t dmp_dv_cmdlist_exec_async(dmp_dv_cmdlist cmdlist, dmp_dv_exec_callback callback, void *user_data) {
+  if ((!cmdlist) || (!callback)) {
+    SET_ERR("Invalid argument: cmdlist=%p callback=%p", cmdlist, (void*)callback);
+    return -EINVAL;
+  }
+  return CDMPDVReaper::ExecAsync((CDMPDVCmdList*)cmdlist, callback, user_data);
+}
+
+
+int dmp_dv_wait_all(struct dmp_dv_wait_entry *entries, int n) {
+  return CDMPDVReaper::WaitAll(entries, n);
+}
+
+
+int dmp_dv_wait_any(struct dmp_dv_wait_entry *entries, int n, int *index) {
+  return CDMPDVReaper::WaitAny(entries, n, index, -1);
+}
+
+
+int dmp_dv_cmdlist_wait_timeout(dmp_dv_cmdlist cmdlist, int64_t exec_id, int64_t timeout_us) {
+  if (!cmdlist) {
+    SET_ERR("Invalid argument: cmdlist is NULL");
+    return EINVAL;
+  }
+  if (timeout_us < 0) {
+    return ((CDMPDVCmdList*)cmdlist)->Wait(exec_id);
+  }
+  struct dmp_dv_wait_entry entry;
+  memset(&entry, 0, sizeof(entry));
+  entry.cmdlist = cmdlist;
+  entry.exec_id = exec_id;
+  return CDMPDVReaper::WaitAny(&entry, 1, NULL, timeout_us);
+}
+
+
+int dmp_dv_cmdlist_poll(dmp_dv_cmdlist cmdlist, int64_t exec_id) {
+  if (!cmdlist) {
+    SET_ERR("Invalid argument: cmdlist is NULL");
+    return EINVAL;
+  }
+  return CDMPDVReaper::Poll((CDMPDVCmdList*)cmdlist, exec_id);
+}
+
+
+int dmp_dv_context_get_completion_fd(dmp_dv_context ctx) {
+  if (!ctx) {
+    SET_ERR("Invalid argument: ctx is NULL");
+    return -1;
+  }
+  return ((CDMPDVContext*)ctx)->GetCompletionFd();
+}
+
+
 int64_t dmp_dv_cmdlist_get_last_exec_time(dmp_dv_cmdlist cmdlist) {
   if (!cmdlist) {
     SET_ERR("Invalid argument: cmdlist is NULL");
@@ -292,6 +763,115 @@ int64_t dmp_dv_cmdlist_get_last_exec_time(dmp_dv_cmdlist cmdlist) {
 }
 
 
+int dmp_dv_cmdlist_set_profiling(dmp_dv_cmdlist cmdlist, int enable) {
+  if (!cmdlist) {
+    SET_ERR("Invalid argument: cmdlist is NULL");
+    return EINVAL;
+  }
+  return ((CDMPDVCmdList*)cmdlist)->SetProfiling(enable != 0);
+}
+
+
+int dmp_dv_cmdlist_get_profile(dmp_dv_cmdlist cmdlist, struct dmp_dv_cmd_profile *profile, int n) {
+  if (!cmdlist) {
+    SET_ERR("Invalid argument: cmdlist is NULL");
+    return -EINVAL;
+  }
+  return ((CDMPDVCmdList*)cmdlist)->GetProfile(profile, n);
+}
+
+
+int dmp_dv_cmdlist_serialize(dmp_dv_cmdlist cmdlist, const dmp_dv_mem *buffer_table, int n_buffers,
+                             void *blob, size_t *size) {
+  if (!cmdlist) {
+    SET_ERR("Invalid argument: cmdlist is NULL");
+    return EINVAL;
+  }
+  if ((!size) || ((!buffer_table) && (n_buffers)) || (n_buffers < 0)) {
+    SET_ERR("Invalid argument: buffer_table = %p n_buffers = %d size = %p", buffer_table, n_buffers, size);
+    return EINVAL;
+  }
+  return ((CDMPDVCmdList*)cmdlist)->Serialize(buffer_table, n_buffers, (uint8_t*)blob, *size);
+}
+
+
+dmp_dv_cmdlist dmp_dv_cmdlist_deserialize(dmp_dv_context ctx, const void *blob, size_t size,
+                                          const dmp_dv_mem *buffer_table, int n_buffers) {
+  if ((!blob) || ((!buffer_table) && (n_buffers)) || (n_buffers < 0)) {
+    SET_ERR("Invalid argument: blob = %p buffer_table = %p n_buffers = %d", blob, buffer_table, n_buffers);
+    return NULL;
+  }
+  CDMPDVCmdList *cmdlist = new CDMPDVCmdList();
+  if (!cmdlist) {
+    SET_ERR_CODE(ENOMEM, "Failed to allocate %zu bytes of memory", sizeof(CDMPDVCmdList));
+    return NULL;
+  }
+  if ((!cmdlist->Initialize((CDMPDVContext*)ctx)) ||
+      (cmdlist->Deserialize((const uint8_t*)blob, size, buffer_table, n_buffers))) {
+    cmdlist->Release();
+    return NULL;
+  }
+  return (dmp_dv_cmdlist)cmdlist;
+}
+
+
+dmp_dv_ring dmp_dv_ring_create(dmp_dv_context ctx, size_t slot_size, int n_slots) {
+  CDMPDVRing *ring = new CDMPDVRing();
+  if (!ring) {
+    SET_ERR_CODE(ENOMEM, "Failed to allocate %zu bytes of memory", sizeof(CDMPDVRing));
+    return NULL;
+  }
+  if (!ring->Initialize((CDMPDVContext*)ctx, slot_size, n_slots)) {
+    ring->Release();
+    return NULL;
+  }
+  return (dmp_dv_ring)ring;
+}
+
+
+int dmp_dv_ring_release(dmp_dv_ring ring) {
+  if (!ring) {
+    return 0;
+  }
+  return ((CDMPDVRing*)ring)->Release();
+}
+
+
+int dmp_dv_ring_retain(dmp_dv_ring ring) {
+  if (!ring) {
+    return 0;
+  }
+  return ((CDMPDVRing*)ring)->Retain();
+}
+
+
+dmp_dv_mem dmp_dv_ring_get_slot(dmp_dv_ring ring, int slot) {
+  if (!ring) {
+    SET_ERR("Invalid argument: ring is NULL");
+    return NULL;
+  }
+  return (dmp_dv_mem)((CDMPDVRing*)ring)->GetSlot(slot);
+}
+
+
+int dmp_dv_ring_acquire(dmp_dv_ring ring, int wait) {
+  if (!ring) {
+    SET_ERR("Invalid argument: ring is NULL");
+    return -EINVAL;
+  }
+  return ((CDMPDVRing*)ring)->Acquire(wait != 0);
+}
+
+
+int dmp_dv_ring_commit(dmp_dv_ring ring, int slot, dmp_dv_cmdlist cmdlist, int64_t exec_id) {
+  if (!ring) {
+    SET_ERR("Invalid argument: ring is NULL");
+    return EINVAL;
+  }
+  return ((CDMPDVRing*)ring)->Commit(slot, (CDMPDVCmdList*)cmdlist, exec_id);
+}
+
+
 int dmp_dv_cmdlist_add_raw(dmp_dv_cmdlist cmdlist, struct dmp_dv_cmdraw *cmd) {
   if (!cmdlist) {
     SET_ERR("Invalid argument: cmdlist is NULL");
@@ -0,0 +1,835 @@
+/*
+ *  Copyright 2018 Digital Media Professionals Inc.
+
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+
+ *      http://www.apache.org/licenses/LICENSE-2.0
+
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+/*
+ * @brief Functional tests for operations on committed command lists.
+ */
+#include <unistd.h>
+#include <poll.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "dmp_dv.h"
+#include "dmp_dv_cmdraw_v0.h"
+
+
+#define LOG(...) fprintf(stdout, __VA_ARGS__); fflush(stdout)
+#define ERR(...) fprintf(stderr, __VA_ARGS__); fflush(stderr)
+
+#define IO_SIZE (56 * 56 * 192 * 2)
+
+
+/// @brief Fills single-run LRN layer configuration which does not need weights.
+static void fill_conf(struct dmp_dv_cmdraw_conv_v0 *conf, dmp_dv_mem input_mem, dmp_dv_mem output_mem) {
+  memset(conf, 0, sizeof(*conf));
+
+  conf->input_buf.mem = input_mem;
+  conf->input_buf.offs = 0;
+
+  conf->output_buf.mem = output_mem;
+  conf->output_buf.offs = 0;
+
+  conf->header.size = sizeof(*conf);
+  conf->header.device_type = DMP_DV_DEV_CONV;
+  conf->header.version = 0;
+  conf->topo = 1;
+  conf->w = 56;
+  conf->h = 56;
+  conf->z = 1;
+  conf->c = 192;
+  conf->run[0].m = 192;
+  conf->run[0].p = 0x0101;
+  conf->run[0].pz = 1;
+  conf->run[0].conv_stride = 0x0101;
+  conf->run[0].pool_stride = 0x0101;
+  conf->run[0].lrn = 0x503;
+}
+
+
+/// @brief Creates and commits command list of n_commands LRN layers from input_mem to output_mem.
+static dmp_dv_cmdlist create_cmdlist(dmp_dv_context ctx, dmp_dv_mem input_mem, dmp_dv_mem output_mem, int n_commands) {
+  struct dmp_dv_cmdraw_conv_v0 conf;
+  fill_conf(&conf, input_mem, output_mem);
+  dmp_dv_cmdlist cmdlist = dmp_dv_cmdlist_create(ctx);
+  if (!cmdlist) {
+    ERR("dmp_dv_cmdlist_create() failed: %s\n", dmp_dv_get_last_error_message());
+    return NULL;
+  }
+  for (int i = 0; i < n_commands; ++i) {
+    if (dmp_dv_cmdlist_add_raw(cmdlist, (struct dmp_dv_cmdraw*)&conf)) {
+      ERR("dmp_dv_cmdlist_add_raw() failed: %s\n", dmp_dv_get_last_error_message());
+      dmp_dv_cmdlist_release(cmdlist);
+      return NULL;
+    }
+  }
+  if (dmp_dv_cmdlist_commit(cmdlist)) {
+    ERR("dmp_dv_cmdlist_commit() failed: %s\n", dmp_dv_get_last_error_message());
+    dmp_dv_cmdlist_release(cmdlist);
+    return NULL;
+  }
+  return cmdlist;
+}
+
+
+/// @brief Executes command list and waits for its completion.
+static int exec_wait(dmp_dv_cmdlist cmdlist) {
+  int64_t exec_id = dmp_dv_cmdlist_exec(cmdlist);
+  if (exec_id < 0) {
+    ERR("dmp_dv_cmdlist_exec() failed: %s\n", dmp_dv_get_last_error_message());
+    return -1;
+  }
+  if (dmp_dv_cmdlist_wait(cmdlist, exec_id)) {
+    ERR("dmp_dv_cmdlist_wait() failed: %s\n", dmp_dv_get_last_error_message());
+    return -1;
+  }
+  return 0;
+}
+
+
+/// @brief Fills memory with pseudo-random half-precision values in [0.5, 1) and writes it to RAM.
+static int fill_input(dmp_dv_mem mem, uint32_t seed) {
+  uint16_t *ptr = (uint16_t*)dmp_dv_mem_map(mem);
+  if (!ptr) {
+    ERR("dmp_dv_mem_map() failed: %s\n", dmp_dv_get_last_error_message());
+    return -1;
+  }
+  for (int i = 0; i < IO_SIZE / 2; ++i) {
+    seed = seed * 1103515245u + 12345u;
+    ptr[i] = (uint16_t)(0x3800 | ((seed >> 16) & 0x3FF));
+  }
+  if (dmp_dv_mem_to_device(mem, 0, IO_SIZE, DMP_DV_MEM_CPU_WONT_READ)) {
+    ERR("dmp_dv_mem_to_device() failed: %s\n", dmp_dv_get_last_error_message());
+    return -1;
+  }
+  return 0;
+}
+
+
+/// @brief Compares contents of two memory buffers written by the device.
+static int compare_output(dmp_dv_mem mem0, dmp_dv_mem mem1) {
+  uint8_t *ptr0 = dmp_dv_mem_map(mem0), *ptr1 = dmp_dv_mem_map(mem1);
+  if ((!ptr0) || (!ptr1)) {
+    ERR("dmp_dv_mem_map() failed: %s\n", dmp_dv_get_last_error_message());
+    return -1;
+  }
+  if ((dmp_dv_mem_to_cpu(mem0, 0, IO_SIZE, 0)) || (dmp_dv_mem_to_cpu(mem1, 0, IO_SIZE, 0))) {
+    ERR("dmp_dv_mem_to_cpu() failed: %s\n", dmp_dv_get_last_error_message());
+    return -1;
+  }
+  if (memcmp(ptr0, ptr1, IO_SIZE)) {
+    ERR("Outputs differ\n");
+    return -1;
+  }
+  return 0;
+}
+
+
+/// @brief Checks that the call has failed with the expected error code.
+static int check_error(int res, int expected, const char *what) {
+  int code = dmp_dv_get_last_error(NULL, NULL);
+  if ((!res) || (code != expected)) {
+    ERR("%s returned %d with error code %d while expecting %d\n", what, res, code, expected);
+    return -1;
+  }
+  return 0;
+}
+
+
+/// @brief Checks that deserialization of the blob fails with the expected error code.
+static int check_deserialize(dmp_dv_context ctx, const void *blob, size_t size,
+                             const dmp_dv_mem *buffer_table, int n_buffers, int expected, const char *what) {
+  dmp_dv_cmdlist cmdlist = dmp_dv_cmdlist_deserialize(ctx, blob, size, buffer_table, n_buffers);
+  if (cmdlist) {
+    ERR("%s has succeeded while expecting error %d\n", what, expected);
+    dmp_dv_cmdlist_release(cmdlist);
+    return -1;
+  }
+  return check_error(-1, expected, what);
+}
+
+
+int test_rebind(dmp_dv_context ctx) {
+  LOG("ENTER: test_rebind\n");
+
+  int result = -1;
+  dmp_dv_mem mems[4] = {NULL, NULL, NULL, NULL};  // input0, input1, output0, output1
+  dmp_dv_cmdlist cmdlist = NULL, fresh = NULL;
+  struct dmp_dv_buf buf;
+
+  for (int i = 0; i < 4; ++i) {
+    mems[i] = dmp_dv_mem_alloc(ctx, IO_SIZE);
+    if (!mems[i]) {
+      ERR("dmp_dv_mem_alloc() failed: %s\n", dmp_dv_get_last_error_message());
+      goto L_EXIT;
+    }
+  }
+  if ((fill_input(mems[0], 1)) || (fill_input(mems[1], 2))) {
+    goto L_EXIT;
+  }
+
+  // Switch the input of the commited command list to the second buffer
+  cmdlist = create_cmdlist(ctx, mems[0], mems[2], 1);
+  if (!cmdlist) {
+    goto L_EXIT;
+  }
+  buf.mem = mems[1];
+  buf.offs = 0;
+  if (dmp_dv_cmdlist_rebind(cmdlist, mems[0], &buf)) {
+    ERR("dmp_dv_cmdlist_rebind() failed: %s\n", dmp_dv_get_last_error_message());
+    goto L_EXIT;
+  }
+  if (exec_wait(cmdlist)) {
+    goto L_EXIT;
+  }
+  fresh = create_cmdlist(ctx, mems[1], mems[3], 1);
+  if ((!fresh) || (exec_wait(fresh))) {
+    goto L_EXIT;
+  }
+  if (compare_output(mems[2], mems[3])) {
+    ERR("Output of the rebound command list differs from the output of the newly built one\n");
+    goto L_EXIT;
+  }
+
+  // Errors must leave the command list unchanged
+  buf.mem = mems[0];
+  buf.offs = 0;
+  if (check_error(dmp_dv_cmdlist_rebind(cmdlist, mems[3], &buf), EINVAL, "dmp_dv_cmdlist_rebind() of unused memory")) {
+    goto L_EXIT;
+  }
+  buf.offs = 2;
+  if (check_error(dmp_dv_cmdlist_rebind(cmdlist, mems[1], &buf), EINVAL, "dmp_dv_cmdlist_rebind() with misaligned shift")) {
+    goto L_EXIT;
+  }
+  buf.offs = 0;
+  int64_t exec_id = dmp_dv_cmdlist_exec(cmdlist);
+  if (exec_id < 0) {
+    ERR("dmp_dv_cmdlist_exec() failed: %s\n", dmp_dv_get_last_error_message());
+    goto L_EXIT;
+  }
+  int res = check_error(dmp_dv_cmdlist_rebind(cmdlist, mems[1], &buf), EBUSY, "dmp_dv_cmdlist_rebind() while executing");
+  if (dmp_dv_cmdlist_wait(cmdlist, exec_id)) {
+    ERR("dmp_dv_cmdlist_wait() failed: %s\n", dmp_dv_get_last_error_message());
+    goto L_EXIT;
+  }
+  if (res) {
+    goto L_EXIT;
+  }
+
+  // The command list must hold a reference only on the memory it uses after rebind
+  if (dmp_dv_cmdlist_rebind(cmdlist, mems[1], &buf)) {
+    ERR("dmp_dv_cmdlist_rebind() failed: %s\n", dmp_dv_get_last_error_message());
+    goto L_EXIT;
+  }
+  dmp_dv_cmdlist_release(fresh);
+  fresh = NULL;
+  res = dmp_dv_mem_release(mems[1]);
+  mems[1] = NULL;
+  if (res) {
+    ERR("Memory which is no longer used by the command list has reference counter %d after release\n", res);
+    goto L_EXIT;
+  }
+  res = dmp_dv_mem_release(mems[0]);
+  if (res != 1) {
+    ERR("Memory which is used by the command list has reference counter %d after release\n", res);
+    mems[0] = NULL;
+    goto L_EXIT;
+  }
+  dmp_dv_mem_retain(mems[0]);
+
+  result = 0;
+
+  L_EXIT:
+
+  dmp_dv_cmdlist_release(fresh);
+  dmp_dv_cmdlist_release(cmdlist);
+  for (int i = 3; i >= 0; --i) {
+    dmp_dv_mem_release(mems[i]);
+  }
+
+  LOG("EXIT%s: test_rebind\n", result ? "(FAILED)" : "");
+  return result;
+}
+
+
+int test_rebind_fc(dmp_dv_context ctx) {
+  LOG("ENTER: test_rebind_fc\n");
+
+  int result = -1;
+  dmp_dv_mem io_mem = NULL, weights_mem = NULL, weights_mem2 = NULL;
+  dmp_dv_cmdlist cmdlist = NULL;
+  struct dmp_dv_cmdraw_fc_v0 cmd;
+  struct dmp_dv_buf buf;
+  struct dmp_dv_info_v0 info;
+  static uint16_t weights[64 * 16], bias[16];
+  size_t weights_size = 0;
+
+  info.header.size = sizeof(info);
+  info.header.version = 0;
+  if (dmp_dv_context_get_info(ctx, (struct dmp_dv_info*)&info)) {
+    ERR("dmp_dv_context_get_info() failed: %s\n", dmp_dv_get_last_error_message());
+    goto L_EXIT;
+  }
+  if (dmp_dv_pack_fc_weights(64, 1, 1, 16, 1, 1, NULL, weights, bias, NULL, &weights_size)) {
+    ERR("dmp_dv_pack_fc_weights() failed: %s\n", dmp_dv_get_last_error_message());
+    goto L_EXIT;
+  }
+  io_mem = dmp_dv_mem_alloc(ctx, 4096 + 16 * 2);
+  weights_mem = dmp_dv_mem_alloc(ctx, weights_size);
+  weights_mem2 = dmp_dv_mem_alloc(ctx, weights_size);
+  if ((!io_mem) || (!weights_mem) || (!weights_mem2)) {
+    ERR("dmp_dv_mem_alloc() failed: %s\n", dmp_dv_get_last_error_message());
+    goto L_EXIT;
+  }
+  uint8_t *ptr = dmp_dv_mem_map(weights_mem);
+  if (!ptr) {
+    ERR("dmp_dv_mem_map() failed: %s\n", dmp_dv_get_last_error_message());
+    goto L_EXIT;
+  }
+  if (dmp_dv_pack_fc_weights(64, 1, 1, 16, 1, 1, NULL, weights, bias, ptr, &weights_size)) {
+    ERR("dmp_dv_pack_fc_weights() failed: %s\n", dmp_dv_get_last_error_message());
+    goto L_EXIT;
+  }
+  dmp_dv_mem_to_device(weights_mem, 0, weights_size, DMP_DV_MEM_CPU_WONT_READ);
+
+  memset(&cmd, 0, sizeof(cmd));
+  cmd.header.size = sizeof(cmd);
+  cmd.header.device_type = DMP_DV_DEV_FC;
+  cmd.header.version = 0;
+  cmd.weight_buf.mem = weights_mem;
+  cmd.input_buf.mem = io_mem;
+  cmd.output_buf.mem = io_mem;
+  cmd.output_buf.offs = 4096;
+  cmd.input_size = 64;
+  cmd.output_size = 16;
+  cmdlist = dmp_dv_cmdlist_create(ctx);
+  if ((!cmdlist) || (dmp_dv_cmdlist_add_raw(cmdlist, (struct dmp_dv_cmdraw*)&cmd)) ||
+      (dmp_dv_cmdlist_commit(cmdlist))) {
+    ERR("Failed to create command list: %s\n", dmp_dv_get_last_error_message());
+    goto L_EXIT;
+  }
+
+  // Weights are repacked on commit when FC layer is executed on CONV
+  buf.mem = weights_mem2;
+  buf.offs = 0;
+  int res = dmp_dv_cmdlist_rebind(cmdlist, weights_mem, &buf);
+  if (info.fc_freq) {
+    if (res) {
+      ERR("dmp_dv_cmdlist_rebind() of FC weights failed: %s\n", dmp_dv_get_last_error_message());
+      goto L_EXIT;
+    }
+  }
+  else if (check_error(res, ENOTSUP, "dmp_dv_cmdlist_rebind() of FC weights executed on CONV")) {
+    goto L_EXIT;
+  }
+
+  result = 0;
+
+  L_EXIT:
+
+  dmp_dv_cmdlist_release(cmdlist);
+  dmp_dv_mem_release(weights_mem2);
+  dmp_dv_mem_release(weights_mem);
+  dmp_dv_mem_release(io_mem);
+
+  LOG("EXIT%s: test_rebind_fc\n", result ? "(FAILED)" : "");
+  return result;
+}
+
+
+int test_exec_many(dmp_dv_context ctx) {
+  LOG("ENTER: test_exec_many\n");
+
+  int result = -1;
+  dmp_dv_mem mems[3] = {NULL, NULL, NULL};  // input, output0, output1
+  dmp_dv_cmdlist cmdlists[3] = {NULL, NULL, NULL};
+  int64_t exec_ids[3];
+  struct dmp_dv_wait_entry entries[3];
+  int index = -1;
+
+  for (int i = 0; i < 3; ++i) {
+    mems[i] = dmp_dv_mem_alloc(ctx, IO_SIZE);
+    if (!mems[i]) {
+      ERR("dmp_dv_mem_alloc() failed: %s\n", dmp_dv_get_last_error_message());
+      goto L_EXIT;
+    }
+  }
+  if (fill_input(mems[0], 3)) {
+    goto L_EXIT;
+  }
+  cmdlists[0] = create_cmdlist(ctx, mems[0], mems[1], 1);
+  cmdlists[1] = create_cmdlist(ctx, mems[0], mems[2], 1);
+  cmdlists[2] = cmdlists[0];
+  if ((!cmdlists[0]) || (!cmdlists[1])) {
+    goto L_EXIT;
+  }
+
+  // Every execution must be returned by dmp_dv_wait_any() exactly once
+  if (dmp_dv_cmdlist_exec_many(cmdlists, 3, exec_ids)) {
+    ERR("dmp_dv_cmdlist_exec_many() failed: %s\n", dmp_dv_get_last_error_message());
+    goto L_EXIT;
+  }
+  memset(entries, 0, sizeof(entries));
+  for (int i = 0; i < 3; ++i) {
+    entries[i].cmdlist = cmdlists[i];
+    entries[i].exec_id = exec_ids[i];
+  }
+  for (int i = 0; i < 3; ++i) {
+    index = -1;
+    if (dmp_dv_wait_any(entries, 3, &index)) {
+      ERR("dmp_dv_wait_any() failed: %s\n", dmp_dv_get_last_error_message());
+      goto L_EXIT;
+    }
+    if ((index < 0) || (index >= 3) || (entries[index].exec_id < 0)) {
+      ERR("dmp_dv_wait_any() returned index %d of the already completed or skipped entry\n", index);
+      goto L_EXIT;
+    }
+    entries[index].exec_id = -1;
+  }
+  if (check_error(dmp_dv_wait_any(entries, 3, &index), EINVAL, "dmp_dv_wait_any() with all entries skipped")) {
+    goto L_EXIT;
+  }
+  if (compare_output(mems[1], mems[2])) {
+    ERR("Outputs of the command lists executed at once differ\n");
+    goto L_EXIT;
+  }
+
+  // Entries with negative exec_id are skipped by dmp_dv_wait_all() even without command list
+  if (dmp_dv_cmdlist_exec_many(cmdlists, 2, exec_ids)) {
+    ERR("dmp_dv_cmdlist_exec_many() failed: %s\n", dmp_dv_get_last_error_message());
+    goto L_EXIT;
+  }
+  memset(entries, 0, sizeof(entries));
+  entries[0].cmdlist = cmdlists[0];
+  entries[0].exec_id = exec_ids[0];
+  entries[1].cmdlist = NULL;
+  entries[1].exec_id = -1;
+  entries[1].result = -1;
+  entries[2].cmdlist = cmdlists[1];
+  entries[2].exec_id = exec_ids[1];
+  entries[2].result = -1;
+  if (dmp_dv_wait_all(entries, 3)) {
+    ERR("dmp_dv_wait_all() failed: %s\n", dmp_dv_get_last_error_message());
+    goto L_EXIT;
+  }
+  if ((entries[0].result) || (entries[2].result)) {
+    ERR("dmp_dv_wait_all() returned 0 while execution results are %d and %d\n",
+        (int)entries[0].result, (int)entries[2].result);
+    goto L_EXIT;
+  }
+  if (entries[1].result != -1) {
+    ERR("dmp_dv_wait_all() has written result %d to the skipped entry\n", (int)entries[1].result);
+    goto L_EXIT;
+  }
+
+  // Execution id which was never returned must be rejected before waiting on any entry
+  entries[0].exec_id = exec_ids[0];
+  entries[1].cmdlist = cmdlists[1];
+  entries[1].exec_id = exec_ids[1] + 1000;
+  entries[2].exec_id = -1;
+  if (check_error(dmp_dv_wait_all(entries, 3), EINVAL, "dmp_dv_wait_all() with invalid exec_id")) {
+    goto L_EXIT;
+  }
+
+  result = 0;
+
+  L_EXIT:
+
+  dmp_dv_cmdlist_release(cmdlists[1]);
+  dmp_dv_cmdlist_release(cmdlists[0]);
+  for (int i = 2; i >= 0; --i) {
+    dmp_dv_mem_release(mems[i]);
+  }
+
+  LOG("EXIT%s: test_exec_many\n", result ? "(FAILED)" : "");
+  return result;
+}
+
+
+int test_wait_timeout(dmp_dv_context ctx) {
+  LOG("ENTER: test_wait_timeout\n");
+
+  int result = -1;
+  dmp_dv_mem mems[2] = {NULL, NULL};  // input, output
+  dmp_dv_cmdlist cmdlist = NULL;
+  int64_t exec_id = -1;
+
+  for (int i = 0; i < 2; ++i) {
+    mems[i] = dmp_dv_mem_alloc(ctx, IO_SIZE);
+    if (!mems[i]) {
+      ERR("dmp_dv_mem_alloc() failed: %s\n", dmp_dv_get_last_error_message());
+      goto L_EXIT;
+    }
+  }
+  if (fill_input(mems[0], 4)) {
+    goto L_EXIT;
+  }
+  cmdlist = create_cmdlist(ctx, mems[0], mems[1], 64);
+  if (!cmdlist) {
+    goto L_EXIT;
+  }
+
+  // Zero timeout only checks the state of the long execution which has just been scheduled
+  exec_id = dmp_dv_cmdlist_exec(cmdlist);
+  if (exec_id < 0) {
+    ERR("dmp_dv_cmdlist_exec() failed: %s\n", dmp_dv_get_last_error_message());
+    goto L_EXIT;
+  }
+  int res = check_error(dmp_dv_cmdlist_wait_timeout(cmdlist, exec_id, 0), ETIMEDOUT,
+                        "dmp_dv_cmdlist_wait_timeout() with zero timeout");
+  if (dmp_dv_cmdlist_wait_timeout(cmdlist, exec_id, 10000000)) {
+    ERR("dmp_dv_cmdlist_wait_timeout() failed: %s\n", dmp_dv_get_last_error_message());
+    goto L_EXIT;
+  }
+  if (res) {
+    goto L_EXIT;
+  }
+
+  // Completed execution is returned at once regardless of the timeout
+  if (dmp_dv_cmdlist_wait_timeout(cmdlist, exec_id, 0)) {
+    ERR("dmp_dv_cmdlist_wait_timeout() with zero timeout failed on completed execution: %s\n",
+        dmp_dv_get_last_error_message());
+    goto L_EXIT;
+  }
+  if (dmp_dv_cmdlist_wait_timeout(cmdlist, exec_id, -1)) {
+    ERR("dmp_dv_cmdlist_wait_timeout() with negative timeout failed on completed execution: %s\n",
+        dmp_dv_get_last_error_message());
+    goto L_EXIT;
+  }
+
+  if (check_error(dmp_dv_cmdlist_wait_timeout(cmdlist, exec_id + 1, 0), EINVAL,
+                  "dmp_dv_cmdlist_wait_timeout() with invalid exec_id")) {
+    goto L_EXIT;
+  }
+  if (check_error(dmp_dv_cmdlist_wait_timeout(NULL, exec_id, 0), EINVAL,
+                  "dmp_dv_cmdlist_wait_timeout() with NULL command list")) {
+    goto L_EXIT;
+  }
+
+  result = 0;
+
+  L_EXIT:
+
+  dmp_dv_cmdlist_release(cmdlist);
+  for (int i = 1; i >= 0; --i) {
+    dmp_dv_mem_release(mems[i]);
+  }
+
+  LOG("EXIT%s: test_wait_timeout\n", result ? "(FAILED)" : "");
+  return result;
+}
+
+
+int test_completion_fd() {
+  LOG("ENTER: test_completion_fd\n");
+
+  int result = -1;
+  dmp_dv_mem mems[2] = {NULL, NULL};  // input, output
+  dmp_dv_cmdlist cmdlist = NULL;
+  struct pollfd pfd;
+  uint64_t counter = 0;
+  int signaled = 0, res;
+
+  // Separate context, so the executions of the other tests are not tracked
+  dmp_dv_context ctx = dmp_dv_context_create();
+  if (!ctx) {
+    ERR("dmp_dv_context_create() failed: %s\n", dmp_dv_get_last_error_message());
+    goto L_EXIT;
+  }
+  pfd.fd = dmp_dv_context_get_completion_fd(ctx);
+  pfd.events = POLLIN;
+  if (pfd.fd < 0) {
+    ERR("dmp_dv_context_get_completion_fd() failed: %s\n", dmp_dv_get_last_error_message());
+    goto L_EXIT;
+  }
+  if (dmp_dv_context_get_completion_fd(ctx) != pfd.fd) {
+    ERR("dmp_dv_context_get_completion_fd() returned different descriptor on the second call\n");
+    goto L_EXIT;
+  }
+
+  for (int i = 0; i < 2; ++i) {
+    mems[i] = dmp_dv_mem_alloc(ctx, IO_SIZE);
+    if (!mems[i]) {
+      ERR("dmp_dv_mem_alloc() failed: %s\n", dmp_dv_get_last_error_message());
+      goto L_EXIT;
+    }
+  }
+  if (fill_input(mems[0], 5)) {
+    goto L_EXIT;
+  }
+  cmdlist = create_cmdlist(ctx, mems[0], mems[1], 16);
+  if (!cmdlist) {
+    goto L_EXIT;
+  }
+
+  // Plain execution must signal the descriptor as well
+  int64_t exec_id = dmp_dv_cmdlist_exec(cmdlist);
+  if (exec_id < 0) {
+    ERR("dmp_dv_cmdlist_exec() failed: %s\n", dmp_dv_get_last_error_message());
+    goto L_EXIT;
+  }
+  while ((res = dmp_dv_cmdlist_poll(cmdlist, exec_id)) == EAGAIN) {
+    if (poll(&pfd, 1, 10000) != 1) {
+      ERR("Completion descriptor was not signaled within 10 seconds\n");
+      goto L_EXIT;
+    }
+    if (read(pfd.fd, &counter, sizeof(counter)) != sizeof(counter)) {
+      ERR("read() from completion descriptor failed\n");
+      goto L_EXIT;
+    }
+    signaled = 1;
+  }
+  if (res) {
+    ERR("dmp_dv_cmdlist_poll() failed: %s\n", dmp_dv_get_last_error_message());
+    goto L_EXIT;
+  }
+  if (!signaled) {  // execution has completed before the first poll, the descriptor is signaled after that
+    if (poll(&pfd, 1, 10000) != 1) {
+      ERR("Completion descriptor was not signaled within 10 seconds\n");
+      goto L_EXIT;
+    }
+    if (read(pfd.fd, &counter, sizeof(counter)) != sizeof(counter)) {
+      ERR("read() from completion descriptor failed\n");
+      goto L_EXIT;
+    }
+  }
+  if ((read(pfd.fd, &counter, sizeof(counter)) >= 0) || (errno != EAGAIN)) {
+    ERR("Completion descriptor is blocking or was signaled more times than commands were executed\n");
+    goto L_EXIT;
+  }
+
+  if (check_error(dmp_dv_cmdlist_poll(cmdlist, exec_id + 1), EINVAL, "dmp_dv_cmdlist_poll() with invalid exec_id")) {
+    goto L_EXIT;
+  }
+
+  result = 0;
+
+  L_EXIT:
+
+  dmp_dv_cmdlist_release(cmdlist);
+  for (int i = 1; i >= 0; --i) {
+    dmp_dv_mem_release(mems[i]);
+  }
+  dmp_dv_context_release(ctx);
+
+  LOG("EXIT%s: test_completion_fd\n", result ? "(FAILED)" : "");
+  return result;
+}
+
+
+int test_serialize(dmp_dv_context ctx) {
+  LOG("ENTER: test_serialize\n");
+
+  int result = -1;
+  dmp_dv_mem mems[3] = {NULL, NULL, NULL};  // input, output0, output1
+  dmp_dv_mem table[2], restore_table[2];
+  dmp_dv_cmdlist cmdlist = NULL, restored = NULL;
+  uint8_t *blob = NULL, *copy = NULL;
+  size_t size = 0, small_size;
+
+  // Offsets of the fields in the blob, header of 40 bytes is followed by the descriptions of the commands
+  static const size_t s_fingerprint_offs[3] = {8, 12, 16};  // ub_size, svn_version, max_kernel_size
+  static const size_t s_magic_offs = 0, s_version_offs = 4, s_device_type_offs = 40 + 24;
+
+  for (int i = 0; i < 3; ++i) {
+    mems[i] = dmp_dv_mem_alloc(ctx, IO_SIZE);
+    if (!mems[i]) {
+      ERR("dmp_dv_mem_alloc() failed: %s\n", dmp_dv_get_last_error_message());
+      goto L_EXIT;
+    }
+  }
+  if (fill_input(mems[0], 6)) {
+    goto L_EXIT;
+  }
+  cmdlist = create_cmdlist(ctx, mems[0], mems[1], 2);
+  if (!cmdlist) {
+    goto L_EXIT;
+  }
+  table[0] = mems[0];
+  table[1] = mems[1];
+  restore_table[0] = mems[0];
+  restore_table[1] = mems[2];
+
+  if (dmp_dv_cmdlist_serialize(cmdlist, table, 2, NULL, &size)) {
+    ERR("dmp_dv_cmdlist_serialize() failed to return size: %s\n", dmp_dv_get_last_error_message());
+    goto L_EXIT;
+  }
+  blob = (uint8_t*)malloc(size);
+  copy = (uint8_t*)malloc(size);
+  if ((!blob) || (!copy)) {
+    ERR("malloc() failed for %zu bytes\n", size);
+    goto L_EXIT;
+  }
+  small_size = size - 1;
+  if (check_error(dmp_dv_cmdlist_serialize(cmdlist, table, 2, blob, &small_size), ENOSPC,
+                  "dmp_dv_cmdlist_serialize() to the small blob")) {
+    goto L_EXIT;
+  }
+  if (small_size != size) {
+    ERR("dmp_dv_cmdlist_serialize() returned required size %zu after ENOSPC while expecting %zu\n", small_size, size);
+    goto L_EXIT;
+  }
+  small_size = size;
+  if (check_error(dmp_dv_cmdlist_serialize(cmdlist, table, 1, blob, &small_size), EINVAL,
+                  "dmp_dv_cmdlist_serialize() without output memory in the buffer table")) {
+    goto L_EXIT;
+  }
+  if (dmp_dv_cmdlist_serialize(cmdlist, table, 2, blob, &size)) {
+    ERR("dmp_dv_cmdlist_serialize() failed: %s\n", dmp_dv_get_last_error_message());
+    goto L_EXIT;
+  }
+
+  // Restored command list writes to another memory, its output must match the output of the original one
+  restored = dmp_dv_cmdlist_deserialize(ctx, blob, size, restore_table, 2);
+  if (!restored) {
+    ERR("dmp_dv_cmdlist_deserialize() failed: %s\n", dmp_dv_get_last_error_message());
+    goto L_EXIT;
+  }
+  if ((exec_wait(cmdlist)) || (exec_wait(restored))) {
+    goto L_EXIT;
+  }
+  if (compare_output(mems[1], mems[2])) {
+    ERR("Output of the restored command list differs from the output of the original one\n");
+    goto L_EXIT;
+  }
+
+  // Blob created for the device with different capabilities
+  for (int i = 0; i < 3; ++i) {
+    memcpy(copy, blob, size);
+    ++*(int32_t*)(copy + s_fingerprint_offs[i]);
+    if (check_deserialize(ctx, copy, size, restore_table, 2, ESTALE,
+                          "dmp_dv_cmdlist_deserialize() of the blob for another device")) {
+      goto L_EXIT;
+    }
+  }
+
+  // Truncated and corrupted blobs
+  if ((check_deserialize(ctx, blob, size - 1, restore_table, 2, EINVAL,
+                         "dmp_dv_cmdlist_deserialize() of the truncated blob")) ||
+      (check_deserialize(ctx, blob, 16, restore_table, 2, EINVAL,
+                         "dmp_dv_cmdlist_deserialize() of the truncated header"))) {
+    goto L_EXIT;
+  }
+  memcpy(copy, blob, size);
+  ++*(uint32_t*)(copy + s_magic_offs);
+  if (check_deserialize(ctx, copy, size, restore_table, 2, EINVAL, "dmp_dv_cmdlist_deserialize() with bad magic")) {
+    goto L_EXIT;
+  }
+  memcpy(copy, blob, size);
+  ++*(uint32_t*)(copy + s_version_offs);
+  if (check_deserialize(ctx, copy, size, restore_table, 2, ENOTSUP,
+                        "dmp_dv_cmdlist_deserialize() of the unsupported version")) {
+    goto L_EXIT;
+  }
+  memcpy(copy, blob, size);
+  *(uint32_t*)(copy + s_device_type_offs) = 99;
+  if (check_deserialize(ctx, copy, size, restore_table, 2, EINVAL,
+                        "dmp_dv_cmdlist_deserialize() of the corrupted command")) {
+    goto L_EXIT;
+  }
+
+  // Buffer table without the memory referenced by the blob
+  restore_table[1] = NULL;
+  if ((check_deserialize(ctx, blob, size, restore_table, 2, EINVAL,
+                         "dmp_dv_cmdlist_deserialize() with NULL memory in the buffer table")) ||
+      (check_deserialize(ctx, blob, size, restore_table, 1, EINVAL,
+                         "dmp_dv_cmdlist_deserialize() with the short buffer table"))) {
+    goto L_EXIT;
+  }
+
+  result = 0;
+
+  L_EXIT:
+
+  free(copy);
+  free(blob);
+  dmp_dv_cmdlist_release(restored);
+  dmp_dv_cmdlist_release(cmdlist);
+  for (int i = 2; i >= 0; --i) {
+    dmp_dv_mem_release(mems[i]);
+  }
+
+  LOG("EXIT%s: test_serialize\n", result ? "(FAILED)" : "");
+  return result;
+}
+
+
+int main(int argc, char **argv) {
+  int n_ok = 0;
+  int n_err = 0;
+  int res = 0;
+
+  dmp_dv_context ctx = dmp_dv_context_create();
+  if (!ctx) {
+    ERR("dmp_dv_context_create() failed: %s\n", dmp_dv_get_last_error_message());
+    return -1;
+  }
+
+  res = test_rebind(ctx);
+  if (res) {
+    ++n_err;
+  }
+  else {
+    ++n_ok;
+  }
+
+  res = test_rebind_fc(ctx);
+  if (res) {
+    ++n_err;
+  }
+  else {
+    ++n_ok;
+  }
+
+  res = test_exec_many(ctx);
+  if (res) {
+    ++n_err;
+  }
+  else {
+    ++n_ok;
+  }
+
+  res = test_wait_timeout(ctx);
+  if (res) {
+    ++n_err;
+  }
+  else {
+    ++n_ok;
+  }
+
+  res = test_completion_fd();
+  if (res) {
+    ++n_err;
+  }
+  else {
+    ++n_ok;
+  }
+
+  res = test_serialize(ctx);
+  if (res) {
+    ++n_err;
+  }
+  else {
+    ++n_ok;
+  }
+
+  dmp_dv_context_release(ctx);
+
+  LOG("Tests succeeded: %d\n", n_ok);
+  LOG("Tests failed: %d\n", n_err);
+  return n_err;
+}
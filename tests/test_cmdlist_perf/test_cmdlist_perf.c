@@ -0,0 +1,311 @@
+/*
+ *  Copyright 2018 Digital Media Professionals Inc.
+
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+
+ *      http://www.apache.org/licenses/LICENSE-2.0
+
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+/*
+ * @brief Benchmark for command list construction and commit latency, restoring from the serialized form,
+ *        per-command execution profile.
+ */
+#include <unistd.h>
+#include <time.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "dmp_dv.h"
+#include "dmp_dv_cmdraw_v0.h"
+#include "../common/stats.h"
+
+
+#define LOG(...) fprintf(stdout, __VA_ARGS__); fflush(stdout)
+#define ERR(...) fprintf(stderr, __VA_ARGS__); fflush(stderr)
+
+
+static double get_ms(struct timespec *ts0, struct timespec *ts1) {
+  time_t dt_sec = ts1->tv_sec - ts0->tv_sec;
+  long dt_nsec = ts1->tv_nsec - ts0->tv_nsec;
+  if (dt_nsec < 0) {
+    dt_sec -= 1;
+    dt_nsec += 1000000000;
+  }
+  return 1.0e3 * dt_sec + 1.0e-6 * dt_nsec;
+}
+
+
+/// @brief Fills single-run LRN layer configuration which does not need weights.
+static void fill_conf(struct dmp_dv_cmdraw_conv_v0 *conf, dmp_dv_mem io_mem) {
+  memset(conf, 0, sizeof(*conf));
+
+  conf->input_buf.mem = io_mem;
+  conf->input_buf.offs = 0;
+
+  conf->output_buf.mem = io_mem;
+  conf->output_buf.offs = 0;
+
+  conf->header.size = sizeof(*conf);
+  conf->header.device_type = DMP_DV_DEV_CONV;
+  conf->header.version = 0;
+  conf->topo = 1;
+  conf->w = 56;
+  conf->h = 56;
+  conf->z = 1;
+  conf->c = 192;
+  conf->run[0].m = 192;
+  conf->run[0].p = 0x0101;
+  conf->run[0].pz = 1;
+  conf->run[0].conv_stride = 0x0101;
+  conf->run[0].pool_stride = 0x0101;
+  conf->run[0].lrn = 0x503;
+}
+
+
+int test_cmdlist_perf(dmp_dv_context ctx, dmp_dv_mem io_mem, int n_commands) {
+  LOG("ENTER: test_cmdlist_perf(%d)\n", n_commands);
+
+  int result = -1;
+  struct timespec ts0, ts1, ts2;
+  long max_mem_kb0 = 0, max_mem_kb1 = 0;
+  double utime, stime;
+  struct dmp_dv_cmdraw_conv_v0 conf;
+  fill_conf(&conf, io_mem);
+
+  get_exec_stats(&max_mem_kb0, &utime, &stime);
+
+  clock_gettime(CLOCK_MONOTONIC, &ts0);
+  dmp_dv_cmdlist cmdlist = dmp_dv_cmdlist_create(ctx);
+  if (!cmdlist) {
+    ERR("dmp_dv_cmdlist_create() failed: %s\n", dmp_dv_get_last_error_message());
+    goto L_EXIT;
+  }
+  for (int i = 0; i < n_commands; ++i) {
+    if (dmp_dv_cmdlist_add_raw(cmdlist, (struct dmp_dv_cmdraw*)&conf)) {
+      ERR("dmp_dv_cmdlist_add_raw() failed: %s\n", dmp_dv_get_last_error_message());
+      goto L_EXIT;
+    }
+  }
+  clock_gettime(CLOCK_MONOTONIC, &ts1);
+  if (dmp_dv_cmdlist_commit(cmdlist)) {
+    ERR("dmp_dv_cmdlist_commit() failed: %s\n", dmp_dv_get_last_error_message());
+    goto L_EXIT;
+  }
+  clock_gettime(CLOCK_MONOTONIC, &ts2);
+
+  get_exec_stats(&max_mem_kb1, &utime, &stime);
+
+  LOG("%d commands: add_raw %.3f usec/command, commit %.3f msec (%.3f usec/command), max RSS growth %ld KB\n",
+      n_commands, get_ms(&ts0, &ts1) * 1000.0 / n_commands,
+      get_ms(&ts1, &ts2), get_ms(&ts1, &ts2) * 1000.0 / n_commands, max_mem_kb1 - max_mem_kb0);
+
+  result = 0;
+
+  L_EXIT:
+
+  dmp_dv_cmdlist_release(cmdlist);
+
+  LOG("EXIT%s: test_cmdlist_perf(%d)\n", result ? "(FAILED)" : "", n_commands);
+  return result;
+}
+
+
+int test_cmdlist_serialize(dmp_dv_context ctx, dmp_dv_mem io_mem, int n_commands) {
+  LOG("ENTER: test_cmdlist_serialize(%d)\n", n_commands);
+
+  int result = -1;
+  struct timespec ts0, ts1, ts2;
+  size_t size = 0;
+  void *blob = NULL;
+  dmp_dv_cmdlist restored = NULL;
+  struct dmp_dv_cmdraw_conv_v0 conf;
+  fill_conf(&conf, io_mem);
+
+  clock_gettime(CLOCK_MONOTONIC, &ts0);
+  dmp_dv_cmdlist cmdlist = dmp_dv_cmdlist_create(ctx);
+  if (!cmdlist) {
+    ERR("dmp_dv_cmdlist_create() failed: %s\n", dmp_dv_get_last_error_message());
+    goto L_EXIT;
+  }
+  for (int i = 0; i < n_commands; ++i) {
+    if (dmp_dv_cmdlist_add_raw(cmdlist, (struct dmp_dv_cmdraw*)&conf)) {
+      ERR("dmp_dv_cmdlist_add_raw() failed: %s\n", dmp_dv_get_last_error_message());
+      goto L_EXIT;
+    }
+  }
+  if (dmp_dv_cmdlist_commit(cmdlist)) {
+    ERR("dmp_dv_cmdlist_commit() failed: %s\n", dmp_dv_get_last_error_message());
+    goto L_EXIT;
+  }
+  clock_gettime(CLOCK_MONOTONIC, &ts1);
+
+  if (dmp_dv_cmdlist_serialize(cmdlist, &io_mem, 1, NULL, &size)) {
+    ERR("dmp_dv_cmdlist_serialize() failed to return size: %s\n", dmp_dv_get_last_error_message());
+    goto L_EXIT;
+  }
+  blob = malloc(size);
+  if (!blob) {
+    ERR("malloc() failed for %zu bytes\n", size);
+    goto L_EXIT;
+  }
+  if (dmp_dv_cmdlist_serialize(cmdlist, &io_mem, 1, blob, &size)) {
+    ERR("dmp_dv_cmdlist_serialize() failed: %s\n", dmp_dv_get_last_error_message());
+    goto L_EXIT;
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &ts2);
+  restored = dmp_dv_cmdlist_deserialize(ctx, blob, size, &io_mem, 1);
+  if (!restored) {
+    ERR("dmp_dv_cmdlist_deserialize() failed: %s\n", dmp_dv_get_last_error_message());
+    goto L_EXIT;
+  }
+  struct timespec ts3;
+  clock_gettime(CLOCK_MONOTONIC, &ts3);
+
+  LOG("%d commands: build and commit %.3f msec, blob %zu bytes, deserialize %.3f msec\n",
+      n_commands, get_ms(&ts0, &ts1), size, get_ms(&ts2, &ts3));
+
+  int64_t exec_id = dmp_dv_cmdlist_exec(restored);
+  if (exec_id < 0) {
+    ERR("dmp_dv_cmdlist_exec() failed: %s\n", dmp_dv_get_last_error_message());
+    goto L_EXIT;
+  }
+  if (dmp_dv_cmdlist_wait(restored, exec_id)) {
+    ERR("dmp_dv_cmdlist_wait() failed: %s\n", dmp_dv_get_last_error_message());
+    goto L_EXIT;
+  }
+
+  result = 0;
+
+  L_EXIT:
+
+  dmp_dv_cmdlist_release(restored);
+  free(blob);
+  dmp_dv_cmdlist_release(cmdlist);
+
+  LOG("EXIT%s: test_cmdlist_serialize(%d)\n", result ? "(FAILED)" : "", n_commands);
+  return result;
+}
+
+
+int test_cmdlist_profile(dmp_dv_context ctx, dmp_dv_mem io_mem, int n_commands) {
+  LOG("ENTER: test_cmdlist_profile(%d)\n", n_commands);
+
+  int result = -1;
+  struct dmp_dv_cmd_profile profile[16];
+  struct dmp_dv_cmdraw_conv_v0 conf;
+  fill_conf(&conf, io_mem);
+
+  dmp_dv_cmdlist cmdlist = dmp_dv_cmdlist_create(ctx);
+  if (!cmdlist) {
+    ERR("dmp_dv_cmdlist_create() failed: %s\n", dmp_dv_get_last_error_message());
+    goto L_EXIT;
+  }
+  if (dmp_dv_cmdlist_set_profiling(cmdlist, 1)) {
+    ERR("dmp_dv_cmdlist_set_profiling() failed: %s\n", dmp_dv_get_last_error_message());
+    goto L_EXIT;
+  }
+  for (int i = 0; i < n_commands; ++i) {
+    if (dmp_dv_cmdlist_add_raw(cmdlist, (struct dmp_dv_cmdraw*)&conf)) {
+      ERR("dmp_dv_cmdlist_add_raw() failed: %s\n", dmp_dv_get_last_error_message());
+      goto L_EXIT;
+    }
+  }
+  if (dmp_dv_cmdlist_commit(cmdlist)) {
+    ERR("dmp_dv_cmdlist_commit() failed: %s\n", dmp_dv_get_last_error_message());
+    goto L_EXIT;
+  }
+  int64_t exec_id = dmp_dv_cmdlist_exec(cmdlist);
+  if (exec_id < 0) {
+    ERR("dmp_dv_cmdlist_exec() failed: %s\n", dmp_dv_get_last_error_message());
+    goto L_EXIT;
+  }
+  if (dmp_dv_cmdlist_wait(cmdlist, exec_id)) {
+    ERR("dmp_dv_cmdlist_wait() failed: %s\n", dmp_dv_get_last_error_message());
+    goto L_EXIT;
+  }
+  if (dmp_dv_cmdlist_get_profile(cmdlist, profile, 16) != n_commands) {
+    ERR("dmp_dv_cmdlist_get_profile() did not return %d commands: %s\n", n_commands, dmp_dv_get_last_error_message());
+    goto L_EXIT;
+  }
+  for (int i = 0; i < n_commands; ++i) {
+    LOG("%d: %lld usec, read %llu bytes, written %llu bytes, %.3f ops/byte\n", i, (long long)profile[i].exec_time,
+        (unsigned long long)profile[i].bytes_read, (unsigned long long)profile[i].bytes_written, profile[i].intensity);
+    if ((profile[i].exec_time < 0) || (profile[i].bytes_read != 56 * 56 * 192 * 2) ||
+        (profile[i].bytes_written != 56 * 56 * 192 * 2)) {
+      ERR("Unexpected profile of command %d\n", i);
+      goto L_EXIT;
+    }
+  }
+
+  result = 0;
+
+  L_EXIT:
+
+  dmp_dv_cmdlist_release(cmdlist);
+
+  LOG("EXIT%s: test_cmdlist_profile(%d)\n", result ? "(FAILED)" : "", n_commands);
+  return result;
+}
+
+
+int main(int argc, char **argv) {
+  int n_ok = 0;
+  int n_err = 0;
+  int res = 0;
+
+  dmp_dv_context ctx = dmp_dv_context_create();
+  if (!ctx) {
+    ERR("dmp_dv_context_create() failed: %s\n", dmp_dv_get_last_error_message());
+    return -1;
+  }
+  dmp_dv_mem io_mem = dmp_dv_mem_alloc(ctx, 56 * 56 * 192 * 2);
+  if (!io_mem) {
+    ERR("dmp_dv_mem_alloc() failed: %s\n", dmp_dv_get_last_error_message());
+    dmp_dv_context_release(ctx);
+    return -1;
+  }
+
+  const int n_commands[] = {1000, 2000, 5000, 10000};
+  for (int i = 0; i < (int)(sizeof(n_commands) / sizeof(n_commands[0])); ++i) {
+    res = test_cmdlist_perf(ctx, io_mem, n_commands[i]);
+    if (res) {
+      ++n_err;
+    }
+    else {
+      ++n_ok;
+    }
+  }
+
+  res = test_cmdlist_serialize(ctx, io_mem, 10000);
+  if (res) {
+    ++n_err;
+  }
+  else {
+    ++n_ok;
+  }
+
+  res = test_cmdlist_profile(ctx, io_mem, 4);
+  if (res) {
+    ++n_err;
+  }
+  else {
+    ++n_ok;
+  }
+
+  dmp_dv_mem_release(io_mem);
+  dmp_dv_context_release(ctx);
+
+  LOG("Tests succeeded: %d\n", n_ok);
+  LOG("Tests failed: %d\n", n_err);
+  return n_err;
+}
@@ -23,6 +23,7 @@
 
 #include <stdio.h>
 #include <string.h>
+#include <errno.h>
 
 #include "dmp_dv.h"
 #include "dmp_dv_cmdraw_v0.h"
@@ -38,7 +39,7 @@ int test_context() {
   LOG("ENTER: test_context\n");
   LOG("dmp_dv_get_version_string(): %s\n", dmp_dv_get_version_string());
 
-  if ((sizeof(struct dmp_dv_info_v0) & 7) || (sizeof(struct dmp_dv_buf) & 7) || (sizeof(struct dmp_dv_cmdraw) & 7) ||
+  if ((sizeof(struct dmp_dv_info_v0) & 7) || (sizeof(struct dmp_dv_info_v1) & 7) || (sizeof(struct dmp_dv_buf) & 7) || (sizeof(struct dmp_dv_cmdraw) & 7) ||
       (sizeof(struct dmp_dv_cmdraw_conv_v0_run) & 7) || (sizeof(struct dmp_dv_cmdraw_conv_v0) & 7) ||
       (sizeof(struct dmp_dv_cmdraw_fc_v0) & 7)) {
     ERR("Detected structure with size not multiple of 8\n");
@@ -55,6 +56,7 @@ int test_context() {
   CHECK_SIZEOF("__fp16", sizeof(__fp16),  2);
 
   CHECK_SIZEOF("dmp_dv_info_v0", sizeof(struct dmp_dv_info_v0), 32);
+  CHECK_SIZEOF("dmp_dv_info_v1", sizeof(struct dmp_dv_info_v1), 56);
   CHECK_SIZEOF("dmp_dv_buf", sizeof(struct dmp_dv_buf), 16);
   CHECK_SIZEOF("dmp_dv_cmdraw", sizeof(struct dmp_dv_cmdraw), 8);
   CHECK_SIZEOF("dmp_dv_cmdraw_conv_v0_run", sizeof(struct dmp_dv_cmdraw_conv_v0_run), 56);
@@ -73,6 +75,15 @@ int test_context() {
   }
   LOG("Successfully created context: %s\n", dmp_dv_context_get_info_string(ctx));
 
+  int code = 0;
+  const char *msg = NULL;
+  if ((!dmp_dv_context_get_info(NULL, NULL)) || (dmp_dv_get_last_error(&code, &msg) != EINVAL) ||
+      (code != EINVAL) || (!msg) || (strcmp(msg, "Invalid argument: ctx is NULL"))) {
+    ERR("dmp_dv_get_last_error() returned unexpected error: code=%d msg=%s\n", code, msg ? msg : "NULL");
+    dmp_dv_context_release(ctx);
+    return -1;
+  }
+
   struct dmp_dv_info_v0 info;
   info.header.size = sizeof(info);
   info.header.version = 0;
@@ -97,6 +108,35 @@ int test_context() {
     return -1;
   }
 
+  // Version which does not fit the provided size must not be reported
+  info.header.version = 1;
+  if ((dmp_dv_context_get_info(ctx, (struct dmp_dv_info*)&info)) || (info.header.version != 0)) {
+    ERR("dmp_dv_context_get_info() reported version %u for the structure of version 0 size\n", info.header.version);
+    dmp_dv_context_release(ctx);
+    return -1;
+  }
+
+  struct dmp_dv_info_v1 info1;
+  memset(&info1, 0xFF, sizeof(info1));
+  info1.header.size = sizeof(info1);
+  info1.header.version = 100;
+  if (dmp_dv_context_get_info(ctx, (struct dmp_dv_info*)&info1)) {
+    ERR("dmp_dv_context_get_info() failed: %s\n", dmp_dv_get_last_error_message());
+    dmp_dv_context_release(ctx);
+    return -1;
+  }
+
+  LOG("mac_num=%d\nsvn_version=%d\nzia_c2=%d\nfeatures=0x%x\npeak_macs=%llu\n",
+      info1.mac_num, info1.svn_version, info1.zia_c2, info1.features, (unsigned long long)info1.peak_macs);
+
+  if ((info1.header.version != 1) || (info1.ub_size != info.ub_size) || (info1.conv_freq != info.conv_freq) ||
+      (info1.mac_num < 0) || (info1.svn_version < 0) || (info1.zia_c2 < 0) ||
+      (info1.peak_macs != (uint64_t)info1.mac_num * (uint64_t)info1.conv_freq * 1000000ull)) {
+    ERR("dmp_dv_context_get_info() returned some invalid values for version 1\n");
+    dmp_dv_context_release(ctx);
+    return -1;
+  }
+
   dmp_dv_context_release(ctx);
 
   static int s_n_fd = -1;
@@ -138,11 +178,141 @@ int test_context() {
 }
 
 
+static double get_us(struct timespec *ts0, struct timespec *ts1) {
+  return (double)(ts1->tv_sec - ts0->tv_sec) * 1.0e6 + (double)(ts1->tv_nsec - ts0->tv_nsec) * 1.0e-3;
+}
+
+
+int test_context_create_perf(int n_iter) {
+  LOG("ENTER: test_context_create_perf(%d)\n", n_iter);
+
+  struct timespec ts0, ts1;
+  dmp_dv_context ctx;
+
+  // The first context in the process probes the device
+  clock_gettime(CLOCK_MONOTONIC, &ts0);
+  ctx = dmp_dv_context_create();
+  clock_gettime(CLOCK_MONOTONIC, &ts1);
+  if (!ctx) {
+    ERR("dmp_dv_context_create() failed: %s\n", dmp_dv_get_last_error_message());
+    return -1;
+  }
+  dmp_dv_context_release(ctx);
+  LOG("First dmp_dv_context_create(): %.1f usec\n", get_us(&ts0, &ts1));
+
+  clock_gettime(CLOCK_MONOTONIC, &ts0);
+  for (int i = 0; i < n_iter; ++i) {
+    ctx = dmp_dv_context_create();
+    if (!ctx) {
+      ERR("dmp_dv_context_create() failed: %s\n", dmp_dv_get_last_error_message());
+      return -1;
+    }
+    dmp_dv_context_release(ctx);
+  }
+  clock_gettime(CLOCK_MONOTONIC, &ts1);
+  LOG("Shared dmp_dv_context_create() + release: %.1f usec\n", get_us(&ts0, &ts1) / n_iter);
+
+  clock_gettime(CLOCK_MONOTONIC, &ts0);
+  for (int i = 0; i < n_iter; ++i) {
+    if (dmp_dv_context_refresh_device_info()) {
+      ERR("dmp_dv_context_refresh_device_info() failed: %s\n", dmp_dv_get_last_error_message());
+      return -1;
+    }
+    ctx = dmp_dv_context_create();
+    if (!ctx) {
+      ERR("dmp_dv_context_create() failed: %s\n", dmp_dv_get_last_error_message());
+      return -1;
+    }
+    dmp_dv_context_release(ctx);
+  }
+  clock_gettime(CLOCK_MONOTONIC, &ts1);
+  LOG("Probing dmp_dv_context_create() + release: %.1f usec\n", get_us(&ts0, &ts1) / n_iter);
+
+  LOG("EXIT: test_context_create_perf(%d)\n", n_iter);
+  return 0;
+}
+
+
+int test_paths() {
+  LOG("ENTER: test_paths\n");
+
+  // Probe must fail with the errno of open() when ION is not there
+  if (dmp_dv_set_path(DMP_DV_PATH_ION, "/nonexistent/ion")) {
+    ERR("dmp_dv_set_path() failed: %s\n", dmp_dv_get_last_error_message());
+    return -1;
+  }
+  int res = dmp_dv_context_refresh_device_info();
+  int code = dmp_dv_get_last_error(NULL, NULL);
+  dmp_dv_set_path(DMP_DV_PATH_ION, NULL);
+  if ((!res) || (code != ENOENT)) {
+    ERR("dmp_dv_context_refresh_device_info() with nonexistent ION returned %d with code %d\n", res, code);
+    return -1;
+  }
+
+  // Long path followed by another string argument must be truncated in the message
+  char long_path[301];
+  memset(long_path, 'a', sizeof(long_path) - 1);
+  long_path[0] = '/';
+  long_path[sizeof(long_path) - 1] = 0;
+  if (dmp_dv_set_path(DMP_DV_PATH_ION, long_path)) {
+    ERR("dmp_dv_set_path() failed: %s\n", dmp_dv_get_last_error_message());
+    return -1;
+  }
+  res = dmp_dv_context_refresh_device_info();
+  const char *msg = NULL;
+  code = dmp_dv_get_last_error(NULL, &msg);
+  dmp_dv_set_path(DMP_DV_PATH_ION, NULL);
+  if ((!res) || (code == 0) || (!msg) || (strncmp(msg, "open() failed for /aaa", 22)) || (strlen(msg) > 255)) {
+    ERR("dmp_dv_context_refresh_device_info() with long ION path returned %d with code %d: %s\n",
+        res, code, msg ? msg : "NULL");
+    return -1;
+  }
+
+  if (!dmp_dv_set_path(DMP_DV_PATH_COUNT, "/dev/ion")) {
+    ERR("dmp_dv_set_path() succeeded for invalid path id\n");
+    return -1;
+  }
+
+  if (dmp_dv_context_refresh_device_info()) {
+    ERR("dmp_dv_context_refresh_device_info() failed: %s\n", dmp_dv_get_last_error_message());
+    return -1;
+  }
+  dmp_dv_context ctx = dmp_dv_context_create();
+  if (!ctx) {
+    ERR("dmp_dv_context_create() failed: %s\n", dmp_dv_get_last_error_message());
+    return -1;
+  }
+  for (int i = 0; i < DMP_DV_PATH_COUNT; ++i) {
+    LOG("dmp_dv_context_get_path(%d): %s\n", i, dmp_dv_context_get_path(ctx, i));
+  }
+  dmp_dv_context_release(ctx);
+
+  LOG("EXIT: test_paths\n");
+  return 0;
+}
+
+
 int main(int argc, char **argv) {
   int n_ok = 0;
   int n_err = 0;
   int res = 0;
 
+  res = test_context_create_perf(100);
+  if (res) {
+    ++n_err;
+  }
+  else {
+    ++n_ok;
+  }
+
+  res = test_paths();
+  if (res) {
+    ++n_err;
+  }
+  else {
+    ++n_ok;
+  }
+
   for (int i = 0; i < 3; ++i) {
     res = test_context();
     if (res) {
@@ -320,6 +320,160 @@ error:
     }
   }
 
+  /// @brief Fills IPU -> CONV -> MAXIMIZER pipeline reading texture at offset 0 and writing to the given offsets.
+  void fill_mixed_cmds(struct dmp_dv_cmdraw_ipu_v0 &ipu, struct dmp_dv_cmdraw_conv_v0 &conv,
+                       struct dmp_dv_cmdraw_maximizer_v0 &maxi, dmp_dv_mem mem,
+                       uint64_t ipu_offs, uint64_t conv_offs, uint64_t max_offs) {
+    // 64x32 RGB888 texture converted to FP16
+    memset(&ipu, 0, sizeof(ipu));
+    ipu.header.size = sizeof(ipu);
+    ipu.header.device_type = DMP_DV_DEV_IPU;
+    ipu.header.version = 0;
+    ipu.tex.mem = mem;
+    ipu.tex.offs = 0;
+    ipu.wr.mem = mem;
+    ipu.wr.offs = ipu_offs;
+    ipu.fmt_tex = DMP_DV_RGB888;
+    ipu.fmt_wr = DMP_DV_RGBFP16;
+    ipu.tex_width = 64;
+    ipu.tex_height = 32;
+    ipu.rect_width = 64;
+    ipu.rect_height = 32;
+    ipu.stride_wr = 64 * 3 * 2;
+    ipu.use_tex = 1;
+    ipu.ridx = 0;
+    ipu.gidx = 1;
+    ipu.bidx = 2;
+    ipu.aidx = -1;
+    ipu.cnv_type = DMP_DV_CNV_FP16_DIV_255;
+
+    // 2x2 max pooling of the IPU output viewed as 32x24x8
+    memset(&conv, 0, sizeof(conv));
+    conv.header.size = sizeof(conv);
+    conv.header.device_type = DMP_DV_DEV_CONV;
+    conv.header.version = 0;
+    conv.input_buf.mem = mem;
+    conv.input_buf.offs = ipu_offs;
+    conv.output_buf.mem = mem;
+    conv.output_buf.offs = conv_offs;
+    conv.topo = 1;
+    conv.w = 32;
+    conv.h = 24;
+    conv.z = 1;
+    conv.c = 8;
+    conv.run[0].m = 8;
+    conv.run[0].conv_enable = 0;
+    conv.run[0].p = 1;
+    conv.run[0].pz = 1;
+    conv.run[0].conv_stride = 0x0101;
+    conv.run[0].pool_enable = 1;
+    conv.run[0].pool_size = 0x0202;
+    conv.run[0].pool_stride = 0x0202;
+
+    // Argmax over 8 classes of 16x12 pooled output
+    memset(&maxi, 0, sizeof(maxi));
+    maxi.header.size = sizeof(maxi);
+    maxi.header.device_type = DMP_DV_DEV_MAXIMIZER;
+    maxi.header.version = 0;
+    maxi.input_buf.mem = mem;
+    maxi.input_buf.offs = conv_offs;
+    maxi.output_buf.mem = mem;
+    maxi.output_buf.offs = max_offs;
+    maxi.width = 16;
+    maxi.height = 12;
+    maxi.nclass = 8;
+  }
+
+  /// @brief Executes command list and waits for it.
+  int exec_wait(dmp_dv_cmdlist cmdlist) {
+    int64_t exec_id = dmp_dv_cmdlist_exec(cmdlist);
+    if (exec_id < 0) {
+      return -1;
+    }
+    return dmp_dv_cmdlist_wait(cmdlist, exec_id);
+  }
+
+  /// @brief Checks that a single command list mixing IPU, CONV and MAXIMIZER produces
+  ///        the same output as three separate command lists.
+  int test_mixed_devices(dmp_dv_context ctx, dmp_dv_mem mem, uint8_t *map) {
+    cout << COLOR_YELLOW << "[TEST START]" << COLOR_WHITE << " IPU -> CONV -> MAXIMIZER in one command list" << endl;
+
+    const uint64_t offs[2][3] = {{0x1000, 0x4000, 0x5000}, {0x6000, 0x9000, 0xA000}};
+    const size_t sizes[3] = {64 * 32 * 3 * 2, 16 * 12 * 8 * 2, 16 * 12};
+    struct dmp_dv_cmdraw_ipu_v0 ipu;
+    struct dmp_dv_cmdraw_conv_v0 conv;
+    struct dmp_dv_cmdraw_maximizer_v0 maxi;
+    struct dmp_dv_cmdraw *cmds[3] = {
+      reinterpret_cast<struct dmp_dv_cmdraw*>(&ipu), reinterpret_cast<struct dmp_dv_cmdraw*>(&conv),
+      reinterpret_cast<struct dmp_dv_cmdraw*>(&maxi)};
+    dmp_dv_cmdlist mixed = nullptr;
+    dmp_dv_cmdlist separate[3] = {nullptr, nullptr, nullptr};
+    int result = -1;
+
+    if (cma_size < 0xB000) {
+      PERR("Not enough memory for the test");
+      return -1;
+    }
+    for (int i = 0; i < 64 * 32 * 3; ++i) {
+      map[i] = static_cast<uint8_t>(rand());
+    }
+    memset(map + 0x1000, 0, 0xA000);
+    if ((dmp_dv_mem_sync_start(mem, 0, 1)) || (dmp_dv_mem_sync_end(mem))) {
+      PERR("dmp_dv_mem_sync_start() failed: %s", dmp_dv_get_last_error_message());
+      return -1;
+    }
+
+    fill_mixed_cmds(ipu, conv, maxi, mem, offs[0][0], offs[0][1], offs[0][2]);
+    mixed = dmp_dv_cmdlist_create(ctx);
+    if (!mixed) {
+      PERR("dmp_dv_cmdlist_create() failed: %s", dmp_dv_get_last_error_message());
+      goto L_EXIT;
+    }
+    for (int i = 0; i < 3; ++i) {
+      if (dmp_dv_cmdlist_add_raw(mixed, cmds[i])) {
+        PERR("dmp_dv_cmdlist_add_raw() failed: %s", dmp_dv_get_last_error_message());
+        goto L_EXIT;
+      }
+    }
+    if ((dmp_dv_cmdlist_commit(mixed)) || (exec_wait(mixed))) {
+      PERR("Execution of the mixed command list failed: %s", dmp_dv_get_last_error_message());
+      goto L_EXIT;
+    }
+
+    fill_mixed_cmds(ipu, conv, maxi, mem, offs[1][0], offs[1][1], offs[1][2]);
+    for (int i = 0; i < 3; ++i) {
+      separate[i] = dmp_dv_cmdlist_create(ctx);
+      if ((!separate[i]) || (dmp_dv_cmdlist_add_raw(separate[i], cmds[i])) ||
+          (dmp_dv_cmdlist_commit(separate[i])) || (exec_wait(separate[i]))) {
+        PERR("Execution of the command list %d failed: %s", i, dmp_dv_get_last_error_message());
+        goto L_EXIT;
+      }
+    }
+
+    if (dmp_dv_mem_sync_start(mem, 1, 0)) {
+      PERR("dmp_dv_mem_sync_start() failed: %s", dmp_dv_get_last_error_message());
+      goto L_EXIT;
+    }
+    result = 0;
+    for (int i = 0; i < 3; ++i) {
+      if (memcmp(map + offs[0][i], map + offs[1][i], sizes[i])) {
+        PERR("Output of the command %d in the mixed command list differs from the separate execution", i);
+        result = -1;
+      }
+    }
+    dmp_dv_mem_sync_end(mem);
+
+L_EXIT:
+    for (int i = 2; i >= 0; --i) {
+      dmp_dv_cmdlist_release(separate[i]);
+    }
+    dmp_dv_cmdlist_release(mixed);
+
+    cout << "\n\tRESULT : " << (result ? COLOR_RED : COLOR_GREEN) << (result ? "FAILED" : "SUCCESSED")
+         << COLOR_WHITE << "\n" << endl;
+    return result;
+  }
+
   void log_overall_result(unsigned success, unsigned failed, unsigned not_tested) {
     cout << COLOR_YELLOW << "Overall Result\n"
       << COLOR_GREEN << "\tSuccessed Test : " << COLOR_WHITE << success << "\n"
@@ -377,6 +531,14 @@ int main(int argc, char const **argv) {
     }
   }
 
+  if (test_mixed_devices(context, phys_mem, phys_map)) {
+    n_fail++;
+    ret = -1;
+  }
+  else {
+    n_succ++;
+  }
+
   log_overall_result(n_succ, n_fail, n_not_tested);
 
 error:
@@ -25,6 +25,7 @@
 #include <string.h>
 
 #include <dmp_dv.h>
+#include <dmp_dv_cmdraw_v0.h>
 
 
 #define LOG(...) fprintf(stdout, __VA_ARGS__); fflush(stdout)
@@ -215,6 +216,463 @@ int mem_perf(size_t size, uint32_t state[4]) {
 }
 
 
+static int count_fds() {
+  int n_fd = 0;
+  DIR *d;
+  struct dirent *dir;
+  d = opendir("/proc/self/fd");
+  if (!d) {
+    ERR("Could not open \"/proc/self/fd\" folder\n");
+    return -1;
+  }
+  while ((dir = readdir(d))) {
+    char *fnme = dir->d_name;
+    int num = 1;
+    for (; *fnme; ++fnme) {
+      if ((*fnme >= '0') && (*fnme <= '9')) {
+        continue;
+      }
+      num = 0;
+      break;
+    }
+    if (num) {
+      ++n_fd;
+    }
+  }
+  closedir(d);
+  return n_fd;
+}
+
+
+static int alloc_release_loop(dmp_dv_context ctx, size_t size, int n_iter, double *ms) {
+  struct timespec ts0, ts1;
+  clock_gettime(CLOCK_MONOTONIC, &ts0);
+  for (int i = 0; i < n_iter; ++i) {
+    dmp_dv_mem mem = dmp_dv_mem_alloc(ctx, size);
+    if (!mem) {
+      ERR("dmp_dv_mem_alloc() failed: %s\n", dmp_dv_get_last_error_message());
+      return -1;
+    }
+    dmp_dv_mem_release(mem);
+  }
+  clock_gettime(CLOCK_MONOTONIC, &ts1);
+  *ms = get_ms(&ts0, &ts1);
+  return 0;
+}
+
+
+int mem_pool_perf(size_t size, int n_iter) {
+  LOG("ENTER: mem_pool_perf(%zu, %d)\n", size, n_iter);
+
+  int result = -1;
+  double ms_unpooled = 0, ms_pooled = 0;
+  struct dmp_dv_mem_pool_stats stats;
+  const int n_fd0 = count_fds();
+
+  dmp_dv_context ctx = dmp_dv_context_create();
+  if (!ctx) {
+    ERR("dmp_dv_context_create() failed: %s\n", dmp_dv_get_last_error_message());
+    goto L_EXIT;
+  }
+
+  if (alloc_release_loop(ctx, size, n_iter, &ms_unpooled)) {
+    goto L_EXIT;
+  }
+  LOG("alloc+release(%zu) unpooled: %.3f msec\n", size, ms_unpooled / n_iter);
+
+  if (dmp_dv_mem_pool_enable(ctx, size << 2)) {
+    ERR("dmp_dv_mem_pool_enable() failed: %s\n", dmp_dv_get_last_error_message());
+    goto L_EXIT;
+  }
+  if (alloc_release_loop(ctx, size, n_iter, &ms_pooled)) {
+    goto L_EXIT;
+  }
+  LOG("alloc+release(%zu) pooled: %.3f msec\n", size, ms_pooled / n_iter);
+
+  if (dmp_dv_mem_pool_get_stats(ctx, &stats)) {
+    ERR("dmp_dv_mem_pool_get_stats() failed: %s\n", dmp_dv_get_last_error_message());
+    goto L_EXIT;
+  }
+  LOG("pool: hits=%llu misses=%llu n_cached=%llu cached_bytes=%llu\n",
+      (unsigned long long)stats.hits, (unsigned long long)stats.misses,
+      (unsigned long long)stats.n_cached, (unsigned long long)stats.cached_bytes);
+  if ((stats.misses != 1) || (stats.hits != (uint64_t)(n_iter - 1)) || (stats.n_cached != 1)) {
+    ERR("Unexpected pool statistics\n");
+    goto L_EXIT;
+  }
+
+  dmp_dv_mem_pool_trim(ctx, 0);
+  dmp_dv_mem_pool_get_stats(ctx, &stats);
+  if ((stats.n_cached) || (stats.cached_bytes)) {
+    ERR("dmp_dv_mem_pool_trim() left %llu allocations in the pool\n", (unsigned long long)stats.n_cached);
+    goto L_EXIT;
+  }
+
+  result = 0;
+
+  L_EXIT:
+
+  dmp_dv_context_release(ctx);
+
+  if (dmp_dv_mem_get_total_size()) {
+    ERR("dmp_dv_mem_get_total_size() returned non-zero: %lld\n",
+        (long long)dmp_dv_mem_get_total_size());
+    result = -1;
+  }
+  if (count_fds() != n_fd0) {
+    ERR("Inconsistent file descriptor count detected, memory leak is probable\n");
+    result = -1;
+  }
+
+  LOG("EXIT%s: mem_pool_perf(%zu, %d)\n", result ? "(FAILED)" : "", size, n_iter);
+  return result;
+}
+
+
+static int to_device_loop(dmp_dv_mem mem, size_t size, int n_iter, double *ms) {
+  struct timespec ts0, ts1;
+  uint8_t *ptr = dmp_dv_mem_map(mem);
+  if (!ptr) {
+    ERR("dmp_dv_mem_map() failed: %s\n", dmp_dv_get_last_error_message());
+    return -1;
+  }
+  *ms = 0;
+  for (int i = 0; i < n_iter; ++i) {
+    memset(ptr, i, size);
+    clock_gettime(CLOCK_MONOTONIC, &ts0);
+    if (dmp_dv_mem_to_device(mem, 0, size, 0)) {
+      ERR("dmp_dv_mem_to_device() failed: %s\n", dmp_dv_get_last_error_message());
+      return -1;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &ts1);
+    *ms += get_ms(&ts0, &ts1);
+  }
+  *ms /= n_iter;
+  return 0;
+}
+
+
+int cache_perf(size_t size, int n_iter) {
+  LOG("ENTER: cache_perf(%zu, %d)\n", size, n_iter);
+
+  int result = -1;
+  double ms_lines = 0, ms_engine = 0;
+  struct dmp_dv_cache_params params0, params, lines_only;
+  dmp_dv_mem mem = NULL;
+
+  dmp_dv_cache_get_params(&params0);
+
+  dmp_dv_context ctx = dmp_dv_context_create();
+  if (!ctx) {
+    ERR("dmp_dv_context_create() failed: %s\n", dmp_dv_get_last_error_message());
+    goto L_EXIT;
+  }
+
+  if (dmp_dv_cache_calibrate(ctx, &params)) {
+    ERR("dmp_dv_cache_calibrate() failed: %s\n", dmp_dv_get_last_error_message());
+    goto L_EXIT;
+  }
+  LOG("cache params: line_ns=%.3f sync_fixed_ns=%.0f sync_byte_ns=%.4f thread_ns=%.0f max_threads=%d\n",
+      params.line_ns, params.sync_fixed_ns, params.sync_byte_ns, params.thread_ns, params.max_threads);
+
+  mem = dmp_dv_mem_alloc(ctx, size);
+  if (!mem) {
+    ERR("dmp_dv_mem_alloc() failed: %s\n", dmp_dv_get_last_error_message());
+    goto L_EXIT;
+  }
+
+  lines_only = params;
+  lines_only.max_threads = 1;
+  lines_only.use_dma_buf_sync = 0;
+  dmp_dv_cache_set_params(&lines_only);
+  if (to_device_loop(mem, size, n_iter, &ms_lines)) {
+    goto L_EXIT;
+  }
+  LOG("to_device(%zu) single thread per-line: %.3f msec\n", size, ms_lines);
+
+  dmp_dv_cache_set_params(&params);
+  if (to_device_loop(mem, size, n_iter, &ms_engine)) {
+    goto L_EXIT;
+  }
+  LOG("to_device(%zu) calibrated: %.3f msec\n", size, ms_engine);
+
+  result = 0;
+
+  L_EXIT:
+
+  dmp_dv_cache_set_params(&params0);
+  dmp_dv_mem_release(mem);
+  dmp_dv_context_release(ctx);
+
+  LOG("EXIT%s: cache_perf(%zu, %d)\n", result ? "(FAILED)" : "", size, n_iter);
+  return result;
+}
+
+
+int upload_perf(size_t size, int n_iter) {
+  LOG("ENTER: upload_perf(%zu, %d)\n", size, n_iter);
+
+  static const int modes[3] = {DMP_DV_MEM_CACHED, DMP_DV_MEM_UNCACHED, DMP_DV_MEM_WRITE_COMBINED};
+  static const char *mode_names[3] = {"cached", "uncached", "write-combined"};
+  int result = -1;
+  struct timespec ts0, ts1;
+  dmp_dv_mem mem = NULL;
+  uint8_t *ptr;
+
+  uint8_t *src = (uint8_t*)malloc(size);
+  if (!src) {
+    ERR("malloc() failed for %zu bytes\n", size);
+    return -1;
+  }
+  memset(src, 0x5A, size);
+
+  dmp_dv_context ctx = dmp_dv_context_create();
+  if (!ctx) {
+    ERR("dmp_dv_context_create() failed: %s\n", dmp_dv_get_last_error_message());
+    goto L_EXIT;
+  }
+
+  for (int i_mode = 0; i_mode < 3; ++i_mode) {
+    mem = dmp_dv_mem_alloc_ex(ctx, size, modes[i_mode]);
+    if (!mem) {
+      ERR("dmp_dv_mem_alloc_ex() failed: %s\n", dmp_dv_get_last_error_message());
+      goto L_EXIT;
+    }
+    ptr = dmp_dv_mem_map(mem);
+    if (!ptr) {
+      ERR("dmp_dv_mem_map() failed: %s\n", dmp_dv_get_last_error_message());
+      goto L_EXIT;
+    }
+    memcpy(ptr, src, size);  // warm up page tables
+    clock_gettime(CLOCK_MONOTONIC, &ts0);
+    for (int i = 0; i < n_iter; ++i) {
+      memcpy(ptr, src, size);
+      if (dmp_dv_mem_to_device(mem, 0, size, DMP_DV_MEM_CPU_WONT_READ)) {
+        ERR("dmp_dv_mem_to_device() failed: %s\n", dmp_dv_get_last_error_message());
+        goto L_EXIT;
+      }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &ts1);
+    const double ms = get_ms(&ts0, &ts1);
+    LOG("upload(%zu, %s): %.3f msec, %.1f MB/s\n", size, mode_names[i_mode], ms / n_iter,
+        (double)size * n_iter / (ms * 1.0e3));
+    dmp_dv_mem_release(mem);
+    mem = NULL;
+  }
+
+  result = 0;
+
+  L_EXIT:
+
+  dmp_dv_mem_release(mem);
+  dmp_dv_context_release(ctx);
+  free(src);
+
+  LOG("EXIT%s: upload_perf(%zu, %d)\n", result ? "(FAILED)" : "", size, n_iter);
+  return result;
+}
+
+
+int copy_perf(size_t size, int n_iter) {
+  LOG("ENTER: copy_perf(%zu, %d)\n", size, n_iter);
+
+  int result = -1;
+  struct timespec ts0, ts1;
+  dmp_dv_mem src = NULL, dst = NULL;
+  uint8_t *src_ptr, *dst_ptr;
+  double ms;
+
+  dmp_dv_context ctx = dmp_dv_context_create();
+  if (!ctx) {
+    ERR("dmp_dv_context_create() failed: %s\n", dmp_dv_get_last_error_message());
+    goto L_EXIT;
+  }
+  src = dmp_dv_mem_alloc(ctx, size);
+  dst = dmp_dv_mem_alloc(ctx, size);
+  if ((!src) || (!dst)) {
+    ERR("dmp_dv_mem_alloc() failed: %s\n", dmp_dv_get_last_error_message());
+    goto L_EXIT;
+  }
+  src_ptr = dmp_dv_mem_map(src);
+  dst_ptr = dmp_dv_mem_map(dst);
+  if ((!src_ptr) || (!dst_ptr)) {
+    ERR("dmp_dv_mem_map() failed: %s\n", dmp_dv_get_last_error_message());
+    goto L_EXIT;
+  }
+  memset(src_ptr, 0x5A, size);
+  memset(dst_ptr, 0, size);  // warm up page tables
+
+  clock_gettime(CLOCK_MONOTONIC, &ts0);
+  for (int i = 0; i < n_iter; ++i) {
+    memcpy(dst_ptr, src_ptr, size);
+    if (dmp_dv_mem_to_device(dst, 0, size, DMP_DV_MEM_CPU_WONT_READ)) {
+      ERR("dmp_dv_mem_to_device() failed: %s\n", dmp_dv_get_last_error_message());
+      goto L_EXIT;
+    }
+  }
+  clock_gettime(CLOCK_MONOTONIC, &ts1);
+  ms = get_ms(&ts0, &ts1);
+  LOG("memcpy + to_device(%zu): %.3f msec, %.1f MB/s\n", size, ms / n_iter, (double)size * n_iter / (ms * 1.0e3));
+
+  clock_gettime(CLOCK_MONOTONIC, &ts0);
+  for (int i = 0; i < n_iter; ++i) {
+    if (dmp_dv_mem_copy(dst, 0, src, 0, size, DMP_DV_MEM_CPU_WONT_READ)) {
+      ERR("dmp_dv_mem_copy() failed: %s\n", dmp_dv_get_last_error_message());
+      goto L_EXIT;
+    }
+  }
+  clock_gettime(CLOCK_MONOTONIC, &ts1);
+  ms = get_ms(&ts0, &ts1);
+  LOG("dmp_dv_mem_copy(%zu): %.3f msec, %.1f MB/s\n", size, ms / n_iter, (double)size * n_iter / (ms * 1.0e3));
+
+  clock_gettime(CLOCK_MONOTONIC, &ts0);
+  for (int i = 0; i < n_iter; ++i) {
+    if (dmp_dv_mem_fill(dst, 0, 0, size, DMP_DV_MEM_CPU_WONT_READ)) {
+      ERR("dmp_dv_mem_fill() failed: %s\n", dmp_dv_get_last_error_message());
+      goto L_EXIT;
+    }
+  }
+  clock_gettime(CLOCK_MONOTONIC, &ts1);
+  ms = get_ms(&ts0, &ts1);
+  LOG("dmp_dv_mem_fill(%zu): %.3f msec, %.1f MB/s\n", size, ms / n_iter, (double)size * n_iter / (ms * 1.0e3));
+
+  result = 0;
+
+  L_EXIT:
+
+  dmp_dv_mem_release(dst);
+  dmp_dv_mem_release(src);
+  dmp_dv_context_release(ctx);
+
+  LOG("EXIT%s: copy_perf(%zu, %d)\n", result ? "(FAILED)" : "", size, n_iter);
+  return result;
+}
+
+
+/// @brief Checks that waiting on a command list with managed coherency does no maintenance for unmapped output.
+int managed_output_test() {
+  LOG("ENTER: managed_output_test()\n");
+
+  int result = -1;
+  const size_t size = 56 * 56 * 192 * 2;
+  dmp_dv_mem input_mem = NULL, output_mem = NULL;
+  dmp_dv_cmdlist cmdlist = NULL;
+  struct dmp_dv_mem_stats stats0, stats1, stats2;
+  struct dmp_dv_cmdraw_conv_v0 conf;
+
+  dmp_dv_context ctx = dmp_dv_context_create();
+  if (!ctx) {
+    ERR("dmp_dv_context_create() failed: %s\n", dmp_dv_get_last_error_message());
+    goto L_EXIT;
+  }
+  input_mem = dmp_dv_mem_alloc(ctx, size);
+  output_mem = dmp_dv_mem_alloc(ctx, size);
+  if ((!input_mem) || (!output_mem)) {
+    ERR("dmp_dv_mem_alloc() failed: %s\n", dmp_dv_get_last_error_message());
+    goto L_EXIT;
+  }
+  uint8_t *ptr = dmp_dv_mem_map(input_mem);
+  if (!ptr) {
+    ERR("dmp_dv_mem_map() failed: %s\n", dmp_dv_get_last_error_message());
+    goto L_EXIT;
+  }
+  memset(ptr, 0, size);
+
+  // Single-run LRN layer which does not need weights
+  memset(&conf, 0, sizeof(conf));
+  conf.header.size = sizeof(conf);
+  conf.header.device_type = DMP_DV_DEV_CONV;
+  conf.header.version = 0;
+  conf.input_buf.mem = input_mem;
+  conf.output_buf.mem = output_mem;
+  conf.topo = 1;
+  conf.w = 56;
+  conf.h = 56;
+  conf.z = 1;
+  conf.c = 192;
+  conf.run[0].m = 192;
+  conf.run[0].p = 0x0101;
+  conf.run[0].pz = 1;
+  conf.run[0].conv_stride = 0x0101;
+  conf.run[0].pool_stride = 0x0101;
+  conf.run[0].lrn = 0x503;
+
+  cmdlist = dmp_dv_cmdlist_create(ctx);
+  if (!cmdlist) {
+    ERR("dmp_dv_cmdlist_create() failed: %s\n", dmp_dv_get_last_error_message());
+    goto L_EXIT;
+  }
+  if ((dmp_dv_cmdlist_set_managed_coherency(cmdlist, 1)) ||
+      (dmp_dv_cmdlist_add_raw(cmdlist, (struct dmp_dv_cmdraw*)&conf)) ||
+      (dmp_dv_cmdlist_commit(cmdlist))) {
+    ERR("Failed to create command list: %s\n", dmp_dv_get_last_error_message());
+    goto L_EXIT;
+  }
+  int64_t exec_id = dmp_dv_cmdlist_exec(cmdlist);
+  if (exec_id < 0) {
+    ERR("dmp_dv_cmdlist_exec() failed: %s\n", dmp_dv_get_last_error_message());
+    goto L_EXIT;
+  }
+  dmp_dv_mem_get_stats(&stats0);
+  if (dmp_dv_cmdlist_wait(cmdlist, exec_id)) {
+    ERR("dmp_dv_cmdlist_wait() failed: %s\n", dmp_dv_get_last_error_message());
+    goto L_EXIT;
+  }
+  dmp_dv_mem_get_stats(&stats1);
+  if ((stats1.n_calls[DMP_DV_MEM_OP_DMA_BUF_SYNC] != stats0.n_calls[DMP_DV_MEM_OP_DMA_BUF_SYNC]) ||
+      (stats1.bytes_invalidated != stats0.bytes_invalidated)) {
+    ERR("dmp_dv_cmdlist_wait() did cache maintenance for unmapped output: %llu DMA_BUF_IOCTL_SYNC calls, "
+        "%llu bytes invalidated\n",
+        (unsigned long long)(stats1.n_calls[DMP_DV_MEM_OP_DMA_BUF_SYNC] - stats0.n_calls[DMP_DV_MEM_OP_DMA_BUF_SYNC]),
+        (unsigned long long)(stats1.bytes_invalidated - stats0.bytes_invalidated));
+    goto L_EXIT;
+  }
+
+  // Deferred invalidation must happen on mapping
+  if (!dmp_dv_mem_map(output_mem)) {
+    ERR("dmp_dv_mem_map() failed: %s\n", dmp_dv_get_last_error_message());
+    goto L_EXIT;
+  }
+  dmp_dv_mem_get_stats(&stats2);
+  if (stats2.bytes_invalidated == stats1.bytes_invalidated) {
+    ERR("dmp_dv_mem_map() did not invalidate CPU caches for the output written by the device\n");
+    goto L_EXIT;
+  }
+
+  result = 0;
+
+  L_EXIT:
+
+  dmp_dv_cmdlist_release(cmdlist);
+  dmp_dv_mem_release(output_mem);
+  dmp_dv_mem_release(input_mem);
+  dmp_dv_context_release(ctx);
+
+  LOG("EXIT%s: managed_output_test()\n", result ? "(FAILED)" : "");
+  return result;
+}
+
+
+static void print_mem_stats() {
+  static const char *op_names[DMP_DV_MEM_OP_COUNT] = {
+    "ION_IOC_ALLOC", "mmap", "munmap", "DMA_BUF_IOCTL_SYNC", "to_device", "to_cpu", "sync_batch"};
+  struct dmp_dv_mem_stats stats;
+  if (dmp_dv_mem_get_stats(&stats)) {
+    ERR("dmp_dv_mem_get_stats() failed: %s\n", dmp_dv_get_last_error_message());
+    return;
+  }
+  for (int i = 0; i < DMP_DV_MEM_OP_COUNT; ++i) {
+    if (!stats.n_calls[i]) {
+      continue;
+    }
+    LOG("%s: %llu calls, %.3f msec avg\n", op_names[i], (unsigned long long)stats.n_calls[i],
+        1.0e-6 * stats.total_ns[i] / stats.n_calls[i]);
+  }
+  LOG("cache maintenance: %llu bytes cleaned, %llu bytes invalidated\n",
+      (unsigned long long)stats.bytes_cleaned, (unsigned long long)stats.bytes_invalidated);
+}
+
+
 int main(int argc, char **argv) {
   if (argc < 2) {
     fprintf(stdout, "USAGE: ./test_mem N_KB\n");
@@ -232,6 +690,8 @@ int main(int argc, char **argv) {
   int n_err = 0;
   int res = 0;
 
+  dmp_dv_mem_stats_enable(1);
+
   struct timespec ts0;
   clock_gettime(CLOCK_MONOTONIC, &ts0);
   uint32_t state[4] = {(uint32_t)ts0.tv_sec, (uint32_t)ts0.tv_nsec, 3, 4};
@@ -246,6 +706,48 @@ int main(int argc, char **argv) {
     }
   }
 
+  res = mem_pool_perf(n_kb << 10, 100);
+  if (res) {
+    ++n_err;
+  }
+  else {
+    ++n_ok;
+  }
+
+  res = cache_perf(n_kb << 10, 10);
+  if (res) {
+    ++n_err;
+  }
+  else {
+    ++n_ok;
+  }
+
+  res = upload_perf(n_kb << 10, 10);
+  if (res) {
+    ++n_err;
+  }
+  else {
+    ++n_ok;
+  }
+
+  res = copy_perf(n_kb << 10, 10);
+  if (res) {
+    ++n_err;
+  }
+  else {
+    ++n_ok;
+  }
+
+  res = managed_output_test();
+  if (res) {
+    ++n_err;
+  }
+  else {
+    ++n_ok;
+  }
+
+  print_mem_stats();
+
   LOG("Tests succeeded: %d\n", n_ok);
   LOG("Tests failed: %d\n", n_err);
   return n_err;
@@ -20,11 +20,14 @@
 #include <sys/mman.h>
 #include <time.h>
 #include <dirent.h>
+#include <stdlib.h>
+#include <errno.h>
 
 #include <stdio.h>
 #include <string.h>
 
 #include <memory>
+#include <vector>
 
 #include "dmp_dv.h"
 
@@ -236,6 +239,640 @@ int test_mem(size_t size) {
 }
 
 
+int test_suballoc(size_t size) {
+  LOG("ENTER: test_suballoc(%zu)\n", size);
+
+  dmp_dv_context ctx = NULL;
+  dmp_dv_mem mem = NULL, sub0 = NULL, sub1 = NULL, sub10 = NULL;
+  int result = -1;
+  uint8_t *arr = NULL, *arr0 = NULL, *arr1 = NULL, *arr10 = NULL;
+  const size_t half = (size >> 1) & ~(size_t)15;
+
+  ctx = dmp_dv_context_create();
+  if (!ctx) {
+    ERR("dmp_dv_context_create() failed: %s\n", dmp_dv_get_last_error_message());
+    goto L_EXIT;
+  }
+
+  mem = dmp_dv_mem_alloc(ctx, size);
+  if (!mem) {
+    ERR("dmp_dv_mem_alloc() failed: %s\n", dmp_dv_get_last_error_message());
+    goto L_EXIT;
+  }
+  sub0 = dmp_dv_mem_suballoc(mem, 0, half);
+  sub1 = dmp_dv_mem_suballoc(mem, half, size - half);
+  if ((!sub0) || (!sub1)) {
+    ERR("dmp_dv_mem_suballoc() failed: %s\n", dmp_dv_get_last_error_message());
+    goto L_EXIT;
+  }
+  sub10 = dmp_dv_mem_suballoc(sub1, 16, 16);
+  if (!sub10) {
+    ERR("dmp_dv_mem_suballoc() failed for nested region: %s\n", dmp_dv_get_last_error_message());
+    goto L_EXIT;
+  }
+  if (dmp_dv_mem_suballoc(sub0, 0, half + 16)) {
+    ERR("dmp_dv_mem_suballoc() succeeded for out of bounds region\n");
+    goto L_EXIT;
+  }
+  if (dmp_dv_mem_suballoc(mem, 8, 16)) {
+    ERR("dmp_dv_mem_suballoc() succeeded for unaligned offset\n");
+    goto L_EXIT;
+  }
+  if ((dmp_dv_mem_get_size(sub0) != half) || (dmp_dv_mem_get_size(sub10) != 16)) {
+    ERR("dmp_dv_mem_get_size() returned unexpected size for region\n");
+    goto L_EXIT;
+  }
+  if (dmp_dv_mem_get_total_size() != (int64_t)dmp_dv_mem_get_size(mem)) {
+    ERR("dmp_dv_mem_get_total_size() accounted memory regions: %lld\n", (long long)dmp_dv_mem_get_total_size());
+    goto L_EXIT;
+  }
+
+  arr1 = dmp_dv_mem_map(sub1);
+  arr0 = dmp_dv_mem_map(sub0);
+  arr10 = dmp_dv_mem_map(sub10);
+  arr = dmp_dv_mem_map(mem);
+  if ((!arr) || (arr0 != arr) || (arr1 != arr + half) || (arr10 != arr + half + 16)) {
+    ERR("dmp_dv_mem_map() returned unexpected pointers for regions\n");
+    goto L_EXIT;
+  }
+  memset(arr10, 0x5A, 16);
+  if (dmp_dv_mem_to_device(sub10, 0, 16, 0)) {
+    ERR("dmp_dv_mem_to_device() failed: %s\n", dmp_dv_get_last_error_message());
+    goto L_EXIT;
+  }
+  if (!dmp_dv_mem_to_device(sub10, 0, 32, 0)) {
+    ERR("dmp_dv_mem_to_device() succeeded for out of bounds range\n");
+    goto L_EXIT;
+  }
+  dmp_dv_mem_unmap(sub0);
+  if (dmp_dv_mem_map(mem) != arr) {
+    ERR("dmp_dv_mem_unmap() on region unmapped the parent\n");
+    goto L_EXIT;
+  }
+
+  // The parent must survive release of its own handle while regions are alive
+  dmp_dv_mem_release(mem);
+  mem = NULL;
+  if (arr[half + 16] != 0x5A) {
+    ERR("Region content is not visible through the parent\n");
+    goto L_EXIT;
+  }
+
+  result = 0;
+
+  L_EXIT:
+
+  dmp_dv_mem_release(sub10);
+  dmp_dv_mem_release(sub1);
+  dmp_dv_mem_release(sub0);
+  dmp_dv_mem_release(mem);
+  dmp_dv_context_release(ctx);
+
+  if (dmp_dv_mem_get_total_size()) {
+    ERR("dmp_dv_mem_get_total_size() returned non-zero: %lld\n",
+        (long long)dmp_dv_mem_get_total_size());
+    result = -1;
+  }
+
+  LOG("EXIT%s: test_suballoc(%zu)\n", result ? "(FAILED)" : "", size);
+  return result;
+}
+
+
+int test_map_ex(size_t size) {
+  LOG("ENTER: test_map_ex(%zu)\n", size);
+
+  dmp_dv_context ctx = NULL;
+  dmp_dv_mem mem = NULL;
+  int result = -1;
+  uint8_t *arr = NULL, *win = NULL, *win2 = NULL, *ro = NULL;
+  const size_t offs = (size >> 1) + 16;
+
+  ctx = dmp_dv_context_create();
+  if (!ctx) {
+    ERR("dmp_dv_context_create() failed: %s\n", dmp_dv_get_last_error_message());
+    goto L_EXIT;
+  }
+
+  mem = dmp_dv_mem_alloc(ctx, size);
+  if (!mem) {
+    ERR("dmp_dv_mem_alloc() failed: %s\n", dmp_dv_get_last_error_message());
+    goto L_EXIT;
+  }
+  if (dmp_dv_mem_map_ex(mem, dmp_dv_mem_get_size(mem), 16, 0)) {
+    ERR("dmp_dv_mem_map_ex() succeeded for out of bounds window\n");
+    goto L_EXIT;
+  }
+  win = dmp_dv_mem_map_ex(mem, offs, 16, DMP_DV_MEM_MAP_POPULATE);
+  win2 = dmp_dv_mem_map_ex(mem, offs, 16, DMP_DV_MEM_MAP_POPULATE);
+  if ((!win) || (win2 != win)) {
+    ERR("dmp_dv_mem_map_ex() failed: %s\n", dmp_dv_get_last_error_message());
+    goto L_EXIT;
+  }
+  memset(win, 0xA5, 16);
+  if (dmp_dv_mem_to_device(mem, offs, 16, 0)) {
+    ERR("dmp_dv_mem_to_device() failed on the window: %s\n", dmp_dv_get_last_error_message());
+    goto L_EXIT;
+  }
+  if (!dmp_dv_mem_to_device(mem, 0, 16, 0)) {
+    ERR("dmp_dv_mem_to_device() succeeded for unmapped range\n");
+    goto L_EXIT;
+  }
+  ro = dmp_dv_mem_map_ex(mem, 0, 0, DMP_DV_MEM_MAP_READ_ONLY);
+  if ((!ro) || (ro[offs] != 0xA5)) {
+    ERR("dmp_dv_mem_map_ex() failed for read-only mapping: %s\n", dmp_dv_get_last_error_message());
+    goto L_EXIT;
+  }
+  if ((dmp_dv_mem_unmap_ex(mem, win)) || (dmp_dv_mem_unmap_ex(mem, win2)) || (dmp_dv_mem_unmap_ex(mem, ro))) {
+    ERR("dmp_dv_mem_unmap_ex() failed: %s\n", dmp_dv_get_last_error_message());
+    goto L_EXIT;
+  }
+  if (!dmp_dv_mem_unmap_ex(mem, win)) {
+    ERR("dmp_dv_mem_unmap_ex() succeeded for already unmapped window\n");
+    goto L_EXIT;
+  }
+  arr = dmp_dv_mem_map(mem);
+  if ((!arr) || (arr[offs] != 0xA5)) {
+    ERR("Window content is not visible through the full mapping\n");
+    goto L_EXIT;
+  }
+  // Leave the window mapped, it must be unmapped on release
+  if (!dmp_dv_mem_map_ex(mem, 0, 16, 0)) {
+    ERR("dmp_dv_mem_map_ex() failed: %s\n", dmp_dv_get_last_error_message());
+    goto L_EXIT;
+  }
+
+  result = 0;
+
+  L_EXIT:
+
+  dmp_dv_mem_release(mem);
+  dmp_dv_context_release(ctx);
+
+  LOG("EXIT%s: test_map_ex(%zu)\n", result ? "(FAILED)" : "", size);
+  return result;
+}
+
+
+int test_sync_batch(size_t size) {
+  LOG("ENTER: test_sync_batch(%zu)\n", size);
+
+  dmp_dv_context ctx = NULL;
+  dmp_dv_mem mem = NULL, sub = NULL;
+  int result = -1;
+  const size_t half = (size >> 1) & ~(size_t)15;
+  struct dmp_dv_mem_range ranges[4];
+
+  ctx = dmp_dv_context_create();
+  if (!ctx) {
+    ERR("dmp_dv_context_create() failed: %s\n", dmp_dv_get_last_error_message());
+    goto L_EXIT;
+  }
+  mem = dmp_dv_mem_alloc(ctx, size);
+  if (!mem) {
+    ERR("dmp_dv_mem_alloc() failed: %s\n", dmp_dv_get_last_error_message());
+    goto L_EXIT;
+  }
+  sub = dmp_dv_mem_suballoc(mem, half, size - half);
+  if (!sub) {
+    ERR("dmp_dv_mem_suballoc() failed: %s\n", dmp_dv_get_last_error_message());
+    goto L_EXIT;
+  }
+
+  memset(ranges, 0, sizeof(ranges));
+  ranges[0].mem = mem;
+  ranges[0].offs = 0;
+  ranges[0].size = half;
+  ranges[0].direction = DMP_DV_MEM_TO_DEVICE;
+  ranges[1].mem = sub;
+  ranges[1].offs = 0;
+  ranges[1].size = size - half;
+  ranges[1].direction = DMP_DV_MEM_TO_DEVICE;
+  ranges[2].mem = sub;
+  ranges[2].offs = 16;
+  ranges[2].size = 16;
+  ranges[2].direction = DMP_DV_MEM_TO_CPU;
+  ranges[3].mem = mem;
+  ranges[3].size = 0;
+  ranges[3].direction = DMP_DV_MEM_TO_CPU;
+
+  if (!dmp_dv_mem_sync_batch(ranges, 4)) {
+    ERR("dmp_dv_mem_sync_batch() succeeded on unmapped memory\n");
+    goto L_EXIT;
+  }
+  if (!dmp_dv_mem_map(mem)) {
+    ERR("dmp_dv_mem_map() failed: %s\n", dmp_dv_get_last_error_message());
+    goto L_EXIT;
+  }
+  if (dmp_dv_mem_sync_batch(ranges, 4)) {
+    ERR("dmp_dv_mem_sync_batch() failed: %s\n", dmp_dv_get_last_error_message());
+    goto L_EXIT;
+  }
+  ranges[2].direction = 2;
+  if (!dmp_dv_mem_sync_batch(ranges, 4)) {
+    ERR("dmp_dv_mem_sync_batch() succeeded with invalid direction\n");
+    goto L_EXIT;
+  }
+  ranges[2].direction = DMP_DV_MEM_TO_CPU;
+  ranges[2].offs = size - half;
+  if (!dmp_dv_mem_sync_batch(ranges, 4)) {
+    ERR("dmp_dv_mem_sync_batch() succeeded for out of bounds range\n");
+    goto L_EXIT;
+  }
+
+  result = 0;
+
+  L_EXIT:
+
+  dmp_dv_mem_release(sub);
+  dmp_dv_mem_release(mem);
+  dmp_dv_context_release(ctx);
+
+  LOG("EXIT%s: test_sync_batch(%zu)\n", result ? "(FAILED)" : "", size);
+  return result;
+}
+
+
+int test_import_fd(size_t size) {
+  LOG("ENTER: test_import_fd(%zu)\n", size);
+
+  dmp_dv_context ctx = NULL;
+  dmp_dv_mem mem = NULL;
+  int result = -1;
+  uint8_t *arr = NULL;
+  char fnme[] = "/tmp/test_mem_XXXXXX";
+  const int64_t total_size = dmp_dv_mem_get_total_size();
+
+  // Regular file is used in place of the dma-buf produced by the external driver
+  int fd = mkstemp(fnme);
+  if (fd == -1) {
+    ERR("mkstemp() failed\n");
+    goto L_EXIT;
+  }
+  unlink(fnme);
+  if (ftruncate(fd, size)) {
+    ERR("ftruncate() failed\n");
+    goto L_EXIT;
+  }
+  if (pwrite(fd, "DV", 2, 16) != 2) {
+    ERR("pwrite() failed\n");
+    goto L_EXIT;
+  }
+
+  ctx = dmp_dv_context_create();
+  if (!ctx) {
+    ERR("dmp_dv_context_create() failed: %s\n", dmp_dv_get_last_error_message());
+    goto L_EXIT;
+  }
+  if (dmp_dv_mem_import_fd(ctx, -1, 0)) {
+    ERR("dmp_dv_mem_import_fd() succeeded for invalid file descriptor\n");
+    goto L_EXIT;
+  }
+  if (dmp_dv_mem_import_fd(ctx, fd, size + 1)) {
+    ERR("dmp_dv_mem_import_fd() succeeded for size greater than the buffer size\n");
+    goto L_EXIT;
+  }
+  mem = dmp_dv_mem_import_fd(ctx, fd, 0);
+  if (!mem) {
+    ERR("dmp_dv_mem_import_fd() failed: %s\n", dmp_dv_get_last_error_message());
+    goto L_EXIT;
+  }
+  close(fd);  // memory handle holds its own file descriptor
+  fd = -1;
+
+  if (dmp_dv_mem_get_size(mem) != size) {
+    ERR("dmp_dv_mem_get_size() returned %zu while %zu was expected\n", dmp_dv_mem_get_size(mem), size);
+    goto L_EXIT;
+  }
+  if (dmp_dv_mem_get_total_size() != total_size) {
+    ERR("dmp_dv_mem_get_total_size() accounted imported memory\n");
+    goto L_EXIT;
+  }
+  arr = dmp_dv_mem_map(mem);
+  if (!arr) {
+    ERR("dmp_dv_mem_map() failed: %s\n", dmp_dv_get_last_error_message());
+    goto L_EXIT;
+  }
+  if ((arr[16] != 'D') || (arr[17] != 'V')) {
+    ERR("Imported memory content mismatch\n");
+    goto L_EXIT;
+  }
+  if (dmp_dv_mem_to_device(mem, 16, 2, 0)) {
+    ERR("dmp_dv_mem_to_device() failed: %s\n", dmp_dv_get_last_error_message());
+    goto L_EXIT;
+  }
+
+  result = 0;
+
+  L_EXIT:
+
+  dmp_dv_mem_release(mem);
+  dmp_dv_context_release(ctx);
+  if (fd != -1) {
+    close(fd);
+  }
+
+  LOG("EXIT%s: test_import_fd(%zu)\n", result ? "(FAILED)" : "", size);
+  return result;
+}
+
+
+static void evict_one(dmp_dv_context ctx, size_t bytes_needed, void *user_data) {
+  dmp_dv_mem *victim = (dmp_dv_mem*)user_data;
+  dmp_dv_mem_release(*victim);
+  *victim = NULL;
+}
+
+
+int test_mem_budget(size_t size) {
+  LOG("ENTER: test_mem_budget(%zu)\n", size);
+
+  dmp_dv_context ctx = NULL;
+  dmp_dv_mem mem0 = NULL, mem1 = NULL, victim = NULL;
+  int result = -1;
+  struct dmp_dv_mem_usage usage;
+
+  ctx = dmp_dv_context_create();
+  if (!ctx) {
+    ERR("dmp_dv_context_create() failed: %s\n", dmp_dv_get_last_error_message());
+    goto L_EXIT;
+  }
+  mem0 = dmp_dv_mem_alloc(ctx, size);
+  if (!mem0) {
+    ERR("dmp_dv_mem_alloc() failed: %s\n", dmp_dv_get_last_error_message());
+    goto L_EXIT;
+  }
+  dmp_dv_context_get_mem_usage(ctx, &usage);
+  if ((usage.live_bytes != dmp_dv_mem_get_size(mem0)) || (usage.n_allocs != 1) || (usage.n_live != 1)) {
+    ERR("Unexpected memory usage: live_bytes=%llu n_allocs=%llu n_live=%llu\n",
+        (unsigned long long)usage.live_bytes, (unsigned long long)usage.n_allocs, (unsigned long long)usage.n_live);
+    goto L_EXIT;
+  }
+
+  // Budget for a single allocation without callback must fail the second one
+  dmp_dv_context_set_mem_budget(ctx, dmp_dv_mem_get_size(mem0), NULL, NULL);
+  mem1 = dmp_dv_mem_alloc(ctx, size);
+  if (mem1) {
+    ERR("dmp_dv_mem_alloc() succeeded while exceeding the budget\n");
+    goto L_EXIT;
+  }
+
+  // Eviction callback releases the first allocation
+  victim = mem0;
+  mem0 = NULL;
+  dmp_dv_context_set_mem_budget(ctx, dmp_dv_mem_get_size(victim), evict_one, &victim);
+  mem1 = dmp_dv_mem_alloc(ctx, size);
+  if ((!mem1) || (victim)) {
+    ERR("dmp_dv_mem_alloc() failed to evict memory: %s\n", dmp_dv_get_last_error_message());
+    goto L_EXIT;
+  }
+
+  dmp_dv_context_get_mem_usage(ctx, &usage);
+  if ((usage.n_allocs != 2) || (usage.n_live != 1) || (usage.n_budget_failures != 1) ||
+      (usage.peak_bytes != usage.live_bytes)) {
+    ERR("Unexpected memory usage: n_allocs=%llu n_live=%llu n_budget_failures=%llu peak_bytes=%llu\n",
+        (unsigned long long)usage.n_allocs, (unsigned long long)usage.n_live,
+        (unsigned long long)usage.n_budget_failures, (unsigned long long)usage.peak_bytes);
+    goto L_EXIT;
+  }
+
+  result = 0;
+
+  L_EXIT:
+
+  dmp_dv_mem_release(victim);
+  dmp_dv_mem_release(mem1);
+  dmp_dv_mem_release(mem0);
+  if (ctx) {
+    dmp_dv_context_get_mem_usage(ctx, &usage);
+    if (usage.live_bytes) {
+      ERR("Context memory usage is %llu bytes after all memory was released\n",
+          (unsigned long long)usage.live_bytes);
+      result = -1;
+    }
+  }
+  dmp_dv_context_release(ctx);
+
+  LOG("EXIT%s: test_mem_budget(%zu)\n", result ? "(FAILED)" : "", size);
+  return result;
+}
+
+
+int test_ring(size_t size) {
+  LOG("ENTER: test_ring(%zu)\n", size);
+
+  dmp_dv_context ctx = NULL;
+  dmp_dv_ring ring = NULL;
+  int result = -1;
+  const int n_slots = 3;
+  int res;
+
+  ctx = dmp_dv_context_create();
+  if (!ctx) {
+    ERR("dmp_dv_context_create() failed: %s\n", dmp_dv_get_last_error_message());
+    goto L_EXIT;
+  }
+  ring = dmp_dv_ring_create(ctx, size, n_slots);
+  if (!ring) {
+    ERR("dmp_dv_ring_create() failed: %s\n", dmp_dv_get_last_error_message());
+    goto L_EXIT;
+  }
+  for (int i = 0; i < n_slots; ++i) {
+    dmp_dv_mem mem = dmp_dv_ring_get_slot(ring, i);
+    if ((!mem) || (dmp_dv_mem_get_size(mem) != size)) {
+      ERR("dmp_dv_ring_get_slot() returned unexpected slot %d: %s\n", i, dmp_dv_get_last_error_message());
+      goto L_EXIT;
+    }
+    res = dmp_dv_ring_acquire(ring, 0);
+    if (res != i) {
+      ERR("dmp_dv_ring_acquire() returned %d while expecting %d\n", res, i);
+      goto L_EXIT;
+    }
+  }
+
+  // All slots are acquired
+  res = dmp_dv_ring_acquire(ring, 0);
+  if (res != -EBUSY) {
+    ERR("dmp_dv_ring_acquire() returned %d while expecting %d\n", res, -EBUSY);
+    goto L_EXIT;
+  }
+
+  // Slot returned without execution must be reusable immediately
+  if (dmp_dv_ring_commit(ring, 0, NULL, 0)) {
+    ERR("dmp_dv_ring_commit() failed: %s\n", dmp_dv_get_last_error_message());
+    goto L_EXIT;
+  }
+  res = dmp_dv_ring_acquire(ring, 0);
+  if (res != 0) {
+    ERR("dmp_dv_ring_acquire() returned %d while expecting 0\n", res);
+    goto L_EXIT;
+  }
+
+  result = 0;
+
+  L_EXIT:
+
+  dmp_dv_ring_release(ring);
+  dmp_dv_context_release(ctx);
+
+  LOG("EXIT%s: test_ring(%zu)\n", result ? "(FAILED)" : "", size);
+  return result;
+}
+
+
+int test_load_file(size_t size) {
+  LOG("ENTER: test_load_file(%zu)\n", size);
+
+  dmp_dv_context ctx = NULL;
+  dmp_dv_mem mem = NULL;
+  int result = -1;
+  uint8_t *arr = NULL;
+  char fnme[] = "/tmp/test_mem_XXXXXX";
+  std::vector<uint8_t> data(size);
+  for (size_t i = 0; i < size; ++i) {
+    data[i] = (uint8_t)(i * 7 + 3);
+  }
+
+  int fd = mkstemp(fnme);
+  if (fd == -1) {
+    ERR("mkstemp() failed\n");
+    goto L_EXIT;
+  }
+  if (pwrite(fd, data.data(), size, 0) != (ssize_t)size) {
+    ERR("pwrite() failed\n");
+    goto L_EXIT;
+  }
+
+  ctx = dmp_dv_context_create();
+  if (!ctx) {
+    ERR("dmp_dv_context_create() failed: %s\n", dmp_dv_get_last_error_message());
+    goto L_EXIT;
+  }
+  mem = dmp_dv_mem_alloc(ctx, size);
+  if (!mem) {
+    ERR("dmp_dv_mem_alloc() failed: %s\n", dmp_dv_get_last_error_message());
+    goto L_EXIT;
+  }
+
+  // Unmapped memory, skip the first page of the file
+  if (dmp_dv_mem_load_file(mem, 0, fnme, 4096, size - 4096, DMP_DV_MEM_LOAD_DIRECT)) {
+    ERR("dmp_dv_mem_load_file() failed: %s\n", dmp_dv_get_last_error_message());
+    goto L_EXIT;
+  }
+  if (!dmp_dv_mem_load_file(mem, 0, fnme, 4096, size - 4095, 0)) {
+    ERR("dmp_dv_mem_load_file() succeeded past the end of file\n");
+    goto L_EXIT;
+  }
+  arr = dmp_dv_mem_map(mem);
+  if (!arr) {
+    ERR("dmp_dv_mem_map() failed: %s\n", dmp_dv_get_last_error_message());
+    goto L_EXIT;
+  }
+  if (dmp_dv_mem_to_cpu(mem, 0, size, 0)) {
+    ERR("dmp_dv_mem_to_cpu() failed: %s\n", dmp_dv_get_last_error_message());
+    goto L_EXIT;
+  }
+  if (memcmp(arr, data.data() + 4096, size - 4096)) {
+    ERR("Loaded memory content mismatch\n");
+    goto L_EXIT;
+  }
+
+  // Mapped memory at unaligned offsets
+  if (dmp_dv_mem_load_file(mem, 16, fnme, 3, 100, 0)) {
+    ERR("dmp_dv_mem_load_file() failed: %s\n", dmp_dv_get_last_error_message());
+    goto L_EXIT;
+  }
+  if (memcmp(arr + 16, data.data() + 3, 100)) {
+    ERR("Loaded memory content mismatch\n");
+    goto L_EXIT;
+  }
+
+  result = 0;
+
+  L_EXIT:
+
+  dmp_dv_mem_release(mem);
+  dmp_dv_context_release(ctx);
+  if (fd != -1) {
+    close(fd);
+    unlink(fnme);
+  }
+
+  LOG("EXIT%s: test_load_file(%zu)\n", result ? "(FAILED)" : "", size);
+  return result;
+}
+
+
+int test_copy_fill(size_t size) {
+  LOG("ENTER: test_copy_fill(%zu)\n", size);
+
+  dmp_dv_context ctx = NULL;
+  dmp_dv_mem src = NULL, dst = NULL;
+  int result = -1;
+  uint8_t *src_ptr = NULL, *dst_ptr = NULL;
+
+  ctx = dmp_dv_context_create();
+  if (!ctx) {
+    ERR("dmp_dv_context_create() failed: %s\n", dmp_dv_get_last_error_message());
+    goto L_EXIT;
+  }
+  src = dmp_dv_mem_alloc(ctx, size);
+  dst = dmp_dv_mem_alloc(ctx, size);
+  if ((!src) || (!dst)) {
+    ERR("dmp_dv_mem_alloc() failed: %s\n", dmp_dv_get_last_error_message());
+    goto L_EXIT;
+  }
+  src_ptr = dmp_dv_mem_map(src);
+  if (!src_ptr) {
+    ERR("dmp_dv_mem_map() failed: %s\n", dmp_dv_get_last_error_message());
+    goto L_EXIT;
+  }
+  for (size_t i = 0; i < size; ++i) {
+    src_ptr[i] = (uint8_t)(i * 7 + 3);
+  }
+
+  // Destination is not mapped, offsets are not cache line aligned
+  if (dmp_dv_mem_fill(dst, 0, 0xA5, size, 0)) {
+    ERR("dmp_dv_mem_fill() failed: %s\n", dmp_dv_get_last_error_message());
+    goto L_EXIT;
+  }
+  if (dmp_dv_mem_copy(dst, 3, src, 5, size - 16, DMP_DV_MEM_CPU_WONT_READ)) {
+    ERR("dmp_dv_mem_copy() failed: %s\n", dmp_dv_get_last_error_message());
+    goto L_EXIT;
+  }
+  if (!dmp_dv_mem_copy(src, 0, src, 1, 2, 0)) {
+    ERR("dmp_dv_mem_copy() succeeded on overlapping ranges\n");
+    goto L_EXIT;
+  }
+
+  dst_ptr = dmp_dv_mem_map(dst);
+  if (!dst_ptr) {
+    ERR("dmp_dv_mem_map() failed: %s\n", dmp_dv_get_last_error_message());
+    goto L_EXIT;
+  }
+  if (dmp_dv_mem_to_cpu(dst, 0, size, 0)) {
+    ERR("dmp_dv_mem_to_cpu() failed: %s\n", dmp_dv_get_last_error_message());
+    goto L_EXIT;
+  }
+  if ((dst_ptr[0] != 0xA5) || (dst_ptr[2] != 0xA5) || (dst_ptr[size - 13] != 0xA5) || (dst_ptr[size - 1] != 0xA5) ||
+      (memcmp(dst_ptr + 3, src_ptr + 5, size - 16))) {
+    ERR("Copied memory content mismatch\n");
+    goto L_EXIT;
+  }
+
+  result = 0;
+
+  L_EXIT:
+
+  dmp_dv_mem_release(dst);
+  dmp_dv_mem_release(src);
+  dmp_dv_context_release(ctx);
+
+  LOG("EXIT%s: test_copy_fill(%zu)\n", result ? "(FAILED)" : "", size);
+  return result;
+}
+
+
 int main(int argc, char **argv) {
   if (argc < 2) {
     fprintf(stdout, "USAGE: ./test_mem N_KB\n");
@@ -263,6 +900,70 @@ int main(int argc, char **argv) {
     }
   }
 
+  res = test_suballoc(n_kb << 10);
+  if (res) {
+    ++n_err;
+  }
+  else {
+    ++n_ok;
+  }
+
+  res = test_map_ex(n_kb << 10);
+  if (res) {
+    ++n_err;
+  }
+  else {
+    ++n_ok;
+  }
+
+  res = test_sync_batch(n_kb << 10);
+  if (res) {
+    ++n_err;
+  }
+  else {
+    ++n_ok;
+  }
+
+  res = test_import_fd(n_kb << 10);
+  if (res) {
+    ++n_err;
+  }
+  else {
+    ++n_ok;
+  }
+
+  res = test_mem_budget(n_kb << 10);
+  if (res) {
+    ++n_err;
+  }
+  else {
+    ++n_ok;
+  }
+
+  res = test_ring(n_kb << 10);
+  if (res) {
+    ++n_err;
+  }
+  else {
+    ++n_ok;
+  }
+
+  res = test_load_file(n_kb << 10);
+  if (res) {
+    ++n_err;
+  }
+  else {
+    ++n_ok;
+  }
+
+  res = test_copy_fill(n_kb << 10);
+  if (res) {
+    ++n_err;
+  }
+  else {
+    ++n_ok;
+  }
+
   LOG("Tests succeeded: %d\n", n_ok);
   LOG("Tests failed: %d\n", n_err);
   return n_err;
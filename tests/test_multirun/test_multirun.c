@@ -17,6 +17,7 @@
  * @brief Test that multirun configuration does not hang.
  */
 #include <unistd.h>
+#include <poll.h>
 #include <sys/mman.h>
 #include <time.h>
 #include <dirent.h>
@@ -107,7 +108,51 @@ static int fill_mem(dmp_dv_mem mem, uint32_t state[4]) {
 }
 
 
-int exec_command(dmp_dv_context ctx, struct dmp_dv_cmdraw_conv_v0 *conf_ptr) {
+static void on_exec_completed(dmp_dv_cmdlist cmdlist, int64_t exec_id, int result, void *user_data) {
+  __sync_lock_test_and_set((int*)user_data, result ? -1 : 1);
+}
+
+
+int exec_command_async(dmp_dv_context ctx, dmp_dv_cmdlist cmdlist) {
+  int completed = 0;
+  uint64_t counter;
+
+  LOG("Executing command list with completion callback...\n");
+  struct pollfd pfd;
+  pfd.fd = dmp_dv_context_get_completion_fd(ctx);
+  pfd.events = POLLIN;
+  if (pfd.fd < 0) {
+    ERR("dmp_dv_context_get_completion_fd() failed: %s\n", dmp_dv_get_last_error_message());
+    return -1;
+  }
+  int64_t exec_id = dmp_dv_cmdlist_exec_async(cmdlist, on_exec_completed, &completed);
+  if (exec_id < 0) {
+    ERR("dmp_dv_cmdlist_exec_async() failed: %s\n", dmp_dv_get_last_error_message());
+    return -1;
+  }
+  while (!__sync_add_and_fetch(&completed, 0)) {
+    if (poll(&pfd, 1, 10000) != 1) {
+      ERR("Completion descriptor was not signaled within 10 seconds\n");
+      return -1;
+    }
+    if (read(pfd.fd, &counter, sizeof(counter)) != sizeof(counter)) {
+      ERR("read() from completion descriptor failed\n");
+      return -1;
+    }
+  }
+  if (completed != 1) {
+    ERR("Execution reported to the completion callback has failed\n");
+    return -1;
+  }
+  if (dmp_dv_cmdlist_poll(cmdlist, exec_id)) {
+    ERR("dmp_dv_cmdlist_poll() failed after completion: %s\n", dmp_dv_get_last_error_message());
+    return -1;
+  }
+  return 0;
+}
+
+
+int exec_command(dmp_dv_context ctx, struct dmp_dv_cmdraw_conv_v0 *conf_ptr, int async) {
   dmp_dv_cmdlist cmdlist = NULL;
   int result = -1;
 
@@ -141,6 +186,10 @@ int exec_command(dmp_dv_context ctx, struct dmp_dv_cmdraw_conv_v0 *conf_ptr) {
     goto L_EXIT;
   }
 
+  if ((async) && (exec_command_async(ctx, cmdlist))) {
+    goto L_EXIT;
+  }
+
   result = 0;
 
   L_EXIT:
@@ -191,7 +240,7 @@ int run_conf_lrn(dmp_dv_context ctx, dmp_dv_mem weights_mem, dmp_dv_mem io_mem,
   conf.run[0].rectifi_en = 0;
   conf.run[0].lrn = 0x503;
 
-  return exec_command(ctx, &conf);
+  return exec_command(ctx, &conf, 1);  // completion callback is checked on this config only
 }
 
 
@@ -276,7 +325,7 @@ int run_conf_squeezenet(dmp_dv_context ctx, dmp_dv_mem weights_mem, dmp_dv_mem i
   conf.run[1].rectifi_en = 0;  // Rectification, i.e. max(0, x) (NOTE: Can be applied after non-ReLU activation function)
   conf.run[1].lrn = 0x0;  // [0] : 1 = LRN enable, 0 = LRN disable, [1] : 1 = incl. power func, 0 = excl., [8:11] = x^2 scale factor log2
 
-  return exec_command(ctx, &conf);
+  return exec_command(ctx, &conf, 0);
 }
 
 
@@ -495,7 +544,7 @@ int run_conf_googlenet(dmp_dv_context ctx, dmp_dv_mem weights_mem, dmp_dv_mem io
   conf.run[6].rectifi_en = 0;  // Rectification, i.e. max(0, x) (NOTE: Can be applied after non-ReLU activation function)
   conf.run[6].lrn = 0x0;  // [0] : 1 = LRN enable, 0 = LRN disable, [1] : 1 = incl. power func, 0 = excl., [8:11] = x^2 scale factor log2
 
-  return exec_command(ctx, &conf);
+  return exec_command(ctx, &conf, 0);
 }
 
 